@@ -11,17 +11,25 @@
   cktanx@gmail.com.
 */
 
+#define _GNU_SOURCE
 #include "csv.h"
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #ifdef __ARM_NEON__
 #include "simde/x86/sse2.h"
 #include "simde/x86/sse4.2.h"
 #include "simde/x86/avx2.h"
+#include "simde/x86/clmul.h"
 #else
 #include <x86intrin.h>
 #endif
@@ -29,27 +37,91 @@
 #define likely(x) __builtin_expect((x), 1)
 #define unlikely(x) __builtin_expect((x), 0)
 
+typedef struct kernel_t kernel_t;
+
+/* the special chars of a dialect, and their nibble lookup tables */
+typedef struct dialect_t dialect_t;
+struct dialect_t {
+  char qte, esc, delim;
+  uint8_t lo[16]; /* class bits by low nibble */
+  uint8_t hi[16]; /* class bits by high nibble */
+};
+
 typedef struct scan_t scan_t;
 struct scan_t {
-  uint32_t bmap;
+  uint64_t qemap; /* qte and esc chars in the current block */
+  uint64_t smap;  /* delim, \n and \r chars in the current block */
+  void (*bmap64)(const char *p, const dialect_t *dl, uint64_t *qemap,
+                 uint64_t *smap);
   const char *base;
   const char *q;
-  char qte;
-  char esc;
-  char delim;
+  const dialect_t *dl;
 };
 
+/* dialects with parsers specialized at compile time; all of them have
+ * an empty nullstr */
+#define SPEC_ANY 0 /* whatever was given to csv_open */
+#define SPEC_CSV 1 /* , with " quote and " escape */
+#define SPEC_PSV 2 /* | with " quote and \ escape */
+#define SPEC_TSV 3 /* tab with " quote and " escape */
+
+/* row terminators */
+#define EOL_LF 1
+#define EOL_CR 2
+#define EOL_CRLF 3
+
 struct csv_parse_t {
+  /* fld[], qmap[], nmap[] and len[] share one block at fld */
   int fldmax;           /* num allocated elements in fld[] */
   int fldtop;           /* num used elements in fld[]. fld[fldtop-1] is valid */
   char **fld;           /* fld[] - points to each field */
+  uint64_t *qmap;       /* qmap[] - bit i set if field i is quoted */
+  int qtop;             /* qmap[qtop..] is all zero */
+  uint64_t *nmap;       /* nmap[] - bit i set if field i may be a sql NULL */
+  int ntop;             /* nmap[ntop..] is all zero */
   int *len;             /* len[] - length of each field */
-  char *quoted;         /* quoted[] - flag if field is quoted */
   char qte, esc, delim; /* quote, escape, delim chars */
   char nullstr[20];     /* null indicator string */
   int nullstrsz;        /* strlen(nullstr) */
+  dialect_t dl;         /* special chars for the simd kernels */
+  int spec;             /* SPEC_xx for the parsers to dispatch on */
+
+  uint64_t *proj; /* proj[] - bit i set if column i is selected, or NULL */
+  int projmax;    /* num columns covered by proj[]; the rest are not */
+
+  int eol;      /* EOL_xx of the first row; all rows must end the same way */
+  int eob;      /* a \r at the end of buf[] ends the row */
+  int eof;      /* buf[] ends at the end of input, which ends the row */
 
-  char *lastbuf; /* used by feed_last when we must add \n to end */
+  char *lastbuf; /* feed_last: copy of a last field that runs to the end */
+  int lastbufsz;
+
+  char *grepbuf; /* csv_feed_grep: value of a quoted field */
+  int grepbufsz;
+
+  const kernel_t *kern; /* simd kernels picked for this cpu */
+
+  csv_sindex_t six; /* structural index used by csv_line when esc == qte */
+  int sixcur;       /* next unconsumed element in six.pos[] */
+  int sixnext;      /* offset in six.buf[] where the next row starts */
+
+  /* where csv_line stopped in a row that did not fit in buf[] */
+  struct {
+    int ok;        /* the next csv_line may pick up from here */
+    int again;     /* csv_feed_again: the next call passes the same row */
+    int cno;       /* fields done; their len[] and qmap[] are kept */
+    int fldstart;  /* offset of the current field from the row start */
+    int top;       /* offset from the row start where scanning resumes */
+    int quoted;    /* fsm: the current field has quotes */
+    int inquote;   /* fsm: in QUOTED state; sindex: inside quotes at top */
+    int qpend;     /* sindex: a quote since the last structural char */
+    char head[16]; /* first bytes of the row, to recognize it */
+  } resume;
+
+  csv_batch_t batch; /* rows returned by csv_feed_batch */
+
+  csv_view_t *view; /* view[] - fields returned by csv_feed_view */
+  int viewmax;      /* num allocated elements in view[] */
 
   struct {
     int64_t linenum;
@@ -68,507 +140,5241 @@ struct csv_parse_t {
   scan_t scan;
 };
 
-static inline uint32_t fillbmap(const __m256i *p, char qte, char esc,
-                                char delim) {
-  __m256i src = _mm256_loadu_si256(p);
-  __m256i pat0 = _mm256_set1_epi8(qte);
-  __m256i pat2 = _mm256_set1_epi8(delim);
-  __m256i pat3 = _mm256_set1_epi8('\n');
+#if defined(__x86_64__) || defined(__i386__)
+#define CSV_X86 1
+#define TARGET(x) __attribute__((target(x)))
+#else
+#define TARGET(x)
+#endif
+
+#define INLINE static inline __attribute__((always_inline))
 
-  int32_t flag0 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(src, pat0));
-  int32_t flag1 = (esc == qte) ? 0 : _mm256_movemask_epi8(_mm256_cmpeq_epi8(
-                                         src, _mm256_set1_epi8(esc)));
-  int32_t flag2 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(src, pat2));
-  int32_t flag3 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(src, pat3));
+/* the smallest page size of the supported targets */
+#define PAGE_MIN 4096
 
-  // return ntohl(flag0|flag1|flag2|flag3);
-  return flag0 | flag1 | flag2 | flag3;
-}
+/* asan and valgrind object to reading past the end of a buffer */
+#if defined(__SANITIZE_ADDRESS__) || defined(CSV_NO_OVERREAD)
+#define OVERREAD 0
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define OVERREAD 0
+#endif
+#endif
+#ifndef OVERREAD
+#define OVERREAD 1
+#endif
 
-/* setup the scan_t to scan p .. q */
-static void scan_reset(scan_t *sp, const char *p, const char *q, char qte,
-                       char esc, char delim) {
-  char tmpbuf[32];
-  sp->base = p;
-  sp->q = q;
-  sp->qte = qte;
-  sp->esc = esc;
-  sp->delim = delim;
-  int len = q - p;
-  if (len < 32) {
-    memcpy(tmpbuf, p, len);
-    p = tmpbuf;
+/**
+ *  tail64 - return a pointer to 64 loadable bytes that start with the
+ *  n < 64 bytes at p. A load that does not cross into the next page
+ *  cannot fault, so p itself is returned when the page allows it;
+ *  otherwise the bytes are copied to tmp. Either way the bytes past n
+ *  are junk for the caller to mask off.
+ */
+INLINE const char *tail64(const char *p, int n, char *tmp) {
+  if (OVERREAD && ((uintptr_t)p & (PAGE_MIN - 1)) <= PAGE_MIN - 64) {
+    return p;
   }
-  sp->bmap = fillbmap((const __m256i *)p, sp->qte, sp->esc, sp->delim);
+  memcpy(tmp, p, n);
+  return tmp;
 }
 
-static int __scan_forward(scan_t *sp) {
-  const char *base = sp->base;
-  char tmpbuf[32];
-  const char *q = sp->q;
-  while (0 == sp->bmap) {
-    base += 32;
-    const char *p = base;
-    const int plen = q - base;
-    if (unlikely(plen < 32)) {
-      if (plen < 0) {
-        return -1;
-      }
-      // We will load 32-byte in fillbmap. If there is
-      // less than 32-byte in base, copy into tmpbuf
-      // and read from tmpbuf.
-      memcpy(tmpbuf, p, plen);
-      p = tmpbuf;
-    }
-    sp->bmap = fillbmap((const __m256i *)p, sp->qte, sp->esc, sp->delim);
+/* character classes of the special chars */
+#define C_QTE 0x01
+#define C_ESC 0x02
+#define C_DELIM 0x04
+#define C_LF 0x08
+#define C_CR 0x10
+
+/* set up the nibble lookup tables for the special chars of a dialect */
+static void dialect_init(dialect_t *dl, char qte, char esc, char delim) {
+  const char ch[5] = {qte, esc, delim, '\n', '\r'};
+  const uint8_t cls[5] = {C_QTE, C_ESC, C_DELIM, C_LF, C_CR};
+  memset(dl, 0, sizeof(*dl));
+  dl->qte = qte;
+  dl->esc = esc;
+  dl->delim = delim;
+  for (int i = 0; i < 5; i++) {
+    /* a char that plays two roles (esc == qte) gets both classes. Any
+     * other collision would need a char in two classes, which only
+     * happens for nonsense dialects like delim == qte. */
+    dl->lo[ch[i] & 0xf] |= cls[i];
+    dl->hi[(ch[i] >> 4) & 0xf] |= cls[i];
   }
-  sp->base = base;
-  return 0;
 }
 
-/* this is the main workhorse. return ptr to the next special char */
-static inline __attribute__((always_inline)) const char *scan_next(scan_t *sp) {
-  const char *ret = 0;
-  if (0 == sp->bmap && __scan_forward(sp)) {
-    ;
-  } else {
-    int off = __builtin_ffs(sp->bmap) - 1;
-    sp->bmap &= ~(1 << off);
-    ret = sp->base + off;
-    ret = ret < sp->q ? ret : 0;
-  }
-  return ret;
+/*
+ * SIMD kernels. Each variant provides
+ *
+ *   bmap64:     bitmaps of qte/esc and of delim/\n/\r in 64 bytes at p
+ *   classify64: separate bitmaps of qte, delim, \n and \r in 64 bytes at p
+ *   pxor:       prefix xor; bit i of the result is the xor of bits 0..i.
+ *               Applied to a quote bitmap, this yields the mask of bytes
+ *               that lie inside quotes.
+ *
+ * The SIMD variants classify every byte at once with two nibble table
+ * lookups (pshufb): a byte belongs to class C iff both lo[low nibble]
+ * and hi[high nibble] have the bit for C. More special chars can be
+ * added to dialect_init without extra cost per byte.
+ *
+ * The loops that call them are written once as always_inline templates
+ * below and instantiated per variant; csv_open picks the best variant
+ * the cpu supports.
+ */
+
+/* ---- scalar: 8 bytes at a time in a uint64_t ---- */
+
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_LOW7 0x7f7f7f7f7f7f7f7fULL
+
+/* 0x80 in each byte of w that equals ch; 0 elsewhere */
+INLINE uint64_t swar_eq(uint64_t w, char ch) {
+  uint64_t t = w ^ (SWAR_ONES * (uint8_t)ch);
+  return ~(((t & SWAR_LOW7) + SWAR_LOW7) | t | SWAR_LOW7);
 }
 
-/* there are more fields than the current cp->fld[]. expand it. */
-static int expand(csv_parse_t *cp) {
-  void *xp;
-  int max = cp->fldmax * 1.2 + 64;
+/* gather the high bit of each byte into an 8-bit mask */
+INLINE uint64_t swar_movemask(uint64_t m) {
+  return ((m >> 7) * 0x0102040810204080ULL) >> 56;
+}
 
-  if (!(xp = realloc(cp->fld, sizeof(*cp->fld) * max))) {
-    return -1;
+INLINE uint64_t swar_load(const char *p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static void bmap64_scalar(const char *p, const dialect_t *dl, uint64_t *qemap,
+                          uint64_t *smap) {
+  uint64_t qe = 0, st = 0;
+  for (int i = 0; i < 64; i += 8) {
+    uint64_t w = swar_load(p + i);
+    qe |= swar_movemask(swar_eq(w, dl->qte) | swar_eq(w, dl->esc)) << i;
+    st |= swar_movemask(swar_eq(w, dl->delim) | swar_eq(w, '\n') |
+                        swar_eq(w, '\r'))
+          << i;
   }
-  cp->fld = xp;
+  *qemap = qe;
+  *smap = st;
+}
 
-  if (!(xp = realloc(cp->len, sizeof(*cp->len) * max))) {
-    return -1;
+INLINE void classify64_scalar(const char *p, const dialect_t *dl,
+                              uint64_t *qbits, uint64_t *dbits,
+                              uint64_t *nbits, uint64_t *rbits) {
+  uint64_t q = 0, d = 0, n = 0, r = 0;
+  for (int i = 0; i < 64; i += 8) {
+    uint64_t w = swar_load(p + i);
+    q |= swar_movemask(swar_eq(w, dl->qte)) << i;
+    d |= swar_movemask(swar_eq(w, dl->delim)) << i;
+    n |= swar_movemask(swar_eq(w, '\n')) << i;
+    r |= swar_movemask(swar_eq(w, '\r')) << i;
   }
-  cp->len = xp;
+  *qbits = q;
+  *dbits = d;
+  *nbits = n;
+  *rbits = r;
+}
 
-  if (!(xp = realloc(cp->quoted, sizeof(*cp->quoted) * max))) {
-    return -1;
+INLINE uint64_t eq64_scalar(const char *p, char ch) {
+  uint64_t m = 0;
+  for (int i = 0; i < 64; i += 8) {
+    m |= swar_movemask(swar_eq(swar_load(p + i), ch)) << i;
   }
-  cp->quoted = xp;
+  return m;
+}
 
-  cp->fldmax = max;
-  return 0;
+INLINE uint64_t pxor_scalar(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
 }
 
-/* save error state and return errnum */
-static int reterr(csv_parse_t *cp, int errnum, const char *const errmsg,
-                  int cno, int nline, int nchar) {
-  cp->state.errnum = errnum;
-  cp->state.errmsg = errmsg;
-  cp->state.elinenum = cp->state.linenum + nline;
-  cp->state.echarnum = cp->state.charnum + nchar;
-  cp->state.erownum = cp->state.rownum + 1;
-  cp->state.efldnum = cno;
-  return -1;
+/* ---- avx2 (on arm, via simde) ---- */
+
+/* class bits of each of the 32 bytes in src */
+INLINE TARGET("avx2") __m256i classify32(__m256i src, const dialect_t *dl) {
+  __m256i lo = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)dl->lo));
+  __m256i hi = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)dl->hi));
+  __m256i nib = _mm256_set1_epi8(0xf);
+  __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(src, nib));
+  __m256i h = _mm256_shuffle_epi8(
+      hi, _mm256_and_si256(_mm256_srli_epi16(src, 4), nib));
+  return _mm256_and_si256(l, h);
 }
 
-/**
- *	touchup - NUL terminate, replace nullstr, and unescape each field
- */
-static void touchup(csv_parse_t *cp) {
-  const char *const nullstr = cp->nullstr;
-  const int nullstrsz = cp->nullstrsz;
-  const char esc = cp->esc;
-  const char qte = cp->qte;
-  (void)esc;
-  (void)qte; /* prevent unused var warning */
+/* mask of the bytes in cls that have any of the class bits in c */
+INLINE TARGET("avx2") uint32_t movemask_cls32(__m256i cls, int c) {
+  __m256i m = _mm256_and_si256(cls, _mm256_set1_epi8(c));
+  return ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+}
 
-  /* process the fields one by one */
-  const int top = cp->fldtop;
-  for (int i = 0; i < top; i++) {
-    char **const fld = &cp->fld[i];
-    char *p = *fld;
-    char *q = p + cp->len[i];
+static TARGET("avx2") void bmap64_avx2(const char *p, const dialect_t *dl,
+                                      uint64_t *qemap, uint64_t *smap) {
+  __m256i lo = classify32(_mm256_loadu_si256((const __m256i *)p), dl);
+  __m256i hi = classify32(_mm256_loadu_si256((const __m256i *)(p + 32)), dl);
+  *qemap = movemask_cls32(lo, C_QTE | C_ESC) |
+           ((uint64_t)movemask_cls32(hi, C_QTE | C_ESC) << 32);
+  *smap = movemask_cls32(lo, C_DELIM | C_LF | C_CR) |
+          ((uint64_t)movemask_cls32(hi, C_DELIM | C_LF | C_CR) << 32);
+}
 
-    *q = 0; /* NUL term */
+INLINE TARGET("avx2") void classify64_avx2(const char *p, const dialect_t *dl,
+                                           uint64_t *qbits, uint64_t *dbits,
+                                           uint64_t *nbits, uint64_t *rbits) {
+  __m256i lo = classify32(_mm256_loadu_si256((const __m256i *)p), dl);
+  __m256i hi = classify32(_mm256_loadu_si256((const __m256i *)(p + 32)), dl);
+  /* shift each class bit into the sign bit of its byte */
+#define CLS64(n)                                                              \
+  ((uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(lo, n)) |                 \
+   ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(hi, n)) << 32))
+  *qbits = CLS64(7);
+  *dbits = CLS64(5);
+  *nbits = CLS64(4);
+  *rbits = CLS64(3);
+#undef CLS64
+}
 
-    /* check empty field */
-    if (cp->len[i] == 0) {
-      *fld = 0; /* make it a nullptr to indicate sql NULL field */
-      continue;
-    }
+INLINE TARGET("avx2") uint64_t eq64_avx2(const char *p, char ch) {
+  __m256i c = _mm256_set1_epi8(ch);
+  uint32_t lo = _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), c));
+  uint32_t hi = _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 32)), c));
+  return lo | ((uint64_t)hi << 32);
+}
 
-    if (q - p == nullstrsz && 0 == memcmp(p, nullstr, nullstrsz)) {
-      *fld = 0; /* make it a nullptr to indicate sql NULL field */
-      continue;
-    }
+INLINE TARGET("pclmul") uint64_t pxor_clmul(uint64_t x) {
+  __m128i v = _mm_set_epi64x(0, x);
+  return _mm_cvtsi128_si64(_mm_clmulepi64_si128(v, _mm_set1_epi8(-1), 0));
+}
 
-    if (!cp->quoted[i]) {
-      continue;
-    }
+#ifdef CSV_X86
+/* ---- sse4.2 ---- */
 
-    int inquote = 0;
-    char *start = p;
-    char *s = p;
-    while (p < q) {
-      char ch = *p++;
-      int special = (ch == esc) | (ch == qte);
-      if (unlikely(special)) {
-        if (inquote && ch == esc) {
-          char nextch = (p < q ? *p : 0);
-          if (nextch == qte || nextch == esc) {
-            // do the escape
-            p++;
-            *s++ = nextch;
-            continue;
-          }
-          // ignore the escape
-        }
-        if (ch == qte) {
-          inquote = !inquote;
-          continue;
-        }
-        // fallthru
-      }
-      *s++ = ch;
-    }
-    assert(!inquote);
-    *s = 0; /* NUL term */
-
-    cp->fld[i] = start;
-    cp->len[i] = s - start;
-  }
-
-  // remove the last \r in the last field
-  if (top > 0) {
-    char *p = cp->fld[top - 1];
-    if (p) {
-      char *q = p + cp->len[top - 1];
-      if (q - p > 0 && q[-1] == '\r') {
-        *--q = 0;
-        cp->len[top - 1] = q - p;
-        if (q - p == nullstrsz && 0 == memcmp(p, nullstr, nullstrsz)) {
-          cp->fld[top - 1] = 0; /* make it a nullptr to indicate sql NULL field */
-        }
-      }
+INLINE TARGET("sse4.2") __m128i classify16(__m128i src, const dialect_t *dl) {
+  __m128i lo = _mm_loadu_si128((const __m128i *)dl->lo);
+  __m128i hi = _mm_loadu_si128((const __m128i *)dl->hi);
+  __m128i nib = _mm_set1_epi8(0xf);
+  __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(src, nib));
+  __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(src, 4), nib));
+  return _mm_and_si128(l, h);
+}
+
+/* mask of the bytes in 64 bytes at p that have any of the class bits in
+ * c, for each of the four class masks in c[] */
+INLINE TARGET("sse4.2") void movemask_cls64(const char *p, const dialect_t *dl,
+                                            int n, const int c[],
+                                            uint64_t *ret[]) {
+  for (int j = 0; j < n; j++) {
+    *ret[j] = 0;
+  }
+  for (int i = 0; i < 4; i++) {
+    __m128i cls =
+        classify16(_mm_loadu_si128((const __m128i *)(p + i * 16)), dl);
+    for (int j = 0; j < n; j++) {
+      __m128i m = _mm_and_si128(cls, _mm_set1_epi8(c[j]));
+      uint16_t bits =
+          ~_mm_movemask_epi8(_mm_cmpeq_epi8(m, _mm_setzero_si128()));
+      *ret[j] |= (uint64_t)bits << (i * 16);
     }
   }
 }
 
-int csv_line(csv_parse_t *const cp, const char *buf, int bufsz) {
-  /*
-   * NOTE: this routine MUST NOT modify buf[]; it should only index
-   * fld[] into buf[].  When it succeeded, then buf[] can be modified
-   * later via a call to touchup().
-   */
-  if (unlikely(!buf || bufsz <= 0)) {
-    return bufsz == 0 ? 0 : reterr(cp, CSV_EPARAM, "bad bufsz", 0, 0, 0);
-  }
-  const char qte = cp->qte;
-  const char esc = cp->esc;
-  (void)qte, (void)esc; /* prevent gcc unused-var warning */
+static TARGET("sse4.2") void bmap64_sse42(const char *p, const dialect_t *dl,
+                                         uint64_t *qemap, uint64_t *smap) {
+  const int c[2] = {C_QTE | C_ESC, C_DELIM | C_LF | C_CR};
+  uint64_t *ret[2] = {qemap, smap};
+  movemask_cls64(p, dl, 2, c, ret);
+}
 
-  const char delim = cp->delim;
-  const char *ppp = buf;
-  const char *const q = ppp + bufsz;
+INLINE TARGET("sse4.2") void classify64_sse42(const char *p,
+                                              const dialect_t *dl,
+                                              uint64_t *qbits,
+                                              uint64_t *dbits,
+                                              uint64_t *nbits,
+                                              uint64_t *rbits) {
+  const int c[4] = {C_QTE, C_DELIM, C_LF, C_CR};
+  uint64_t *ret[4] = {qbits, dbits, nbits, rbits};
+  movemask_cls64(p, dl, 4, c, ret);
+}
 
-  int cno = 0;   /* start at field 0 */
-  int nline = 0; /* count num lines */
+INLINE TARGET("sse4.2") uint64_t eq64_sse42(const char *p, char ch) {
+  __m128i c = _mm_set1_epi8(ch);
+  uint64_t m = 0;
+  for (int i = 0; i < 4; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i * 16));
+    m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, c))
+         << (i * 16);
+  }
+  return m;
+}
 
-  const char **fld; /* points at cp->fld[cno] */
-  scan_t *scan = &cp->scan;
-  scan_reset(scan, ppp, q, qte, esc, delim);
-  int quoted = 0;
+/* ---- avx512bw: tests yield 64-bit mask registers directly ---- */
 
-STARTVAL : {
-  if (unlikely(cno >= cp->fldmax)) {
-    if (expand(cp)) {
-      return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", cno, nline,
-                    ppp - buf);
-    }
-    assert(cno < cp->fldmax);
-  }
+INLINE TARGET("avx512bw") __m512i classify64x(const char *p,
+                                              const dialect_t *dl) {
+  __m512i src = _mm512_loadu_si512((const void *)p);
+  __m512i lo = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)dl->lo));
+  __m512i hi = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)dl->hi));
+  __m512i nib = _mm512_set1_epi8(0xf);
+  __m512i l = _mm512_shuffle_epi8(lo, _mm512_and_si512(src, nib));
+  __m512i h = _mm512_shuffle_epi8(
+      hi, _mm512_and_si512(_mm512_srli_epi16(src, 4), nib));
+  return _mm512_and_si512(l, h);
+}
 
-  /* field starts here */
-  fld = (const char **)&cp->fld[cno];
-  *fld = ppp;
-  goto UNQUOTED;
+INLINE TARGET("avx512bw") uint64_t mask_cls64(__m512i cls, int c) {
+  return _mm512_test_epi8_mask(cls, _mm512_set1_epi8(c));
 }
 
-UNQUOTED : {
-  // point ppp at next special char
-  if (0 == (ppp = scan_next(scan)))
-    return 0;
+static TARGET("avx512bw") void bmap64_avx512(const char *p,
+                                            const dialect_t *dl,
+                                            uint64_t *qemap, uint64_t *smap) {
+  __m512i cls = classify64x(p, dl);
+  *qemap = mask_cls64(cls, C_QTE | C_ESC);
+  *smap = mask_cls64(cls, C_DELIM | C_LF | C_CR);
+}
 
-  const char ch = *ppp;
-  if (likely(ch == delim || ch == '\n'))
-    goto ENDVAL;
+INLINE TARGET("avx512bw") void classify64_avx512(const char *p,
+                                                 const dialect_t *dl,
+                                                 uint64_t *qbits,
+                                                 uint64_t *dbits,
+                                                 uint64_t *nbits,
+                                                 uint64_t *rbits) {
+  __m512i cls = classify64x(p, dl);
+  *qbits = mask_cls64(cls, C_QTE);
+  *dbits = mask_cls64(cls, C_DELIM);
+  *nbits = mask_cls64(cls, C_LF);
+  *rbits = mask_cls64(cls, C_CR);
+}
+INLINE TARGET("avx512bw") uint64_t eq64_avx512(const char *p, char ch) {
+  return _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)p),
+                                _mm512_set1_epi8(ch));
+}
+#endif /* CSV_X86 */
 
-  if (ch == qte) {
-    goto QUOTED;
+/* fill the bitmaps from the 64 bytes at base, of which only base..q are
+ * valid */
+static inline void scan_fill(scan_t *sp, const char *base) {
+  char tmpbuf[64];
+  const char *p = base;
+  const int len = sp->q - base;
+  if (unlikely(len < 64)) {
+    // We will load 64-byte in bmap64. If there is
+    // less than 64-byte in base, load past the end
+    // or from a copy in tmpbuf.
+    p = tail64(p, len, tmpbuf);
   }
+  sp->bmap64(p, sp->dl, &sp->qemap, &sp->smap);
+  if (unlikely(len < 64)) {
+    uint64_t valid = (1ULL << len) - 1;
+    sp->qemap &= valid;
+    sp->smap &= valid;
+  }
+}
 
-  assert(ch == esc); /* ignore */
-  goto UNQUOTED;     /* still in UNQUOTED */
+/* setup the scan_t to scan p .. q */
+static void scan_reset(scan_t *sp, const char *p, const char *q,
+                       const dialect_t *dl) {
+  sp->base = p;
+  sp->q = q;
+  sp->dl = dl;
+  scan_fill(sp, p);
 }
 
-QUOTED : {
+/* advance to the next block that has a bit set in qemap, or in qemap or
+ * smap if smask is all ones */
+static int __scan_forward(scan_t *sp, uint64_t smask) {
+  const char *base = sp->base;
+  const char *q = sp->q;
+  while (0 == (sp->qemap | (sp->smap & smask))) {
+    base += 64;
+    if (unlikely(base >= q)) {
+      return -1;
+    }
+    scan_fill(sp, base);
+  }
+  sp->base = base;
+  return 0;
+}
 
-  quoted = 1;
-  if (0 == (ppp = scan_next(scan)))
-    return 0;
+/* pop the first bit of bmap and forget everything before it */
+static inline __attribute__((always_inline)) const char *
+scan_pop(scan_t *sp, uint64_t bmap) {
+  int off = __builtin_ctzll(bmap);
+  uint64_t after = ~((2ULL << off) - 1);
+  sp->qemap &= after;
+  sp->smap &= after;
+  return sp->base + off;
+}
 
-  const char ch = *ppp;
-  if (ch == esc) {
-    char nextch = (ppp + 1 < q ? ppp[1] : 0);
-    if (nextch == qte || nextch == esc) {
-      if (unlikely(ppp + 1 != scan_next(scan))) {
-        return reterr(cp, CSV_EINTERNAL, "internal error: bad pointer value",
-                      cno, nline, ppp - buf);
-      }
-      goto QUOTED;
-    }
-    if (nextch == 0) {
+/* this is the main workhorse. return ptr to the next special char */
+static inline __attribute__((always_inline)) const char *scan_next(scan_t *sp) {
+  uint64_t bmap = sp->qemap | sp->smap;
+  if (0 == bmap) {
+    if (__scan_forward(sp, ~0ULL)) {
       return 0;
     }
-    // fallthru
-  }
-  if (likely(ch == qte)) {
-    // close quote
-    goto UNQUOTED;
+    bmap = sp->qemap | sp->smap;
   }
-
-  goto QUOTED;
+  return scan_pop(sp, bmap);
 }
 
-ENDVAL : {
-  /* ppp is pointing at [delim, \n] */
-  assert(*ppp == delim || *ppp == '\n');
+/* inside quotes only qte and esc matter: return ptr to the next one,
+ * skipping over delims and newlines without visiting them */
+static inline __attribute__((always_inline)) const char *
+scan_next_quoted(scan_t *sp) {
+  if (0 == sp->qemap && __scan_forward(sp, 0)) {
+    return 0;
+  }
+  return scan_pop(sp, sp->qemap);
+}
 
-  /* fin the field */
-  cp->len[cno] = ppp - *fld;
-  cp->quoted[cno] = quoted;
-  cno++;
+/* make room for max fields in cp->fld[] and friends, keeping the
+ * fields of the current row */
+static int fld_reserve(csv_parse_t *cp, int max) {
+  max = (max + 63) & ~63;
+  if (max <= cp->fldmax) {
+    return 0;
+  }
+  char *xp = malloc((sizeof(*cp->fld) + sizeof(*cp->len)) * max + max / 4);
+  if (!xp) {
+    return -1;
+  }
+  char **fld = (char **)xp;
+  uint64_t *qmap = (uint64_t *)(fld + max);
+  uint64_t *nmap = qmap + max / 64;
+  int *len = (int *)(nmap + max / 64);
+  const int n = cp->fldmax;
+  if (n) {
+    memcpy(fld, cp->fld, n * sizeof(*fld));
+    memcpy(qmap, cp->qmap, n / 8);
+    memcpy(nmap, cp->nmap, n / 8);
+    memcpy(len, cp->len, n * sizeof(*len));
+  }
+  memset(qmap + n / 64, 0, (max - n) / 8);
+  memset(nmap + n / 64, 0, (max - n) / 8);
+  free(cp->fld);
+  cp->fld = fld;
+  cp->qmap = qmap;
+  cp->nmap = nmap;
+  cp->len = len;
+  cp->fldmax = max;
+  return 0;
+}
 
-  const char ch = *ppp++;
+/* there are more fields than the current cp->fld[]. expand it. */
+static int expand(csv_parse_t *cp) {
+  return fld_reserve(cp, cp->fldmax ? cp->fldmax * 2 : 64);
+}
 
-  if (likely(ch == delim)) {
-    goto STARTVAL; /* start next field */
+/* mark field i as quoted; qmap[] is cleared by qmap_clear for each row,
+ * so that unquoted fields cost nothing */
+INLINE void qmap_set(csv_parse_t *cp, int i) {
+  cp->qmap[i >> 6] |= 1ULL << (i & 63);
+  if (cp->qtop <= i >> 6) {
+    cp->qtop = (i >> 6) + 1;
   }
-
-  /* the field is done? */
-  cp->fldtop = cno;
-  goto FINROW;
 }
 
-FINROW : {
-  int rowsz = ppp - buf;
-  nline++;
-  cp->state.linenum += nline;
-  cp->state.rownum++;
-  cp->state.charnum += rowsz;
+/* mark field i, of len bytes, as a sql NULL candidate if it is empty
+ * or as long as nullstr; touchup checks only the fields marked */
+INLINE void nmap_set(csv_parse_t *cp, int i, int len) {
+  if (unlikely(len == 0 || len == cp->nullstrsz)) {
+    cp->nmap[i >> 6] |= 1ULL << (i & 63);
+    if (cp->ntop <= i >> 6) {
+      cp->ntop = (i >> 6) + 1;
+    }
+  }
+}
 
-  return rowsz;
+/* forget the quoted and NULL candidate fields of the last row */
+INLINE void qmap_clear(csv_parse_t *cp) {
+  if (cp->qtop) {
+    memset(cp->qmap, 0, cp->qtop * sizeof(*cp->qmap));
+    cp->qtop = 0;
+  }
+  if (cp->ntop) {
+    memset(cp->nmap, 0, cp->ntop * sizeof(*cp->nmap));
+    cp->ntop = 0;
+  }
 }
+
+INLINE int qmap_get(const uint64_t *qmap, int i) {
+  return (qmap[i >> 6] >> (i & 63)) & 1;
 }
 
-int csv_feed(csv_parse_t *const cp, char *buf, int bufsz, char ***ret_field,
-             int *ret_nfield) {
-  *ret_field = 0;
-  *ret_nfield = 0;
+/* number of bytes indexed at a time by csv_line */
+#define SINDEX_WINDOW (64 * 1024)
 
-  int rowsz = csv_line(cp, buf, bufsz);
-  if (rowsz <= 0) {
-    // insufficient chars in buf for a row
-    return rowsz;
+/* make room for at least n more elements in ix->pos[] */
+static int sindex_reserve(csv_sindex_t *ix, int n) {
+  if (ix->npos + n <= ix->maxpos) {
+    return 0;
   }
+  int max = (ix->npos + n) * 1.5 + 1024;
+  void *xp = realloc(ix->pos, sizeof(*ix->pos) * max);
+  if (!xp) {
+    return -1;
+  }
+  ix->pos = xp;
+  ix->maxpos = max;
+  return 0;
+}
 
-  // we have a row!
-  *ret_field = cp->fld;
-  *ret_nfield = cp->fldtop;
+/* start indexing buf[] from the beginning */
+static void sindex_reset(csv_sindex_t *ix, const char *buf, int bufsz) {
+  ix->buf = buf;
+  ix->bufsz = bufsz;
+  ix->top = 0;
+  ix->npos = 0;
+  ix->inquote = 0;
+  ix->qpend = 0;
+}
 
-  // go back to fix up fields with escaped chars
-  touchup(cp);
+/**
+ *  sindex_fill - stage 1. Index buf[top..upto) and append the
+ *  structural chars found outside quotes to pos[]. Upto - top must
+ *  be a multiple of 64, or upto must equal bufsz.
+ */
+INLINE int sindex_fill_tmpl(csv_sindex_t *ix, const dialect_t *dl, int upto,
+                            void (*classify64)(const char *, const dialect_t *,
+                                               uint64_t *, uint64_t *,
+                                               uint64_t *, uint64_t *),
+                            uint64_t (*pxor)(uint64_t)) {
+  const char *const buf = ix->buf;
+  uint64_t inquote = ix->inquote;
+  int qpend = ix->qpend;
 
-  return rowsz;
-}
+  for (int off = ix->top; off < upto; off += 64) {
+    if (unlikely(sindex_reserve(ix, 64))) {
+      return -1;
+    }
+    uint32_t *pos = ix->pos + ix->npos;
+    const char *p = buf + off;
+    const int len = ix->bufsz - off;
+    char tmpbuf[64];
+    if (unlikely(len < 64)) {
+      p = tail64(p, len, tmpbuf);
+    }
 
-int csv_feed_last(csv_parse_t *const cp, char *buf, int bufsz,
-                  char ***ret_field, int *ret_nfield) {
-  *ret_field = 0;
-  *ret_nfield = 0;
+    uint64_t qbits, dbits, nbits, rbits;
+    classify64(p, dl, &qbits, &dbits, &nbits, &rbits);
+    uint64_t sbits = dbits | nbits | rbits;
+    if (unlikely(len < 64)) {
+      uint64_t valid = (1ULL << len) - 1;
+      qbits &= valid;
+      sbits &= valid;
+    }
 
-  if (bufsz <= 0)
-    return bufsz == 0 ? 0 : reterr(cp, CSV_EPARAM, "bad bufsz", 0, 0, 0);
+    /* drop the structural chars that are inside quotes */
+    uint64_t inside = pxor(qbits) ^ inquote;
+    inquote = (uint64_t)((int64_t)inside >> 63);
+    sbits &= ~inside;
 
-  /* handle the case where last row is missing \n */
-  int appended = 0;
-  if (buf[bufsz - 1] != '\n') {
-    free(cp->lastbuf);
-    cp->lastbuf = malloc(bufsz + 2);
-    if (!cp->lastbuf) {
-      return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", 0, 0, 0);
+    if (likely(!(qbits | qpend))) {
+      /* no quotes in sight: every field ending here is unquoted */
+      while (sbits) {
+        *pos++ = off + __builtin_ctzll(sbits);
+        sbits &= sbits - 1;
+      }
+    } else {
+      while (sbits) {
+        /* was there a quote in the field that ends here? */
+        uint64_t below = (sbits & -sbits) - 1;
+        qpend |= (qbits & below) != 0;
+        qbits &= ~below;
+        *pos++ =
+            (off + __builtin_ctzll(sbits)) | (qpend ? CSV_SINDEX_QUOTED : 0);
+        qpend = 0;
+        sbits &= sbits - 1;
+      }
+      qpend |= (qbits != 0);
     }
-    memcpy(cp->lastbuf, buf, bufsz);
-    cp->lastbuf[bufsz] = '\n';
-    cp->lastbuf[bufsz + 1] = '\0';
-    buf = cp->lastbuf;
-    bufsz++;
-    appended = 1;
+    ix->npos = pos - ix->pos;
   }
 
-  int n = csv_feed(cp, buf, bufsz, ret_field, ret_nfield);
-  return (n > 0 && appended) ? n - 1 : n;
+  ix->top = upto;
+  ix->inquote = inquote;
+  ix->qpend = qpend;
+  return 0;
 }
 
-csv_parse_t *csv_open(int qte, int esc, int delim, const char nullstr[20]) {
-  /* default values */
-  qte = qte ? qte : '"';
-  esc = esc ? esc : qte;
-  delim = delim ? delim : ',';
-  nullstr = nullstr ? nullstr : "";
+/**
+ *  nl64 - the quotes and the row terminators in the 64 bytes at
+ *  buf[off], of which only those before hi count. A row ends at \n,
+ *  or at \r if not followed by \n.
+ */
+INLINE void nl64_tmpl(const char *buf, int64_t bufsz, int64_t off, int64_t hi,
+                      const dialect_t *dl, uint64_t *qret, uint64_t *nret,
+                      void (*classify64)(const char *, const dialect_t *,
+                                         uint64_t *, uint64_t *, uint64_t *,
+                                         uint64_t *)) {
+  const char *p = buf + off;
+  char tmpbuf[64];
+  if (unlikely(bufsz - off < 64)) {
+    p = tail64(p, bufsz - off, tmpbuf);
+  }
+
+  uint64_t qbits, dbits, nbits, rbits;
+  classify64(p, dl, &qbits, &dbits, &nbits, &rbits);
+  if (unlikely(bufsz - off < 64)) {
+    /* drop the junk past the end before pairing \r with \n */
+    uint64_t valid = (1ULL << (bufsz - off)) - 1;
+    nbits &= valid;
+    rbits &= valid;
+  }
+
+  /* the \r of a \r\n does not end a row; the \n does */
+  uint64_t crlf = rbits & (nbits >> 1);
+  if ((rbits >> 63) && off + 64 < bufsz && buf[off + 64] == '\n') {
+    crlf |= 1ULL << 63;
+  }
+  nbits |= rbits & ~crlf;
+  if (unlikely(hi - off < 64)) {
+    uint64_t valid = (1ULL << (hi - off)) - 1;
+    qbits &= valid;
+    nbits &= valid;
+  }
+  *qret = qbits;
+  *nret = nbits;
+}
+
+/**
+ *  nlscan - find the row boundaries in buf[lo..hi) for both possible
+ *  quote states (h = 0, 1) at buf[lo]. Records in first[h] the offset
+ *  past the first row terminator outside quotes (-1 if none), and in
+ *  nnl[h] the number of row terminators outside quotes. Returns the
+ *  parity of the quote count.
+ */
+INLINE int nlscan_tmpl(const char *buf, int64_t bufsz, int64_t lo,
+                       int64_t hi, const dialect_t *dl, int64_t first[2],
+                       int64_t nnl[2],
+                       void (*classify64)(const char *, const dialect_t *,
+                                          uint64_t *, uint64_t *, uint64_t *,
+                                          uint64_t *),
+                       uint64_t (*pxor)(uint64_t)) {
+  uint64_t inquote = 0;
+
+  first[0] = first[1] = -1;
+  nnl[0] = nnl[1] = 0;
+  for (int64_t off = lo; off < hi; off += 64) {
+    uint64_t qbits, nbits;
+    nl64_tmpl(buf, bufsz, off, hi, dl, &qbits, &nbits, classify64);
+
+    /* inside[] assumes we were not in quotes at buf[lo]; its complement
+     * is the mask for the other hypothesis */
+    uint64_t inside = pxor(qbits) ^ inquote;
+    inquote = (uint64_t)((int64_t)inside >> 63);
+    uint64_t nl[2] = {nbits & ~inside, nbits & inside};
+    for (int h = 0; h < 2; h++) {
+      if (nl[h]) {
+        if (first[h] < 0) {
+          first[h] = off + __builtin_ctzll(nl[h]) + 1;
+        }
+        nnl[h] += __builtin_popcountll(nl[h]);
+      }
+    }
+  }
+  return inquote & 1;
+}
+
+/**
+ *  nlnth - the offset past the n-th (n >= 1) row terminator outside
+ *  quotes in buf[lo..hi), given whether buf[lo] is inside quotes; -1
+ *  if there are fewer.
+ */
+INLINE int64_t nlnth_tmpl(const char *buf, int64_t bufsz, int64_t lo,
+                          int64_t hi, const dialect_t *dl, int inq,
+                          int64_t n,
+                          void (*classify64)(const char *, const dialect_t *,
+                                             uint64_t *, uint64_t *,
+                                             uint64_t *, uint64_t *),
+                          uint64_t (*pxor)(uint64_t)) {
+  uint64_t inquote = inq ? ~0ULL : 0;
+  for (int64_t off = lo; off < hi; off += 64) {
+    uint64_t qbits, nbits;
+    nl64_tmpl(buf, bufsz, off, hi, dl, &qbits, &nbits, classify64);
+    uint64_t inside = pxor(qbits) ^ inquote;
+    inquote = (uint64_t)((int64_t)inside >> 63);
+    uint64_t nl = nbits & ~inside;
+    const int c = __builtin_popcountll(nl);
+    if (c >= n) {
+      while (--n) {
+        nl &= nl - 1;
+      }
+      return off + __builtin_ctzll(nl) + 1;
+    }
+    n -= c;
+  }
+  return -1;
+}
+
+/**
+ *  find - memmem. A position is a candidate if the first and the last
+ *  byte of pat are both there, which is tested 64 positions at a time;
+ *  only the candidates are compared in full. Returns the first match
+ *  in p[0..n), or NULL.
+ */
+INLINE const char *find_tmpl(const char *p, int64_t n, const char *pat,
+                             int patsz,
+                             uint64_t (*eq64)(const char *, char)) {
+  if (patsz <= 0) {
+    return p;
+  }
+  const char first = pat[0];
+  const char last = pat[patsz - 1];
+  const int64_t end = n - patsz + 1; /* num positions to try */
+  int64_t off = 0;
+  for (; off + 64 <= end; off += 64) {
+    uint64_t m = eq64(p + off, first) & eq64(p + off + patsz - 1, last);
+    while (m) {
+      const char *x = p + off + __builtin_ctzll(m);
+      if (patsz <= 2 || 0 == memcmp(x + 1, pat + 1, patsz - 2)) {
+        return x;
+      }
+      m &= m - 1;
+    }
+  }
+  for (; off < end; off++) {
+    if (p[off] == first && 0 == memcmp(p + off, pat, patsz)) {
+      return p + off;
+    }
+  }
+  return 0;
+}
+
+/* instantiate the templates for one kernel variant */
+#define KERNEL_INSTANCE(name, attr, classify64, pxor, eq64)                   \
+  static attr int sindex_fill_##name(csv_sindex_t *ix, const dialect_t *dl,   \
+                                     int upto) {                              \
+    return sindex_fill_tmpl(ix, dl, upto, classify64, pxor);                  \
+  }                                                                           \
+  static attr int nlscan_##name(const char *buf, int64_t bufsz, int64_t lo,   \
+                                int64_t hi, const dialect_t *dl,              \
+                                int64_t first[2], int64_t nnl[2]) {           \
+    return nlscan_tmpl(buf, bufsz, lo, hi, dl, first, nnl, classify64, pxor); \
+  }                                                                           \
+  static attr int64_t nlnth_##name(const char *buf, int64_t bufsz,           \
+                                   int64_t lo, int64_t hi,                    \
+                                   const dialect_t *dl, int inq, int64_t n) { \
+    return nlnth_tmpl(buf, bufsz, lo, hi, dl, inq, n, classify64, pxor);      \
+  }                                                                           \
+  static attr const char *find_##name(const char *p, int64_t n,              \
+                                      const char *pat, int patsz) {           \
+    return find_tmpl(p, n, pat, patsz, eq64);                                 \
+  }
+
+KERNEL_INSTANCE(scalar, , classify64_scalar, pxor_scalar, eq64_scalar)
+KERNEL_INSTANCE(avx2, TARGET("avx2,pclmul"), classify64_avx2, pxor_clmul,
+                eq64_avx2)
+#ifdef CSV_X86
+KERNEL_INSTANCE(sse42, TARGET("sse4.2,pclmul"), classify64_sse42, pxor_clmul,
+                eq64_sse42)
+KERNEL_INSTANCE(avx512, TARGET("avx512bw,pclmul"), classify64_avx512,
+                pxor_clmul, eq64_avx512)
+#endif
+
+struct kernel_t {
+  const char *name;
+  int (*supported)(void);
+  void (*bmap64)(const char *p, const dialect_t *dl, uint64_t *qemap,
+                 uint64_t *smap);
+  int (*sindex_fill)(csv_sindex_t *ix, const dialect_t *dl, int upto);
+  int (*nlscan)(const char *buf, int64_t bufsz, int64_t lo, int64_t hi,
+                const dialect_t *dl, int64_t first[2], int64_t nnl[2]);
+  int64_t (*nlnth)(const char *buf, int64_t bufsz, int64_t lo, int64_t hi,
+                   const dialect_t *dl, int inq, int64_t n);
+  const char *(*find)(const char *p, int64_t n, const char *pat, int patsz);
+};
+
+#ifdef CSV_X86
+static int cpu_avx512(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("pclmul");
+}
+static int cpu_avx2(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("pclmul");
+}
+static int cpu_sse42(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+}
+#else
+static int cpu_avx2(void) { return 1; }
+#endif
+static int cpu_any(void) { return 1; }
+
+/* in order of preference */
+static const kernel_t kernels[] = {
+#ifdef CSV_X86
+    {"avx512", cpu_avx512, bmap64_avx512, sindex_fill_avx512, nlscan_avx512,
+     nlnth_avx512, find_avx512},
+#endif
+    {"avx2", cpu_avx2, bmap64_avx2, sindex_fill_avx2, nlscan_avx2, nlnth_avx2,
+     find_avx2},
+#ifdef CSV_X86
+    {"sse42", cpu_sse42, bmap64_sse42, sindex_fill_sse42, nlscan_sse42,
+     nlnth_sse42, find_sse42},
+#endif
+    {"scalar", cpu_any, bmap64_scalar, sindex_fill_scalar, nlscan_scalar,
+     nlnth_scalar, find_scalar},
+};
+
+/**
+ *  kernel_select - pick the best kernel supported by the cpu. The
+ *  CSV_SIMD environment variable may name a kernel to use instead,
+ *  e.g. CSV_SIMD=scalar; it is ignored if the cpu cannot run it.
+ */
+static const kernel_t *kernel_select(void) {
+  static const kernel_t *selected = 0;
+  if (selected) {
+    return selected;
+  }
+
+  const int n = sizeof(kernels) / sizeof(kernels[0]);
+  const char *want = getenv("CSV_SIMD");
+  const kernel_t *k = 0;
+  for (int i = 0; i < n && !k; i++) {
+    if (want && 0 == strcmp(want, kernels[i].name) && kernels[i].supported()) {
+      k = &kernels[i];
+    }
+  }
+  for (int i = 0; i < n && !k; i++) {
+    if (kernels[i].supported()) {
+      k = &kernels[i];
+    }
+  }
+  return selected = k;
+}
+
+/* save error state and return errnum */
+static int reterr(csv_parse_t *cp, int errnum, const char *const errmsg,
+                  int cno, int nline, int nchar) {
+  cp->state.errnum = errnum;
+  cp->state.errmsg = errmsg;
+  cp->state.elinenum = cp->state.linenum + nline;
+  cp->state.echarnum = cp->state.charnum + nchar;
+  cp->state.erownum = cp->state.rownum + 1;
+  cp->state.efldnum = cno;
+  return -1;
+}
+
+/* fields shorter than this are unescaped a byte at a time */
+#define UNESCAPE_SIMD_MIN 32
+
+/**
+ *	unescape - strip the quotes and escapes of the quoted field
+ *	p[0..len) into out[], which may be p. Returns the new length.
+ *
+ *	Long fields are walked 64 bytes at a time: the kernel's bitmap
+ *	of qte and esc chars locates the special chars, and the clean
+ *	runs between them are moved with memmove.
+ */
+INLINE int unescape_tmpl(const csv_parse_t *cp, const char *p, int len,
+                         char *out, const char qte, const char esc) {
+  const char *const q = p + len;
+  int inquote = 0;
+  char *s = out;
+
+  if (len >= UNESCAPE_SIMD_MIN) {
+    char tmp[64];
+    while (p < q) {
+      /* bitmap of qte and esc chars in the next block */
+      uint64_t m, smap;
+      int n = q - p;
+      if (n >= 64) {
+        n = 64;
+        cp->kern->bmap64(p, &cp->dl, &m, &smap);
+      } else {
+        cp->kern->bmap64(tail64(p, n, tmp), &cp->dl, &m, &smap);
+        m &= (1ULL << n) - 1;
+      }
+
+      /* move the clean run before each special char, then handle it */
+      const char *const base = p;
+      while (m) {
+        const char *x = base + __builtin_ctzll(m);
+        if (x >= p) {
+          memmove(s, p, x - p);
+          s += x - p;
+          p = x + 1;
+          const char ch = *x;
+          if (inquote && ch == esc) {
+            char nextch = (p < q ? *p : 0);
+            if (nextch == qte || nextch == esc) {
+              p++; /* do the escape */
+              *s++ = nextch;
+              m &= m - 1;
+              continue;
+            }
+          }
+          if (ch == qte) {
+            inquote = !inquote;
+          } else {
+            *s++ = ch;
+          }
+        }
+        m &= m - 1; /* a char consumed by an escape is skipped */
+      }
+      if (p < base + n) {
+        memmove(s, p, base + n - p);
+        s += base + n - p;
+        p = base + n;
+      }
+    }
+    assert(!inquote);
+    return s - out;
+  }
+
+  while (p < q) {
+    char ch = *p++;
+    int special = (ch == esc) | (ch == qte);
+    if (unlikely(special)) {
+      if (inquote && ch == esc) {
+        char nextch = (p < q ? *p : 0);
+        if (nextch == qte || nextch == esc) {
+          // do the escape
+          p++;
+          *s++ = nextch;
+          continue;
+        }
+        // ignore the escape
+      }
+      if (ch == qte) {
+        inquote = !inquote;
+        continue;
+      }
+      // fallthru
+    }
+    *s++ = ch;
+  }
+  assert(!inquote);
+  return s - out;
+}
+
+static int unescape(const csv_parse_t *cp, const char *p, int len,
+                    char *out) {
+  return unescape_tmpl(cp, p, len, out, cp->qte, cp->esc);
+}
+
+/**
+ *	touchup1 - NUL terminate, replace nullstr, and unescape one field.
+ *	The field keeps its start. Returns its new length, or -1 if it is
+ *	a sql NULL.
+ */
+INLINE int touchup1_tmpl(const csv_parse_t *cp, char *p, int len, int quoted,
+                         const char qte, const char esc,
+                         const int nullempty) {
+  const char *const nullstr = cp->nullstr;
+  const int nullstrsz = nullempty ? 0 : cp->nullstrsz;
+  char *q = p + len;
+
+  *q = 0; /* NUL term */
+
+  /* check empty field */
+  if (len == 0) {
+    return -1;
+  }
+
+  if (len == nullstrsz && 0 == memcmp(p, nullstr, nullstrsz)) {
+    return -1;
+  }
+
+  if (likely(!quoted)) {
+    return len;
+  }
+
+  len = unescape_tmpl(cp, p, len, p, qte, esc);
+  p[len] = 0; /* NUL term */
+  return len;
+}
+
+static int touchup1(const csv_parse_t *cp, char *p, int len, int quoted) {
+  return touchup1_tmpl(cp, p, len, quoted, cp->qte, cp->esc, 0);
+}
+
+/**
+ *	touchup - touchup1 the fields of the row in cp->fld[] that are
+ *	flagged in qmap[] or nmap[]. The others were NUL terminated by
+ *	line(nul), but for a last field that ends at the end of input.
+ */
+INLINE void touchup_tmpl(csv_parse_t *cp, const char qte, const char esc,
+                         const int nullempty) {
+  const int top = cp->fldtop;
+  char **const fld = cp->fld;
+  int *const len = cp->len;
+  if (top) {
+    fld[top - 1][len[top - 1]] = 0; /* NUL term */
+  }
+  const int wtop = cp->qtop > cp->ntop ? cp->qtop : cp->ntop;
+  for (int w = 0; w < wtop; w++) {
+    const uint64_t quoted = w < cp->qtop ? cp->qmap[w] : 0;
+    uint64_t special = quoted | (w < cp->ntop ? cp->nmap[w] : 0);
+    while (special) {
+      const int j = __builtin_ctzll(special);
+      const int i = (w << 6) + j;
+      int k = touchup1_tmpl(cp, fld[i], len[i], (quoted >> j) & 1, qte, esc,
+                            nullempty);
+      if (k < 0) {
+        fld[i] = 0; /* make it a nullptr to indicate sql NULL field */
+      } else {
+        len[i] = k;
+      }
+      special &= special - 1;
+    }
+  }
+}
+
+static void touchup(csv_parse_t *cp) {
+  switch (cp->spec) {
+  case SPEC_CSV:
+  case SPEC_TSV:
+    touchup_tmpl(cp, '"', '"', 1);
+    break;
+  case SPEC_PSV:
+    touchup_tmpl(cp, '"', '\\', 1);
+    break;
+  default:
+    touchup_tmpl(cp, cp->qte, cp->esc, 0);
+    break;
+  }
+}
+
+/**
+ *  touchup_proj - touchup for a projection. The selected fields are
+ *  touched up and moved down to the front of fld[] and len[]; the
+ *  others are left alone, without even a NUL. Returns the #fields
+ *  kept.
+ */
+static int touchup_proj(csv_parse_t *cp) {
+  const int top = cp->fldtop < cp->projmax ? cp->fldtop : cp->projmax;
+  char **const fld = cp->fld;
+  int *const len = cp->len;
+  int n = 0;
+  for (int base = 0; base < top; base += 64) {
+    uint64_t sel = cp->proj[base >> 6];
+    if (top - base < 64) {
+      sel &= ~(~(uint64_t)0 << (top - base));
+    }
+    const uint64_t quoted = cp->qmap[base >> 6];
+    while (sel) {
+      const int j = __builtin_ctzll(sel);
+      const int i = base + j;
+      const int k = touchup1(cp, fld[i], len[i], (quoted >> j) & 1);
+      fld[n] = k < 0 ? 0 : fld[i];
+      len[n] = k < 0 ? 0 : k;
+      n++;
+      sel &= sel - 1;
+    }
+  }
+  return n;
+}
+
+/* touch up the row found by csv_line; returns the #fields for the caller */
+static int touchup_row(csv_parse_t *cp) {
+  if (cp->proj) {
+    return touchup_proj(cp);
+  }
+  touchup(cp);
+  return cp->fldtop;
+}
+
+/**
+ *  endrow - classify the row terminator at p, which is \n or \r, and
+ *  check it against the newline style of the first row. Returns the
+ *  size of the terminator (1 or 2), 0 if p is a \r at the end of the
+ *  buffer and we need the next char to decide, or -1 if the style does
+ *  not match.
+ */
+static inline int endrow(csv_parse_t *cp, const char *p, const char *q) {
+  int eol = EOL_LF;
+  if (*p == '\r') {
+    if (p + 1 == q) {
+      if (!cp->eob) {
+        return 0;
+      }
+      eol = EOL_CR;
+    } else {
+      eol = (p[1] == '\n') ? EOL_CRLF : EOL_CR;
+    }
+  }
+
+  if (unlikely(eol != cp->eol)) {
+    if (cp->eol == 0) {
+      cp->eol = eol; /* first row decides */
+    } else {
+      return -1;
+    }
+  }
+  return eol == EOL_CRLF ? 2 : 1;
+}
+
+static const char *const errcrlf = "inconsistent newline style (CR, LF, CRLF)";
+
+/* make room in the batch for one more row of nfield fields */
+static int batch_reserve(csv_batch_t *b, int nfield) {
+  if (b->nrow + 2 > b->maxrow) {
+    int max = b->maxrow ? b->maxrow * 2 : 64;
+    int *row = realloc(b->row, max * sizeof(*row));
+    if (!row) {
+      return -1;
+    }
+    b->row = row;
+    b->maxrow = max;
+  }
+  if (b->nfield + nfield > b->maxfield) {
+    int max = b->maxfield ? b->maxfield * 2 : 256;
+    while (max < b->nfield + nfield) {
+      max *= 2;
+    }
+    int *off = realloc(b->off, max * sizeof(*off));
+    if (!off) {
+      return -1;
+    }
+    b->off = off;
+    int *len = realloc(b->len, max * sizeof(*len));
+    if (!len) {
+      return -1;
+    }
+    b->len = len;
+    b->maxfield = max;
+  }
+  return 0;
+}
+
+/**
+ *  resume_save - remember that csv_line stopped at offset top of the
+ *  row at buf, with cno fields done and the next one at fldstart.
+ */
+static void resume_save(csv_parse_t *cp, const char *buf, int cno,
+                        int fldstart, int top) {
+  cp->resume.ok = 1;
+  cp->resume.cno = cno;
+  cp->resume.fldstart = fldstart;
+  cp->resume.top = top;
+  const int n = sizeof(cp->resume.head);
+  memcpy(cp->resume.head, buf, top < n ? top : n);
+}
+
+/**
+ *  resume_check - can csv_line pick up the row at buf where it stopped?
+ *  Only if the caller said by csv_feed_again that buf starts with the
+ *  same row, maybe moved, with more data after it. Every call uses up
+ *  the saved state, so it never carries over to an unrelated buffer.
+ */
+static int resume_check(csv_parse_t *cp, const char *buf, int bufsz) {
+  const int again = cp->resume.again;
+  cp->resume.again = 0;
+  if (likely(!cp->resume.ok)) {
+    return 0;
+  }
+  cp->resume.ok = 0;
+  if (!again) {
+    return 0;
+  }
+  const int top = cp->resume.top;
+  const int n = sizeof(cp->resume.head);
+  return bufsz >= top && 0 == memcmp(buf, cp->resume.head, top < n ? top : n);
+}
+
+/* resume_save for line_sindex; the fields done go to cp->len/quoted */
+static void line_sindex_save(csv_parse_t *cp, const csv_batch_t *b,
+                             const char *row, int cno, int fldstart, int top,
+                             int inquote, int qpend) {
+  if (b) {
+    while (cp->fldmax < cno) {
+      if (expand(cp)) {
+        return; /* next time start over */
+      }
+    }
+    qmap_clear(cp);
+    for (int i = 0; i < cno; i++) {
+      const int len = b->len[b->nfield + i];
+      cp->len[i] = len < 0 ? ~len : len;
+      if (len < 0) {
+        qmap_set(cp, i);
+      }
+      nmap_set(cp, i, cp->len[i]);
+    }
+  }
+  resume_save(cp, row, cno, fldstart, top);
+  cp->resume.inquote = inquote;
+  cp->resume.qpend = qpend;
+}
+
+/**
+ *  nul_undo - line(nul) stores a NUL over the delim after each field
+ *  as it goes. For a row it cannot finish, put back the delims after
+ *  the first n fields, so that buf[] can be passed again.
+ */
+static void nul_undo(csv_parse_t *cp, int n, char delim) {
+  for (int i = 0; i < n; i++) {
+    cp->fld[i][cp->len[i]] = delim;
+  }
+}
+
+/**
+ *  line_sindex - stage 2. Cut the next row out of buf[] using the
+ *  structural index in cp->six. The index is built one window at a
+ *  time and kept across calls as long as the caller continues with
+ *  the rest of the same buffer.
+ *
+ *  The fields go to cp->fld[], or if b is given, are appended to the
+ *  batch past b->nfield with the len of a quoted field stored as ~len.
+ *  The batch is left for the caller to finish. With nul, and no b, each
+ *  field is NUL terminated in buf[] but for one that ends at the end of
+ *  input.
+ */
+INLINE int line_sindex_tmpl(csv_parse_t *const cp, const char *buf, int bufsz,
+                            csv_batch_t *b, const char delim, const int nul) {
+  csv_sindex_t *const ix = &cp->six;
+  int cno = 0;
+  int fldstart = 0;
+  const int resume = resume_check(cp, buf, bufsz);
+  if (!(ix->buf && ix->buf + cp->sixnext == buf &&
+        ix->buf + ix->bufsz == buf + bufsz)) {
+    sindex_reset(ix, buf, bufsz);
+    cp->sixcur = 0;
+    cp->sixnext = 0;
+    if (unlikely(resume)) {
+      /* pick up the indexing where the last call ran out of buf[] */
+      ix->top = cp->resume.top;
+      ix->inquote = cp->resume.inquote ? ~0ULL : 0;
+      ix->qpend = cp->resume.qpend;
+      cno = cp->resume.cno;
+      fldstart = cp->resume.fldstart;
+      if (b && batch_reserve(b, cno)) {
+        return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", 0, 0, 0);
+      }
+      /* fields are back to back, one delim apart */
+      for (int i = 0, start = 0; i < cno; start += cp->len[i++] + 1) {
+        if (b) {
+          b->off[b->nfield + i] = buf - b->buf + start;
+          b->len[b->nfield + i] =
+              qmap_get(cp->qmap, i) ? ~cp->len[i] : cp->len[i];
+        } else {
+          cp->fld[i] = (char *)buf + start;
+          if (nul) {
+            cp->fld[i][cp->len[i]] = 0;
+          }
+        }
+      }
+    }
+  }
+
+  if (!b && cno == 0) {
+    qmap_clear(cp); /* unless resumed, this is a new row */
+  }
+
+  const char *const ixbuf = ix->buf;
+  const int rowstart = cp->sixnext;
+  fldstart += rowstart;
+
+  const uint32_t *pos = ix->pos;
+  int cur = cp->sixcur;
+
+  /* batch arrays in locals; stores to them could alias *b */
+  int *boff = b ? b->off + b->nfield : 0;
+  int *blen = b ? b->len + b->nfield : 0;
+  int bmax = b ? b->maxfield - b->nfield : 0;
+  const int bdelta = b ? ixbuf - b->buf : 0;
+  int atend = 0;
+  for (;;) {
+    if (unlikely(cur == ix->npos)) {
+      if (ix->top == ix->bufsz) {
+        if (cp->eof && !ix->inquote) {
+          /* the end of input ends the last field and the row */
+          atend = 1;
+          goto ADDFIELD;
+        }
+        /* incomplete row; forget the index, but not how far we got */
+        if (nul) {
+          nul_undo(cp, cno, delim);
+        }
+        line_sindex_save(cp, b, ixbuf + rowstart, cno, fldstart - rowstart,
+                         ix->top - rowstart, ix->inquote != 0, ix->qpend);
+        ix->buf = 0;
+        return 0;
+      }
+      /* all of pos[] consumed; index the next window in its place */
+      ix->npos = cur = 0;
+      int upto = ix->top + SINDEX_WINDOW;
+      upto = upto < ix->bufsz ? upto : ix->bufsz;
+      if (cp->kern->sindex_fill(ix, &cp->dl, upto)) {
+        if (nul) {
+          nul_undo(cp, cno, delim);
+        }
+        ix->buf = 0;
+        return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", cno, 0,
+                      fldstart - rowstart);
+      }
+      pos = ix->pos;
+      if (ix->npos && (int)(pos[0] & ~CSV_SINDEX_QUOTED) < fldstart) {
+        cur = 1; /* the \n of a \r\n that straddled the window */
+      }
+      continue;
+    }
+
+  ADDFIELD:
+    if (unlikely(cno >= (b ? bmax : cp->fldmax))) {
+      if (b ? batch_reserve(b, cno + 1) : expand(cp)) {
+        if (nul) {
+          nul_undo(cp, cno, delim);
+        }
+        ix->buf = 0;
+        return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", cno, 0,
+                      fldstart - rowstart);
+      }
+      if (b) {
+        boff = b->off + b->nfield;
+        blen = b->len + b->nfield;
+        bmax = b->maxfield - b->nfield;
+      }
+    }
+
+    const uint32_t e =
+        likely(!atend)
+            ? pos[cur++]
+            : ix->bufsz | (ix->qpend ? CSV_SINDEX_QUOTED : 0);
+    const int off = e & ~CSV_SINDEX_QUOTED;
+    const int start = fldstart;
+    if (b) {
+      boff[cno] = bdelta + fldstart;
+      blen[cno] = (e & CSV_SINDEX_QUOTED) ? ~(off - fldstart) : off - fldstart;
+    } else {
+      cp->fld[cno] = (char *)ixbuf + fldstart;
+      cp->len[cno] = off - fldstart;
+      if (unlikely(e & CSV_SINDEX_QUOTED)) {
+        qmap_set(cp, cno);
+      }
+      nmap_set(cp, cno, off - fldstart);
+    }
+    cno++;
+    fldstart = off + 1;
+    if (unlikely(atend)) {
+      fldstart = off;
+      break;
+    }
+    if (ixbuf[off] != delim) {
+      /* \n or \r ends the row */
+      int n = endrow(cp, ixbuf + off, ixbuf + ix->bufsz);
+      if (unlikely(n <= 0)) {
+        if (nul) {
+          nul_undo(cp, cno - 1, delim);
+        }
+        if (n == 0) {
+          /* a \r at the end of buf[]; come back to it with more data */
+          line_sindex_save(cp, b, ixbuf + rowstart, cno - 1,
+                           start - rowstart, off - rowstart, 0,
+                           (e & CSV_SINDEX_QUOTED) != 0);
+        }
+        ix->buf = 0;
+        return n == 0 ? 0
+                      : reterr(cp, CSV_ECRLF, errcrlf, cno - 1, 0,
+                               off - rowstart);
+      }
+      if (nul) {
+        ((char *)ixbuf)[off] = 0;
+      }
+      if (n == 2) {
+        /* skip the \n of \r\n */
+        fldstart++;
+        cur += (cur < ix->npos);
+      }
+      break;
+    }
+    if (nul) {
+      ((char *)ixbuf)[off] = 0;
+    }
+  }
+
+  cp->sixcur = cur;
+  cp->fldtop = cno;
+  cp->sixnext = fldstart;
+
+  int rowsz = fldstart - rowstart;
+  cp->state.linenum++;
+  cp->state.rownum++;
+  cp->state.charnum += rowsz;
+  return rowsz;
+}
+
+int csv_sindex(csv_parse_t *const cp, const char *buf, int bufsz,
+               csv_sindex_t *ix) {
+  if (unlikely(!buf || bufsz < 0)) {
+    return reterr(cp, CSV_EPARAM, "bad bufsz", 0, 0, 0);
+  }
+  if (cp->esc != cp->qte) {
+    return reterr(cp, CSV_EPARAM, "structural index requires esc == qte", 0,
+                  0, 0);
+  }
+  sindex_reset(ix, buf, bufsz);
+  if (cp->kern->sindex_fill(ix, &cp->dl, bufsz)) {
+    return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", 0, 0, 0);
+  }
+  return 0;
+}
+
+void csv_sindex_free(csv_sindex_t *ix) {
+  if (ix) {
+    free(ix->pos);
+    memset(ix, 0, sizeof(*ix));
+  }
+}
+
+/* resume_save for the state machine in csv_line */
+static void line_fsm_save(csv_parse_t *cp, const char *buf, int cno,
+                          int fldstart, int top, int quoted, int inquote) {
+  resume_save(cp, buf, cno, fldstart, top);
+  cp->resume.quoted = quoted;
+  cp->resume.inquote = inquote;
+}
+
+/* line_sindex_tmpl specialized on the dialect; requires esc == qte */
+INLINE int line_sindex(csv_parse_t *const cp, const char *buf, int bufsz,
+                       csv_batch_t *b, const int nul) {
+  switch (cp->spec) {
+  case SPEC_CSV:
+    return line_sindex_tmpl(cp, buf, bufsz, b, ',', nul);
+  case SPEC_TSV:
+    return line_sindex_tmpl(cp, buf, bufsz, b, '\t', nul);
+  default:
+    return line_sindex_tmpl(cp, buf, bufsz, b, cp->delim, nul);
+  }
+}
+
+/*
+ * The state machine behind csv_line, for when esc != qte. Like
+ * line_sindex_tmpl it is specialized on its dialect arguments, and
+ * with nul it NUL terminates the fields in buf[].
+ */
+INLINE int line_fsm_tmpl(csv_parse_t *const cp, const char *buf, int bufsz,
+                         const char qte, const char esc, const char delim,
+                         const int nul) {
+  const char *ppp = buf;
+  const char *const q = ppp + bufsz;
+
+  int cno = 0;   /* start at field 0 */
+  int nline = 0; /* count num lines */
+
+  const char **fld; /* points at cp->fld[cno] */
+  scan_t *scan = &cp->scan;
+  scan->bmap64 = cp->kern->bmap64;
+  int quoted = 0;
+  if (unlikely(resume_check(cp, buf, bufsz))) {
+    /* pick up the scan where the last call ran out of buf[] */
+    cno = cp->resume.cno;
+    for (int i = 0, start = 0; i < cno; start += cp->len[i++] + 1) {
+      cp->fld[i] = (char *)buf + start;
+      if (nul) {
+        cp->fld[i][cp->len[i]] = 0;
+      }
+    }
+    fld = (const char **)&cp->fld[cno];
+    *fld = buf + cp->resume.fldstart;
+    ppp = buf + cp->resume.top;
+    quoted = cp->resume.quoted;
+    scan_reset(scan, ppp, q, &cp->dl);
+    if (cp->resume.inquote) {
+      goto QUOTED;
+    }
+    goto UNQUOTED;
+  }
+  qmap_clear(cp);
+  scan_reset(scan, ppp, q, &cp->dl);
+
+STARTVAL : {
+  if (unlikely(cno >= cp->fldmax)) {
+    if (expand(cp)) {
+      if (nul) {
+        nul_undo(cp, cno, delim);
+      }
+      return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", cno, nline,
+                    ppp - buf);
+    }
+    assert(cno < cp->fldmax);
+  }
+
+  /* field starts here */
+  fld = (const char **)&cp->fld[cno];
+  *fld = ppp;
+  goto UNQUOTED;
+}
+
+UNQUOTED : {
+  // point ppp at next special char
+  if (0 == (ppp = scan_next(scan))) {
+    if (cp->eof) {
+      ppp = q;
+      goto ENDINPUT;
+    }
+    if (nul) {
+      nul_undo(cp, cno, delim);
+    }
+    line_fsm_save(cp, buf, cno, *fld - buf, bufsz, quoted, 0);
+    return 0;
+  }
+
+  const char ch = *ppp;
+  if (likely(ch == delim || ch == '\n' || ch == '\r'))
+    goto ENDVAL;
+
+  if (ch == qte) {
+    goto QUOTED;
+  }
+
+  assert(ch == esc); /* ignore */
+  goto UNQUOTED;     /* still in UNQUOTED */
+}
+
+QUOTED : {
+
+  quoted = 1;
+  if (0 == (ppp = scan_next_quoted(scan))) {
+    if (nul) {
+      nul_undo(cp, cno, delim);
+    }
+    line_fsm_save(cp, buf, cno, *fld - buf, bufsz, quoted, 1);
+    return 0;
+  }
+
+  const char ch = *ppp;
+  if (ch == esc) {
+    char nextch = (ppp + 1 < q ? ppp[1] : 0);
+    if (nextch == qte || nextch == esc) {
+      if (unlikely(ppp + 1 != scan_next_quoted(scan))) {
+        if (nul) {
+          nul_undo(cp, cno, delim);
+        }
+        return reterr(cp, CSV_EINTERNAL, "internal error: bad pointer value",
+                      cno, nline, ppp - buf);
+      }
+      goto QUOTED;
+    }
+    if (nextch == 0) {
+      if (nul) {
+        nul_undo(cp, cno, delim);
+      }
+      line_fsm_save(cp, buf, cno, *fld - buf, ppp - buf, quoted, 1);
+      return 0;
+    }
+    // fallthru
+  }
+  if (likely(ch == qte)) {
+    // close quote
+    goto UNQUOTED;
+  }
+
+  goto QUOTED;
+}
+
+ENDVAL : {
+  /* ppp is pointing at [delim, \n, \r] */
+  assert(*ppp == delim || *ppp == '\n' || *ppp == '\r');
+
+  /* fin the field */
+  cp->len[cno] = ppp - *fld;
+  if (quoted) {
+    qmap_set(cp, cno);
+  }
+  nmap_set(cp, cno, ppp - *fld);
+  cno++;
+
+  if (likely(*ppp == delim)) {
+    if (nul) {
+      *(char *)ppp = 0;
+    }
+    ppp++;
+    goto STARTVAL; /* start next field */
+  }
+
+  /* the field is done? */
+  int n = endrow(cp, ppp, q);
+  if (unlikely(n <= 0)) {
+    if (nul) {
+      nul_undo(cp, cno - 1, delim);
+    }
+    if (n == 0) {
+      /* a \r at the end of buf[]; come back to it with more data */
+      line_fsm_save(cp, buf, cno - 1, *fld - buf, ppp - buf, quoted, 0);
+      return 0;
+    }
+    return reterr(cp, CSV_ECRLF, errcrlf, cno - 1, nline, ppp - buf);
+  }
+  if (nul) {
+    *(char *)ppp = 0;
+  }
+  ppp += n;
+  cp->fldtop = cno;
+  goto FINROW;
+}
+
+ENDINPUT : {
+  /* the end of input ends the last field and the row */
+  cp->len[cno] = ppp - *fld;
+  if (quoted) {
+    qmap_set(cp, cno);
+  }
+  nmap_set(cp, cno, ppp - *fld);
+  cp->fldtop = ++cno;
+  goto FINROW;
+}
+
+FINROW : {
+  int rowsz = ppp - buf;
+  nline++;
+  cp->state.linenum += nline;
+  cp->state.rownum++;
+  cp->state.charnum += rowsz;
+
+  return rowsz;
+}
+}
+
+/*
+ * line - csv_line. With nul, the delim or row terminator after each
+ * field is overwritten with a NUL as the field is found, so that
+ * touchup only has to visit the special fields. A row that cannot be
+ * finished leaves buf[] as it was.
+ */
+INLINE int line(csv_parse_t *const cp, const char *buf, int bufsz,
+                const int nul) {
+  if (unlikely(!buf || bufsz <= 0)) {
+    cp->resume.ok = cp->resume.again = 0;
+    return bufsz == 0 ? 0 : reterr(cp, CSV_EPARAM, "bad bufsz", 0, 0, 0);
+  }
+  if (cp->spec == SPEC_PSV) {
+    return line_fsm_tmpl(cp, buf, bufsz, '"', '\\', '|', nul);
+  }
+  if (likely(cp->esc == cp->qte)) {
+    return line_sindex(cp, buf, bufsz, 0, nul);
+  }
+  return line_fsm_tmpl(cp, buf, bufsz, cp->qte, cp->esc, cp->delim, nul);
+}
+
+int csv_line(csv_parse_t *const cp, const char *buf, int bufsz) {
+  /*
+   * NOTE: this routine MUST NOT modify buf[]; it should only index
+   * fld[] into buf[].  When it succeeded, then buf[] can be modified
+   * later via a call to touchup().
+   */
+  return line(cp, buf, bufsz, 0);
+}
+
+/* csv_line for the callers that touch up the row in buf[] after */
+static int line_nul(csv_parse_t *const cp, char *buf, int bufsz) {
+  return line(cp, buf, bufsz, 1);
+}
+
+void csv_feed_again(csv_parse_t *const cp) {
+  cp->resume.again = cp->resume.ok;
+}
+
+int csv_feed(csv_parse_t *const cp, char *buf, int bufsz, char ***ret_field,
+             int *ret_nfield) {
+  *ret_field = 0;
+  *ret_nfield = 0;
+
+  int rowsz = line_nul(cp, buf, bufsz);
+  if (rowsz <= 0) {
+    // insufficient chars in buf for a row
+    return rowsz;
+  }
+
+  // we have a row!
+  *ret_field = cp->fld;
+
+  // go back to fix up fields with escaped chars
+  *ret_nfield = touchup_row(cp);
+
+  return rowsz;
+}
+
+/* touch up the row found by csv_line and append it to the batch */
+static int batch_add(csv_parse_t *cp) {
+  csv_batch_t *b = &cp->batch;
+  const int top = cp->fldtop;
+  if (unlikely(batch_reserve(b, top))) {
+    return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", 0, 0, 0);
+  }
+  int *off = b->off + b->nfield;
+  int *len = b->len + b->nfield;
+  for (int i = 0; i < top; i++) {
+    off[i] = cp->fld[i] - b->buf; /* touchup keeps the start of a field */
+  }
+  touchup(cp);
+  for (int i = 0; i < top; i++) {
+    len[i] = cp->fld[i] ? cp->len[i] : -1;
+  }
+  b->nfield += top;
+  b->row[++b->nrow] = b->nfield;
+  return 0;
+}
+
+/* start an empty batch of rows in buf[] */
+static int batch_reset(csv_parse_t *cp, char *buf, int64_t rownum) {
+  csv_batch_t *b = &cp->batch;
+  b->buf = buf;
+  b->rownum = rownum;
+  b->nrow = 0;
+  b->nfield = 0;
+  if (unlikely(batch_reserve(b, 0))) {
+    return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", 0, 0, 0);
+  }
+  b->row[0] = 0;
+  return 0;
+}
+
+int csv_feed_batch(csv_parse_t *const cp, char *buf, int bufsz, int maxrow,
+                   const csv_batch_t **ret_batch) {
+  csv_batch_t *b = &cp->batch;
+  *ret_batch = b;
+  if (unlikely(batch_reset(cp, buf, cp->state.rownum + 1))) {
+    return -1;
+  }
+
+  char *p = buf;
+  char *const q = buf + bufsz;
+  const int indexed = (cp->esc == cp->qte);
+  if (unlikely(p == q)) {
+    cp->resume.ok = cp->resume.again = 0;
+  }
+  while (p < q && (maxrow <= 0 || b->nrow < maxrow)) {
+    int rowsz =
+        indexed ? line_sindex(cp, p, q - p, b, 0) : line_nul(cp, p, q - p);
+    if (rowsz <= 0) {
+      if (rowsz < 0 && b->nrow == 0) {
+        return -1;
+      }
+      break; /* an error will be raised again by the next call */
+    }
+    if (indexed) {
+      /* the fields are in the batch already; touch them up */
+      const int top = cp->fldtop;
+      const int *off = b->off + b->nfield;
+      int *len = b->len + b->nfield;
+      for (int k = 0; k < top; k++) {
+        const int n = len[k];
+        len[k] = touchup1(cp, b->buf + off[k], n < 0 ? ~n : n, n < 0);
+      }
+      const int end = b->nfield + top;
+      b->nfield = end;
+      b->row[++b->nrow] = end;
+      if (unlikely(batch_reserve(b, 0))) {
+        return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", 0, 0, 0);
+      }
+    } else if (unlikely(batch_add(cp))) {
+      return -1;
+    }
+    p += rowsz;
+  }
+
+  return p - buf;
+}
+
+/**
+ *  line_last - csv_line for the last row, which may be missing its
+ *  newline. The end of buf[] is taken as the end of input, so the row
+ *  is parsed in place. Writes to buf[] only with nul, as line_nul.
+ */
+static int line_last(csv_parse_t *const cp, const char *buf, int bufsz,
+                     int nul) {
+  cp->eob = cp->eof = 1;
+  int n = nul ? line_nul(cp, (char *)buf, bufsz) : csv_line(cp, buf, bufsz);
+  cp->eob = cp->eof = 0;
+  return n;
+}
+
+/**
+ *  feed_last - csv_feed_last. If the row has no newline, its last
+ *  field needs buf[bufsz] for the NUL terminator; unless the caller
+ *  says that byte is ours (room), the field is copied to cp->lastbuf.
+ */
+static int feed_last(csv_parse_t *const cp, char *buf, int bufsz, int room,
+                     char ***ret_field, int *ret_nfield) {
+  *ret_field = 0;
+  *ret_nfield = 0;
+
+  int rowsz = line_last(cp, buf, bufsz, 1);
+  if (rowsz <= 0) {
+    return rowsz;
+  }
+
+  const int last = cp->fldtop - 1;
+  const int len = cp->len[last];
+  if (!room && cp->fld[last] + len == buf + bufsz) {
+    if (len >= cp->lastbufsz) {
+      char *p = realloc(cp->lastbuf, len + 1);
+      if (!p) {
+        return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", last, 0, 0);
+      }
+      cp->lastbuf = p;
+      cp->lastbufsz = len + 1;
+    }
+    memcpy(cp->lastbuf, cp->fld[last], len);
+    cp->fld[last] = cp->lastbuf;
+  }
+
+  *ret_field = cp->fld;
+  *ret_nfield = touchup_row(cp);
+
+  return rowsz;
+}
+
+int csv_feed_last(csv_parse_t *const cp, char *buf, int bufsz,
+                  char ***ret_field, int *ret_nfield) {
+  return feed_last(cp, buf, bufsz, 0, ret_field, ret_nfield);
+}
+
+int csv_feed_batch_last(csv_parse_t *const cp, char *buf, int bufsz,
+                        const csv_batch_t **ret_batch) {
+  *ret_batch = &cp->batch;
+  if (unlikely(batch_reset(cp, buf, cp->state.rownum + 1))) {
+    return -1;
+  }
+  int rowsz = line_last(cp, buf, bufsz, 1);
+  if (rowsz > 0 && batch_add(cp)) {
+    return -1;
+  }
+  return rowsz;
+}
+
+/* does the value s[0..len) of a field satisfy grep? */
+static int grep_match1(csv_parse_t *cp, const csv_grep_t *grep, const char *s,
+                       int len) {
+  if (!s || len < grep->patsz) {
+    return 0;
+  }
+  switch (grep->how) {
+  case CSV_GREP_EQUALS:
+    return len == grep->patsz && 0 == memcmp(s, grep->pat, len);
+  case CSV_GREP_PREFIX:
+    return 0 == memcmp(s, grep->pat, grep->patsz);
+  default:
+    return 0 != cp->kern->find(s, len, grep->pat, grep->patsz);
+  }
+}
+
+/* does the touched up row in cp->fld[] satisfy grep? */
+static int grep_match(csv_parse_t *cp, const csv_grep_t *grep) {
+  if (grep->col >= 0) {
+    return grep->col < cp->fldtop &&
+           grep_match1(cp, grep, cp->fld[grep->col], cp->len[grep->col]);
+  }
+  for (int i = 0; i < cp->fldtop; i++) {
+    if (grep_match1(cp, grep, cp->fld[i], cp->len[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* is the quoted field p[0..len) just its value in a pair of quotes? */
+static int grep_plain(const csv_parse_t *cp, const char *p, int len) {
+  return len >= 2 && p[0] == cp->qte && p[len - 1] == cp->qte &&
+         !memchr(p + 1, cp->qte, len - 2) &&
+         (cp->esc == cp->qte || !memchr(p + 1, cp->esc, len - 2));
+}
+
+/**
+ *  grep_quoted - can the row in cp->fld[], whose raw bytes do not hold
+ *  the pattern, match all the same? Dropping the quotes of a field may
+ *  join the bytes on either side of them, so the quoted fields that
+ *  are more than a value in a pair of quotes are unescaped into
+ *  cp->grepbuf and tested. Returns 1 if one matches, 0 if none, or -1
+ *  on error. Does not write to the row.
+ */
+static int grep_quoted(csv_parse_t *cp, const csv_grep_t *grep) {
+  int lo = 0;
+  int hi = cp->fldtop;
+  if (grep->col >= 0) {
+    lo = grep->col;
+    hi = grep->col < hi ? grep->col + 1 : 0;
+  }
+  for (int i = lo; i < hi; i++) {
+    const char *p = cp->fld[i];
+    const int len = cp->len[i];
+    if (!qmap_get(cp->qmap, i) || len == 0 ||
+        (len == cp->nullstrsz && 0 == memcmp(p, cp->nullstr, len)) ||
+        grep_plain(cp, p, len)) {
+      continue; /* as is, or a sql NULL */
+    }
+    if (len > cp->grepbufsz) {
+      char *x = realloc(cp->grepbuf, len);
+      if (!x) {
+        return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", i, 0, 0);
+      }
+      cp->grepbuf = x;
+      cp->grepbufsz = len;
+    }
+    const int k = unescape(cp, p, len, cp->grepbuf);
+    if (grep_match1(cp, grep, cp->grepbuf, k)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int csv_feed_grep(csv_parse_t *const cp, char *buf, int bufsz, int last,
+                  const csv_grep_t *grep, char ***ret_field,
+                  int *ret_nfield) {
+  *ret_field = 0;
+  *ret_nfield = 0;
+
+  /* the raw bytes hold the pattern as is unless it has quotes or
+   * escapes in it, which would be doubled or escaped in buf[] */
+  int prefilter = grep->patsz > 0;
+  for (int i = 0; i < grep->patsz && prefilter; i++) {
+    prefilter = grep->pat[i] != cp->qte && grep->pat[i] != cp->esc;
+  }
+
+  char *p = buf;
+  char *const q = buf + bufsz;
+  const char *hit = 0; /* next occurrence of the pattern at or after p */
+  while (p < q) {
+    if (prefilter && hit < p) {
+      hit = cp->kern->find(p, q - p, grep->pat, grep->patsz);
+      hit = hit ? hit : q;
+    }
+    int rowsz = last ? line_last(cp, p, q - p, 1) : line_nul(cp, p, q - p);
+    if (rowsz <= 0) {
+      if (rowsz < 0) {
+        return -1;
+      }
+      break;
+    }
+    char *const end = p + rowsz;
+    int candidate = !prefilter || hit < end;
+    if (!candidate && cp->qtop) {
+      if ((candidate = grep_quoted(cp, grep)) < 0) {
+        return -1;
+      }
+    }
+    if (candidate) {
+      touchup(cp);
+      if (grep_match(cp, grep)) {
+        *ret_field = cp->fld;
+        *ret_nfield = cp->fldtop;
+        return end - buf;
+      }
+    }
+    p = end;
+  }
+
+  return p - buf;
+}
+
+/* point cp->view[] at the fields of the row found by csv_line */
+static int mkview(csv_parse_t *cp) {
+  const int top = cp->fldtop;
+  if (top > cp->viewmax) {
+    int max = cp->fldmax;
+    csv_view_t *view = realloc(cp->view, max * sizeof(*view));
+    if (!view) {
+      return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", 0, 0, 0);
+    }
+    cp->view = view;
+    cp->viewmax = max;
+  }
+  for (int i = 0; i < top; i++) {
+    cp->view[i].ptr = cp->fld[i];
+    cp->view[i].len = cp->len[i];
+    cp->view[i].flags = qmap_get(cp->qmap, i) ? CSV_VIEW_QUOTED : 0;
+  }
+  return 0;
+}
+
+int csv_feed_view(csv_parse_t *const cp, const char *buf, int bufsz,
+                  const csv_view_t **ret_view, int *ret_nview) {
+  *ret_view = 0;
+  *ret_nview = 0;
+
+  int rowsz = csv_line(cp, buf, bufsz);
+  if (rowsz <= 0) {
+    return rowsz;
+  }
+  if (unlikely(mkview(cp))) {
+    return -1;
+  }
+
+  *ret_view = cp->view;
+  *ret_nview = cp->fldtop;
+  return rowsz;
+}
+
+int csv_feed_view_last(csv_parse_t *const cp, const char *buf, int bufsz,
+                       const csv_view_t **ret_view, int *ret_nview) {
+  *ret_view = 0;
+  *ret_nview = 0;
+
+  int rowsz = line_last(cp, buf, bufsz, 0);
+  if (rowsz <= 0) {
+    return rowsz;
+  }
+  if (unlikely(mkview(cp))) {
+    return -1;
+  }
+
+  *ret_view = cp->view;
+  *ret_nview = cp->fldtop;
+  return rowsz;
+}
+
+int csv_view_get(csv_parse_t *const cp, const csv_view_t *v, char *scratch,
+                 int scratchsz, const char **ret) {
+  *ret = 0;
+  if (v->len == 0 ||
+      (v->len == cp->nullstrsz && 0 == memcmp(v->ptr, cp->nullstr, v->len))) {
+    return 0; /* sql NULL */
+  }
+  if (!(v->flags & CSV_VIEW_QUOTED)) {
+    *ret = v->ptr;
+    return v->len;
+  }
+  if (scratchsz < v->len) {
+    return reterr(cp, CSV_EPARAM, "scratch buffer too small", 0, 0, 0);
+  }
+  *ret = scratch;
+  return unescape(cp, v->ptr, v->len, scratch);
+}
+
+/* ---- typed conversion ---- */
+
+/* are the 8 bytes in w all digits? */
+INLINE int swar_isdigits8(uint64_t w) {
+  return ((w & (SWAR_ONES * 0xf0)) |
+          (((w + SWAR_ONES * 0x06) & (SWAR_ONES * 0xf0)) >> 4)) ==
+         SWAR_ONES * 0x33;
+}
+
+/* value of the 8 digits in w, the first one in the lowest byte */
+INLINE uint64_t swar_digits8(uint64_t w) {
+  w -= SWAR_ONES * '0';
+  w = (w * 10) + (w >> 8);
+  return (((w & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32))) +
+          (((w >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32)))) >>
+         32;
+}
+
+/**
+ *  scan_digits - consume the digits at *pp, up to q, eight at a time
+ *  where possible. Returns how many there were; *v gets their value
+ *  if there were no more than 19.
+ */
+INLINE int scan_digits(const char **pp, const char *q, uint64_t *v) {
+  const char *p = *pp;
+  uint64_t x = 0;
+  while (q - p >= 8) {
+    uint64_t w = swar_load(p);
+    if (!swar_isdigits8(w)) {
+      break;
+    }
+    x = x * 100000000 + swar_digits8(w);
+    p += 8;
+  }
+  while (p < q && (unsigned)(*p - '0') <= 9) {
+    x = x * 10 + (*p++ - '0');
+  }
+  const int n = p - *pp;
+  *pp = p;
+  *v = x;
+  return n;
+}
+
+/* skip the leading zeros of the digits at p, keeping the last one */
+INLINE const char *skip_zeros(const char *p, const char *q) {
+  while (q - p > 1 && p[0] == '0' && (unsigned)(p[1] - '0') <= 9) {
+    p++;
+  }
+  return p;
+}
+
+/* parse an optional sign at *pp; returns 1 if it is a minus */
+INLINE int scan_sign(const char **pp, const char *q) {
+  const char *p = *pp;
+  if (p < q && (*p == '-' || *p == '+')) {
+    *pp = p + 1;
+    return *p == '-';
+  }
+  return 0;
+}
+
+static int parse_int64(const char *p, int len, int64_t *ret) {
+  const char *const q = p + len;
+  const int neg = scan_sign(&p, q);
+  uint64_t v;
+  p = skip_zeros(p, q);
+  const int n = scan_digits(&p, q, &v);
+  if (n == 0 || n > 19 || p != q || v > (uint64_t)INT64_MAX + neg) {
+    return -1;
+  }
+  *ret = neg ? (int64_t)(0 - v) : (int64_t)v;
+  return 0;
+}
+
+static const double pow10_exact[23] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* skip the digits at p; returns how many */
+INLINE int skip_digits(const char **pp, const char *q) {
+  const char *p = *pp;
+  while (p < q && (unsigned)(*p - '0') <= 9) {
+    p++;
+  }
+  const int n = p - *pp;
+  *pp = p;
+  return n;
+}
+
+/* is p[0..len) a decimal float: [sign] digits [. digits] [e [sign]
+ * digits], with a digit before or after the point? */
+static int is_decimal(const char *p, int len) {
+  const char *const q = p + len;
+  scan_sign(&p, q);
+  int n = skip_digits(&p, q);
+  if (p < q && *p == '.') {
+    p++;
+    n += skip_digits(&p, q);
+  }
+  if (n == 0) {
+    return 0;
+  }
+  if (p < q && (*p == 'e' || *p == 'E')) {
+    p++;
+    scan_sign(&p, q);
+    if (0 == skip_digits(&p, q)) {
+      return 0;
+    }
+  }
+  return p == q;
+}
+
+/**
+ *  parse_float64 - parse a decimal float. When the digits make an
+ *  integer m of at most 2^53 and the exponent e is within 22 of zero,
+ *  both m and 10^e are exact doubles, so the one multiply or divide
+ *  of m * 10^e is correctly rounded. Any other decimal goes to strtod,
+ *  on a NUL terminated copy as p[len] may be the next field.
+ */
+static int parse_float64(const char *p, int len, double *ret) {
+  const char *const q = p + len;
+  const char *s = p;
+  const int neg = scan_sign(&s, q);
+  uint64_t ip, fp = 0;
+  s = skip_zeros(s, q);
+  const int n1 = scan_digits(&s, q, &ip);
+  int n2 = 0;
+  if (s < q && *s == '.') {
+    s++;
+    n2 = scan_digits(&s, q, &fp);
+  }
+  int e = -n2;
+  if (n1 + n2 == 0 || n1 + n2 > 19) {
+    goto slow;
+  }
+  if (s < q && (*s == 'e' || *s == 'E')) {
+    s++;
+    const int eneg = scan_sign(&s, q);
+    uint64_t x;
+    const int n = scan_digits(&s, q, &x);
+    if (n == 0 || n > 3) {
+      goto slow;
+    }
+    e += eneg ? -(int)x : (int)x;
+  }
+  if (s != q) {
+    goto slow;
+  }
+
+  const uint64_t m = ip * (uint64_t)pow10_exact[n2] + fp;
+  if (m > (1ULL << 53) || e < -22 || e > 22) {
+    goto slow;
+  }
+  double v = (double)m;
+  v = e < 0 ? v / pow10_exact[-e] : v * pow10_exact[e];
+  *ret = neg ? -v : v;
+  return 0;
+
+slow : {
+  /* strtod also takes nan, inf, hex and leading blanks */
+  if (!is_decimal(p, len)) {
+    return -1;
+  }
+  char tmp[64];
+  char *z = len < (int)sizeof(tmp) ? tmp : malloc(len + 1);
+  if (!z) {
+    return -1;
+  }
+  memcpy(z, p, len);
+  z[len] = 0;
+  char *end;
+  *ret = strtod(z, &end);
+  const int ok = (end == z + len);
+  if (z != tmp) {
+    free(z);
+  }
+  return ok ? 0 : -1;
+}
+}
+
+/* parse a decimal with up to scale digits after the point, as the
+ * integer value * 10^scale */
+static int parse_decimal(const char *p, int len, int scale, int64_t *ret) {
+  const char *const q = p + len;
+  const int neg = scan_sign(&p, q);
+  uint64_t ip, fp = 0;
+  p = skip_zeros(p, q);
+  const int n1 = scan_digits(&p, q, &ip);
+  int n2 = 0;
+  if (p < q && *p == '.') {
+    p++;
+    n2 = scan_digits(&p, q, &fp);
+  }
+  if (n1 + n2 == 0 || n1 > 19 || n2 > scale || p != q) {
+    return -1;
+  }
+  /* ip * 10^scale + fp * 10^(scale - n2) */
+  uint64_t v;
+  if (__builtin_mul_overflow(ip, (uint64_t)pow10_exact[scale], &v) ||
+      __builtin_add_overflow(v, fp * (uint64_t)pow10_exact[scale - n2], &v) ||
+      v > (uint64_t)INT64_MAX + neg) {
+    return -1;
+  }
+  *ret = neg ? (int64_t)(0 - v) : (int64_t)v;
+  return 0;
+}
+
+static int parse_bool(const char *p, int len, uint8_t *ret) {
+  static const char *const name[] = {"false", "f", "no", "n", "0",
+                                     "true",  "t", "yes", "y", "1"};
+  for (int i = 0; i < 10; i++) {
+    if (len == (int)strlen(name[i]) && 0 == strncasecmp(p, name[i], len)) {
+      *ret = i >= 5;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* value of the n digits at p, or -1 if they are not all digits */
+INLINE int fixed_digits(const char *p, int n) {
+  int v = 0;
+  for (int i = 0; i < n; i++) {
+    const unsigned d = p[i] - '0';
+    if (d > 9) {
+      return -1;
+    }
+    v = v * 10 + d;
+  }
+  return v;
+}
+
+/* days since 1970-01-01 of a date in the proleptic gregorian calendar */
+static int64_t days_from_civil(int y, int m, int d) {
+  y -= m <= 2;
+  const int era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = y - era * 400;
+  const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return (int64_t)era * 146097 + doe - 719468;
+}
+
+/* parse YYYY-MM-DD at p as days since 1970-01-01 */
+static int parse_date10(const char *p, int64_t *ret) {
+  static const int mdays[13] = {0, 31, 29, 31, 30, 31, 30,
+                                31, 31, 30, 31, 30, 31};
+  const int y = fixed_digits(p, 4);
+  const int m = fixed_digits(p + 5, 2);
+  const int d = fixed_digits(p + 8, 2);
+  if (y < 0 || m < 1 || m > 12 || d < 1 || d > mdays[m] || p[4] != '-' ||
+      p[7] != '-') {
+    return -1;
+  }
+  if (m == 2 && d == 29 && (y % 4 || (y % 100 == 0 && y % 400))) {
+    return -1;
+  }
+  *ret = days_from_civil(y, m, d);
+  return 0;
+}
+
+static int parse_date(const char *p, int len, int32_t *ret) {
+  int64_t days;
+  if (len != 10 || parse_date10(p, &days)) {
+    return -1;
+  }
+  *ret = days;
+  return 0;
+}
+
+/* parse YYYY-MM-DD[(T| )HH:MM:SS[.f...]][Z] as microseconds since
+ * 1970-01-01 00:00:00 UTC */
+static int parse_timestamp(const char *p, int len, int64_t *ret) {
+  int64_t days;
+  if (len < 10 || parse_date10(p, &days)) {
+    return -1;
+  }
+  int64_t us = 0;
+  const char *s = p + 10;
+  const char *const q = p + len;
+  if (s < q) {
+    if (q - s < 9 || (*s != 'T' && *s != ' ') || s[3] != ':' || s[6] != ':') {
+      return -1;
+    }
+    const int hh = fixed_digits(s + 1, 2);
+    const int mm = fixed_digits(s + 4, 2);
+    const int ss = fixed_digits(s + 7, 2);
+    if (hh < 0 || hh > 23 || mm < 0 || mm > 59 || ss < 0 || ss > 59) {
+      return -1;
+    }
+    us = ((hh * 60 + mm) * 60 + ss) * (int64_t)1000000;
+    s += 9;
+    if (s < q && *s == '.') {
+      /* keep up to 6 digits of the fraction */
+      int n = 0;
+      for (s++; s < q && (unsigned)(*s - '0') <= 9; s++, n++) {
+        if (n < 6) {
+          us += (*s - '0') * (int64_t)pow10_exact[5 - n];
+        }
+      }
+      if (n == 0 || n > 9) {
+        return -1;
+      }
+    }
+    if (s < q && *s == 'Z') {
+      s++;
+    }
+    if (s != q) {
+      return -1;
+    }
+  }
+  *ret = days * 86400 * (int64_t)1000000 + us;
+  return 0;
+}
+
+/* bytes per value of a column type in data[] */
+static int column_width(int type) {
+  switch (type) {
+  case CSV_BOOL:
+    return 1;
+  case CSV_DATE:
+  case CSV_STRING: /* int offsets */
+    return 4;
+  default:
+    return 8;
+  }
+}
+
+/* make room for nrow values, and strsz bytes of strings */
+static int column_reserve(csv_column_t *x, int nrow, int strsz) {
+  if (nrow > x->maxrow || !x->data) {
+    const int max = nrow + nrow / 2 + 64;
+    void *data = realloc(x->data, (size_t)(max + 1) * column_width(x->type));
+    if (data) {
+      x->data = data;
+    }
+    uint8_t *valid = realloc(x->valid, (max + 7) / 8);
+    if (valid) {
+      x->valid = valid;
+    }
+    if (!data || !valid) {
+      return -1;
+    }
+    x->maxrow = max;
+  }
+  if (strsz > x->maxstr) {
+    const int max = strsz + strsz / 2 + 1024;
+    char *str = realloc(x->str, max);
+    if (!str) {
+      return -1;
+    }
+    x->str = str;
+    x->maxstr = max;
+  }
+  return 0;
+}
+
+void csv_column_free(csv_column_t *x) {
+  if (x) {
+    free(x->valid);
+    free(x->data);
+    free(x->str);
+    x->valid = 0;
+    x->data = 0;
+    x->str = 0;
+    x->nrow = x->nnull = x->strsz = x->maxrow = x->maxstr = 0;
+  }
+}
+
+/* save the error of a value that does not convert */
+static int converr(csv_parse_t *cp, int errnum, const char *errmsg,
+                   int64_t rownum, int cno) {
+  cp->state.errnum = errnum;
+  cp->state.errmsg = errmsg;
+  cp->state.elinenum = 0;
+  cp->state.echarnum = 0;
+  cp->state.erownum = rownum;
+  cp->state.efldnum = cno;
+  return -1;
+}
+
+/* convert column c of the rows r0..r1-1 in b, appending them to x */
+static int convert1(csv_parse_t *cp, const csv_batch_t *b, int r0, int r1,
+                    int c, csv_column_t *x) {
+  const int base = x->nrow - r0; /* row r goes to value base + r */
+  int strsz = x->strsz;
+  if (x->type == CSV_STRING) {
+    for (int r = r0; r < r1; r++) {
+      const int j = b->row[r] + c;
+      strsz += (j < b->row[r + 1] && b->len[j] > 0) ? b->len[j] : 0;
+    }
+  }
+  if (column_reserve(x, base + r1, strsz)) {
+    return converr(cp, CSV_EOUTOFMEMORY, "out of memory", b->rownum + r0, c);
+  }
+  /* clear the validity bits past the values already in x */
+  if (x->nrow & 7) {
+    x->valid[x->nrow >> 3] &= (1 << (x->nrow & 7)) - 1;
+  }
+  memset(x->valid + (x->nrow + 7) / 8, 0,
+         (base + r1 + 7) / 8 - (x->nrow + 7) / 8);
+  if (x->type == CSV_STRING && x->nrow == 0) {
+    ((int *)x->data)[0] = 0;
+  }
+  x->nrow = base + r1;
+
+  for (int r = r0; r < r1; r++) {
+    const int j = b->row[r] + c;
+    const int i = base + r;
+    if (unlikely(j >= b->row[r + 1])) {
+      return converr(cp, CSV_ECONVERT, "missing field", b->rownum + r, c);
+    }
+    const int len = b->len[j];
+    const char *s = b->buf + b->off[j];
+    int err = 0;
+    if (len < 0) {
+      x->nnull++;
+      s = "";
+    } else {
+      x->valid[i >> 3] |= 1 << (i & 7);
+    }
+    switch (x->type) {
+    case CSV_STRING: {
+      int *off = x->data;
+      const int n = len > 0 ? len : 0;
+      memcpy(x->str + x->strsz, s, n);
+      x->strsz += n;
+      off[i + 1] = x->strsz;
+      break;
+    }
+    case CSV_INT64:
+      ((int64_t *)x->data)[i] = 0;
+      err = len >= 0 && parse_int64(s, len, (int64_t *)x->data + i);
+      break;
+    case CSV_FLOAT64:
+      ((double *)x->data)[i] = 0;
+      err = len >= 0 && parse_float64(s, len, (double *)x->data + i);
+      break;
+    case CSV_DECIMAL:
+      ((int64_t *)x->data)[i] = 0;
+      err = len >= 0 &&
+            parse_decimal(s, len, x->scale, (int64_t *)x->data + i);
+      break;
+    case CSV_BOOL:
+      ((uint8_t *)x->data)[i] = 0;
+      err = len >= 0 && parse_bool(s, len, (uint8_t *)x->data + i);
+      break;
+    case CSV_DATE:
+      ((int32_t *)x->data)[i] = 0;
+      err = len >= 0 && parse_date(s, len, (int32_t *)x->data + i);
+      break;
+    case CSV_TIMESTAMP:
+      ((int64_t *)x->data)[i] = 0;
+      err = len >= 0 && parse_timestamp(s, len, (int64_t *)x->data + i);
+      break;
+    default:
+      return converr(cp, CSV_EPARAM, "bad column type", b->rownum + r, c);
+    }
+    if (unlikely(err)) {
+      return converr(cp, CSV_ECONVERT, "bad value for column type",
+                     b->rownum + r, c);
+    }
+  }
+  return 0;
+}
+
+/* check the scale of a CSV_DECIMAL column */
+static int convert_check(csv_parse_t *cp, const csv_column_t *x,
+                         int64_t rownum, int c) {
+  if (x->type == CSV_DECIMAL && (x->scale < 0 || x->scale > 18)) {
+    return converr(cp, CSV_EPARAM, "bad decimal scale", rownum, c);
+  }
+  return 0;
+}
+
+int csv_convert(csv_parse_t *const cp, const csv_batch_t *batch, int ncol,
+                csv_column_t col[]) {
+  for (int c = 0; c < ncol; c++) {
+    if (convert_check(cp, &col[c], batch->rownum, c)) {
+      return -1;
+    }
+    col[c].nrow = col[c].nnull = col[c].strsz = 0;
+    if (convert1(cp, batch, 0, batch->nrow, c, &col[c])) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int csv_parse_value(int type, int scale, const char *s, int len, void *ret) {
+  int err;
+  switch (type) {
+  case CSV_STRING:
+    return 0;
+  case CSV_INT64:
+    err = parse_int64(s, len, ret);
+    break;
+  case CSV_FLOAT64:
+    err = parse_float64(s, len, ret);
+    break;
+  case CSV_DECIMAL:
+    err = scale < 0 || scale > 18 || parse_decimal(s, len, scale, ret);
+    break;
+  case CSV_BOOL:
+    err = parse_bool(s, len, ret);
+    break;
+  case CSV_DATE:
+    err = parse_date(s, len, ret);
+    break;
+  case CSV_TIMESTAMP:
+    err = parse_timestamp(s, len, ret);
+    break;
+  default:
+    return -1;
+  }
+  return err ? -1 : 0;
+}
+
+/* initial size of cp->lastbuf */
+#define LASTBUF_MIN 256
+
+csv_parse_t *csv_open(int qte, int esc, int delim, const char nullstr[20]) {
+  return csv_open_ex(qte, esc, delim, nullstr, 0);
+}
+
+csv_parse_t *csv_open_ex(int qte, int esc, int delim, const char nullstr[20],
+                         int ncol) {
+  /* default values */
+  qte = qte ? qte : '"';
+  esc = esc ? esc : qte;
+  delim = delim ? delim : ',';
+  nullstr = nullstr ? nullstr : "";
+
+  /* alloc parse struct and init it */
+  csv_parse_t *cp;
+  if (!(cp = calloc(1, sizeof(csv_parse_t)))) {
+    return 0;
+  }
+  strncpy(cp->nullstr, nullstr, sizeof(cp->nullstr));
+  cp->nullstr[sizeof(cp->nullstr) - 1] = 0;
+  cp->nullstrsz = strlen(cp->nullstr);
+
+  cp->qte = qte;
+  cp->esc = esc;
+  cp->delim = delim;
+  dialect_init(&cp->dl, qte, esc, delim);
+  cp->kern = kernel_select();
+  if (cp->nullstrsz == 0 && qte == '"') {
+    if (delim == ',' && esc == '"') {
+      cp->spec = SPEC_CSV;
+    } else if (delim == '|' && esc == '\\') {
+      cp->spec = SPEC_PSV;
+    } else if (delim == '\t' && esc == '"') {
+      cp->spec = SPEC_TSV;
+    }
+  }
+
+  /* size the work areas up front so that short rows, like single
+   * messages, are parsed without touching the heap, and wide rows
+   * do not have to grow fld[] */
+  if (fld_reserve(cp, ncol > 64 ? ncol : 64) ||
+      sindex_reserve(&cp->six, 64) ||
+      !(cp->lastbuf = malloc(LASTBUF_MIN))) {
+    csv_close(cp);
+    return 0;
+  }
+  cp->lastbufsz = LASTBUF_MIN;
+
+  return cp;
+}
+
+int csv_project(csv_parse_t *cp, const int *col, int ncol) {
+  free(cp->proj);
+  cp->proj = 0;
+  cp->projmax = 0;
+  if (ncol <= 0) {
+    return 0;
+  }
+
+  int max = 0;
+  for (int i = 0; i < ncol; i++) {
+    if (col[i] < 0) {
+      return reterr(cp, CSV_EPARAM, "bad column", i, 0, 0);
+    }
+    max = col[i] >= max ? col[i] + 1 : max;
+  }
+  max = (max + 63) & ~63;
+  if (!(cp->proj = calloc(max / 64, sizeof(*cp->proj)))) {
+    return reterr(cp, CSV_EOUTOFMEMORY, "out of memory", 0, 0, 0);
+  }
+  for (int i = 0; i < ncol; i++) {
+    cp->proj[col[i] >> 6] |= (uint64_t)1 << (col[i] & 63);
+  }
+  cp->projmax = max;
+  return 0;
+}
+
+void csv_close(csv_parse_t *cp) {
+  if (cp) {
+    free(cp->proj);
+    free(cp->fld); /* with len[] and qmap[] */
+    free(cp->lastbuf);
+    free(cp->grepbuf);
+    csv_sindex_free(&cp->six);
+    free(cp->batch.row);
+    free(cp->batch.off);
+    free(cp->batch.len);
+    free(cp->view);
+    free(cp);
+  }
+}
+
+const char *csv_kernel(csv_parse_t *cp) { return cp->kern->name; }
+
+int csv_errnum(csv_parse_t *cp) { return cp->state.errnum; }
+const char *csv_errmsg(csv_parse_t *cp) { return cp->state.errmsg; }
+int csv_errlinenum(csv_parse_t *cp) { return cp->state.elinenum; }
+int csv_errcharnum(csv_parse_t *cp) { return cp->state.echarnum; }
+int csv_errrownum(csv_parse_t *cp) { return cp->state.erownum; }
+int csv_errfldnum(csv_parse_t *cp) { return cp->state.efldnum; }
+
+/* rows per on_rows call; keeps the batch arrays in cache */
+#define SCAN_BATCH 1024
+
+/* csv_scan defaults; see csv_scanopt_t */
+#define SCAN_BUFSZ (1024 * 1024)
+#define SCAN_MAXROWSZ (10 * 1024 * 1024)
+
+/* the callbacks of a scan; exactly one of on_row, on_rows, on_view is set */
+typedef struct scancb_t scancb_t;
+struct scancb_t {
+  intptr_t handle;   /* passed to all callbacks but on_bufempty */
+  intptr_t rdhandle; /* passed to on_bufempty */
+  int (*on_bufempty)(intptr_t handle, char *buf, int bufsz);
+  int (*on_row)(intptr_t handle, int64_t rownum, char **field, int nfield);
+  int (*on_rows)(intptr_t handle, const csv_batch_t *batch);
+  int (*on_view)(intptr_t handle, csv_parse_t *cp, int64_t rownum,
+                 const csv_view_t *view, int nview);
+  void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                   csv_parse_t *cp);
+  void (*on_open)(intptr_t handle, csv_parse_t *cp); /* optional */
+};
+
+/**
+ *  scan_rows - pass the complete rows in p..q to the callback.
+ *  Returns the #bytes consumed, or -1 on error.
+ */
+static int64_t scan_rows(csv_parse_t *cp, const scancb_t *cb, char *p,
+                         char *q) {
+  char *const start = p;
+  int nb;
+
+  // hand over the complete rows a batch at a time
+  while (cb->on_rows && p < q) {
+    const csv_batch_t *batch;
+    nb = csv_feed_batch(cp, p, q - p, SCAN_BATCH, &batch);
+    if (unlikely(nb <= 0)) {
+      if (nb == 0) {
+        csv_feed_again(cp); /* the caller comes back with this row */
+        break;
+      }
+      cb->on_error(cb->handle, 0, 0, cp);
+      return -1;
+    }
+    if (cb->on_rows(cb->handle, batch)) {
+      return -1;
+    }
+    p += nb;
+  }
+
+  // the rows as views into p..q, which is not modified
+  while (cb->on_view && p < q) {
+    const csv_view_t *view;
+    int nview;
+    nb = csv_feed_view(cp, p, q - p, &view, &nview);
+    if (unlikely(nb <= 0)) {
+      if (nb == 0) {
+        csv_feed_again(cp); /* the caller comes back with this row */
+        break;
+      }
+      cb->on_error(cb->handle, 0, 0, cp);
+      return -1;
+    }
+    if (cb->on_view(cb->handle, cp, cp->state.rownum, view, nview)) {
+      return -1;
+    }
+    p += nb;
+  }
+
+  // keep feeding until there is no more complete row
+  while (cb->on_row && p < q) {
+    char **field;
+    int nfield;
+    nb = csv_feed(cp, p, q - p, &field, &nfield);
+    if (unlikely(nb <= 0)) {
+      if (nb == 0) {
+        csv_feed_again(cp); /* the caller comes back with this row */
+        break;
+      }
+      cb->on_error(cb->handle, 0, 0, cp);
+      return -1;
+    }
+    if (cb->on_row(cb->handle, cp->state.rownum, field, nfield)) {
+      return -1;
+    }
+    p += nb;
+  }
+
+  return p - start;
+}
+
+/**
+ *  scan_last - pass the last row in p..q, which may be missing its
+ *  newline, to the callback. Returns the #bytes consumed, or -1 on
+ *  error. Unless the callback takes views, q[0] must be writable: the
+ *  last field is NUL terminated there.
+ */
+static int scan_last(csv_parse_t *cp, const scancb_t *cb, char *p, char *q) {
+  int nb;
+  if (cb->on_rows) {
+    nb = line_last(cp, p, q - p, 1);
+    if (nb < 0 || batch_reset(cp, p, cp->state.rownum) ||
+        (nb > 0 && batch_add(cp))) {
+      cb->on_error(cb->handle, 0, 0, cp);
+      return -1;
+    }
+    if (nb == 0) {
+      cp->batch.row[++cp->batch.nrow] = 0; /* same as on_row below */
+    }
+    if (cb->on_rows(cb->handle, &cp->batch)) {
+      return -1;
+    }
+  } else if (cb->on_view) {
+    const csv_view_t *view;
+    int nview;
+    nb = csv_feed_view_last(cp, p, q - p, &view, &nview);
+    if (nb < 0) {
+      cb->on_error(cb->handle, 0, 0, cp);
+      return -1;
+    }
+    if (cb->on_view(cb->handle, cp, cp->state.rownum, view, nview)) {
+      return -1;
+    }
+  } else {
+    char **field;
+    int nfield;
+    nb = feed_last(cp, p, q - p, 1, &field, &nfield);
+    if (nb < 0) {
+      cb->on_error(cb->handle, 0, 0, cp);
+      return -1;
+    }
+    if (cb->on_row(cb->handle, cp->state.rownum, field, nfield)) {
+      return -1;
+    }
+  }
+  return nb;
+}
+
+/* the buffer of a scan; where possible, a ring mapped twice back to back */
+typedef struct scanbuf_t scanbuf_t;
+struct scanbuf_t {
+  char *base;
+  int size;
+  int ring; /* base[size..2*size) is a second mapping of base[0..size) */
+};
+
+static int scanbuf_alloc(scanbuf_t *sb, int size) {
+  const int pg = sysconf(_SC_PAGESIZE);
+  size = (size + pg - 1) / pg * pg;
+  sb->size = size;
+#ifdef __linux__
+  int fd = memfd_create("csv_scan", MFD_CLOEXEC);
+  if (fd >= 0) {
+    char *p = MAP_FAILED;
+    if (0 == ftruncate(fd, size)) {
+      p = mmap(0, 2 * (size_t)size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+    }
+    if (p != MAP_FAILED) {
+      const int prot = PROT_READ | PROT_WRITE;
+      const int flags = MAP_SHARED | MAP_FIXED;
+      if (mmap(p, size, prot, flags, fd, 0) != MAP_FAILED &&
+          mmap(p + size, size, prot, flags, fd, 0) != MAP_FAILED) {
+        close(fd);
+        sb->base = p;
+        sb->ring = 1;
+        return 0;
+      }
+      munmap(p, 2 * (size_t)size);
+    }
+    close(fd);
+  }
+#endif
+  sb->base = malloc(size);
+  sb->ring = 0;
+  return sb->base ? 0 : -1;
+}
+
+static void scanbuf_free(scanbuf_t *sb) {
+  if (sb->ring) {
+    munmap(sb->base, 2 * (size_t)sb->size);
+  } else {
+    free(sb->base);
+  }
+  sb->base = 0;
+}
+
+/**
+ *  readahead - a thread that calls on_bufempty to keep nbuf buffers
+ *  filled ahead of the parser. The parser takes the data out with
+ *  readahead_read, which stands in for on_bufempty.
+ */
+typedef struct readahead_t readahead_t;
+struct readahead_t {
+  pthread_t thread;
+  pthread_mutex_t mu;
+  pthread_cond_t cv;
+  intptr_t rdhandle;
+  int (*on_bufempty)(intptr_t handle, char *buf, int bufsz);
+  int nbuf;  /* num buffers */
+  int bufsz; /* size of each buffer */
+  char *mem; /* the buffers, back to back */
+  int *len;  /* len[i] - #bytes in buffer i; <= 0 for eof or error */
+  int64_t head; /* buffers consumed */
+  int64_t tail; /* buffers filled; buffer tail % nbuf is next */
+  int off;      /* #bytes of buffer head % nbuf consumed */
+  int stop;     /* the parser is done */
+};
+
+static void *readahead_main(void *arg) {
+  readahead_t *ra = arg;
+  pthread_mutex_lock(&ra->mu);
+  for (;;) {
+    while (!ra->stop && ra->tail - ra->head == ra->nbuf) {
+      pthread_cond_wait(&ra->cv, &ra->mu);
+    }
+    if (ra->stop) {
+      break;
+    }
+    const int i = ra->tail % ra->nbuf;
+    pthread_mutex_unlock(&ra->mu);
+    int nb = ra->on_bufempty(ra->rdhandle, ra->mem + (int64_t)i * ra->bufsz,
+                             ra->bufsz);
+    pthread_mutex_lock(&ra->mu);
+    ra->len[i] = nb;
+    ra->tail++;
+    pthread_cond_broadcast(&ra->cv);
+    if (nb <= 0) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ra->mu);
+  return 0;
+}
+
+static int readahead_read(intptr_t handle, char *buf, int bufsz) {
+  readahead_t *ra = (readahead_t *)handle;
+  pthread_mutex_lock(&ra->mu);
+  while (ra->head == ra->tail) {
+    pthread_cond_wait(&ra->cv, &ra->mu);
+  }
+  const int i = ra->head % ra->nbuf;
+  const int len = ra->len[i];
+  pthread_mutex_unlock(&ra->mu);
+  if (len <= 0) {
+    return len; /* eof or error; stays at the head */
+  }
+
+  /* the reader leaves buffer i alone until head moves past it */
+  int nb = len - ra->off;
+  nb = nb < bufsz ? nb : bufsz;
+  memcpy(buf, ra->mem + (int64_t)i * ra->bufsz + ra->off, nb);
+  ra->off += nb;
+  if (ra->off == len) {
+    pthread_mutex_lock(&ra->mu);
+    ra->off = 0;
+    ra->head++;
+    pthread_cond_broadcast(&ra->cv);
+    pthread_mutex_unlock(&ra->mu);
+  }
+  return nb;
+}
+
+static int readahead_start(readahead_t *ra, const scancb_t *cb, int nbuf,
+                           int bufsz) {
+  memset(ra, 0, sizeof(*ra));
+  ra->rdhandle = cb->rdhandle;
+  ra->on_bufempty = cb->on_bufempty;
+  ra->nbuf = nbuf;
+  ra->bufsz = bufsz;
+  ra->mem = malloc((int64_t)nbuf * bufsz);
+  ra->len = calloc(nbuf, sizeof(*ra->len));
+  if (!ra->mem || !ra->len) {
+    goto bail;
+  }
+  pthread_mutex_init(&ra->mu, 0);
+  pthread_cond_init(&ra->cv, 0);
+  if (pthread_create(&ra->thread, 0, readahead_main, ra)) {
+    pthread_mutex_destroy(&ra->mu);
+    pthread_cond_destroy(&ra->cv);
+    goto bail;
+  }
+  return 0;
+
+bail:
+  free(ra->mem);
+  free(ra->len);
+  ra->mem = 0;
+  return -1;
+}
+
+/* stop the reader; it may have to finish an on_bufempty call first */
+static void readahead_stop(readahead_t *ra) {
+  if (!ra->mem) {
+    return;
+  }
+  pthread_mutex_lock(&ra->mu);
+  ra->stop = 1;
+  pthread_cond_broadcast(&ra->cv);
+  pthread_mutex_unlock(&ra->mu);
+  pthread_join(ra->thread, 0);
+  pthread_mutex_destroy(&ra->mu);
+  pthread_cond_destroy(&ra->cv);
+  free(ra->mem);
+  free(ra->len);
+  ra->mem = 0;
+}
+
+/* csv_scan and friends: read through on_bufempty into a buffer */
+static int scan(const scancb_t *cb, const csv_scanopt_t *opt, int qte,
+                int esc, int delim, const char nullstr[20]) {
+  const intptr_t handle = cb->handle;
+  const int maxrowsz = opt && opt->maxrowsz > 0 ? opt->maxrowsz : SCAN_MAXROWSZ;
+  const int growpct = opt && opt->growpct > 0 ? opt->growpct : 50;
+  scanbuf_t sb = {0};
+  readahead_t ra = {0};
+  scancb_t racb;
+  char *p;
+  char *q;
+  int eof = 0;
+  csv_parse_t *cp = 0;
+  int64_t nb;
+  char msg[100];
+
+  if (scanbuf_alloc(&sb, opt && opt->bufsz > 0 ? opt->bufsz : SCAN_BUFSZ)) {
+    cb->on_error(handle, CSV_EOUTOFMEMORY, "out of memory", 0);
+    goto bail;
+  }
+  p = q = sb.base;
+
+  cp = csv_open_ex(qte, esc, delim, nullstr, opt ? opt->ncol : 0);
+  if (!cp) {
+    cb->on_error(handle, CSV_EOUTOFMEMORY, "csv_open failed", 0);
+    goto bail;
+  }
+  if (opt && csv_project(cp, opt->col, opt->ncolsel)) {
+    cb->on_error(handle, 0, 0, cp);
+    goto bail;
+  }
+  if (cb->on_open) {
+    cb->on_open(handle, cp);
+  }
+
+  // read ahead in a thread; if one cannot be started, read inline
+  if (opt && opt->nreadahead > 0 &&
+      0 == readahead_start(&ra, cb, opt->nreadahead, sb.size)) {
+    racb = *cb;
+    racb.rdhandle = (intptr_t)&ra;
+    racb.on_bufempty = readahead_read;
+    cb = &racb;
+  }
+
+  // keep filling up buf[] and feeding csv until eof
+  while (!eof) {
+    if (sb.ring) {
+      // p..q is contiguous in the double mapping; keep p in the first one
+      if (p >= sb.base + sb.size) {
+        p -= sb.size;
+        q -= sb.size;
+      }
+    } else if (p != sb.base) {
+      // shift p..q to start of buf
+      memmove(sb.base, p, q - p);
+      q = sb.base + (q - p);
+      p = sb.base;
+    }
+
+    // the buffer is full of a partial row: grow it, up to maxrowsz
+    if (q - p == sb.size) {
+      if (sb.size >= maxrowsz) {
+        sprintf(msg, "row exceeds %d bytes", maxrowsz);
+        cb->on_error(handle, CSV_EROWTOOLONG, msg, 0);
+        goto bail;
+      }
+      int64_t newsz = (int64_t)sb.size * (100 + growpct) / 100;
+      newsz = newsz < maxrowsz ? newsz : maxrowsz;
+      scanbuf_t nsb;
+      if (scanbuf_alloc(&nsb, newsz)) {
+        sprintf(msg, "cannot expand buffer beyond %d bytes", sb.size);
+        cb->on_error(handle, CSV_EOUTOFMEMORY, msg, 0);
+        goto bail;
+      }
+      memcpy(nsb.base, p, q - p);
+      q = nsb.base + (q - p);
+      p = nsb.base;
+      scanbuf_free(&sb);
+      sb = nsb;
+    }
+
+    // fill
+    assert(!eof);
+    nb = cb->on_bufempty(cb->rdhandle, q, sb.size - (q - p));
+    if (nb < 0)
+      goto bail;
+
+    eof |= (nb == 0);
+    q += nb;
+
+    // pass on the complete rows in buf[]
+    if ((nb = scan_rows(cp, cb, p, q)) < 0) {
+      goto bail;
+    }
+    p += nb;
+  }
+
+  // one last row might remain in buf[]; the read that hit eof had
+  // room, so q is short of the end of the buffer
+  if (p < q) {
+    if ((nb = scan_last(cp, cb, p, q)) < 0) {
+      goto bail;
+    }
+    p += nb;
+  }
+
+  if (p != q) {
+    cb->on_error(handle, CSV_EEXTRAINPUT, "extra data after last row", 0);
+    goto bail;
+  }
+
+  readahead_stop(&ra);
+  scanbuf_free(&sb);
+  csv_close(cp);
+  return 0;
+
+bail:
+  readahead_stop(&ra);
+  scanbuf_free(&sb);
+  csv_close(cp);
+  return -1;
+}
+
+int csv_scan(intptr_t handle, int qte, int esc, int delim,
+             const char nullstr[20],
+             int (*on_bufempty)(intptr_t handle, char *buf, int bufsz),
+             int (*on_row)(intptr_t handle, int64_t rownum, char **field,
+                           int nfield),
+             void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                              csv_parse_t *cp)) {
+  scancb_t cb = {0};
+  cb.handle = cb.rdhandle = handle;
+  cb.on_bufempty = on_bufempty;
+  cb.on_row = on_row;
+  cb.on_error = on_error;
+  return scan(&cb, 0, qte, esc, delim, nullstr);
+}
+
+int csv_scan_ex(const csv_scanopt_t *opt, intptr_t handle, int qte, int esc,
+                int delim, const char nullstr[20],
+                int (*on_bufempty)(intptr_t handle, char *buf, int bufsz),
+                int (*on_row)(intptr_t handle, int64_t rownum, char **field,
+                              int nfield),
+                void (*on_error)(intptr_t handle, int errtype,
+                                 const char *errmsg, csv_parse_t *cp)) {
+  scancb_t cb = {0};
+  cb.handle = cb.rdhandle = handle;
+  cb.on_bufempty = on_bufempty;
+  cb.on_row = on_row;
+  cb.on_error = on_error;
+  return scan(&cb, opt, qte, esc, delim, nullstr);
+}
+
+int csv_scan_batch(intptr_t handle, int qte, int esc, int delim,
+                   const char nullstr[20],
+                   int (*on_bufempty)(intptr_t handle, char *buf, int bufsz),
+                   int (*on_rows)(intptr_t handle, const csv_batch_t *batch),
+                   void (*on_error)(intptr_t handle, int errtype,
+                                    const char *errmsg, csv_parse_t *cp)) {
+  return csv_scan_batch_ex(0, handle, qte, esc, delim, nullstr, on_bufempty,
+                           on_rows, on_error);
+}
+
+int csv_scan_batch_ex(const csv_scanopt_t *opt, intptr_t handle, int qte,
+                      int esc, int delim, const char nullstr[20],
+                      int (*on_bufempty)(intptr_t handle, char *buf,
+                                         int bufsz),
+                      int (*on_rows)(intptr_t handle,
+                                     const csv_batch_t *batch),
+                      void (*on_error)(intptr_t handle, int errtype,
+                                       const char *errmsg, csv_parse_t *cp)) {
+  scancb_t cb = {0};
+  cb.handle = cb.rdhandle = handle;
+  cb.on_bufempty = on_bufempty;
+  cb.on_rows = on_rows;
+  cb.on_error = on_error;
+  return scan(&cb, opt, qte, esc, delim, nullstr);
+}
+
+/* csv_feed takes an int size; a mapped file is parsed in windows */
+#define MAP_WINDOW (1 << 30)
+
+/* csv_scan_file: parse the mapped file buf[0..bufsz) in place */
+static int scan_map(const scancb_t *cb, const char *buf, int64_t bufsz,
+                    int qte, int esc, int delim, const char nullstr[20]) {
+  csv_parse_t *cp = csv_open(qte, esc, delim, nullstr);
+  if (!cp) {
+    cb->on_error(cb->handle, CSV_EOUTOFMEMORY, "csv_open failed", 0);
+    return -1;
+  }
+
+  /* only views are handed out; buf[] is never written */
+  char *p = (char *)buf;
+  char *const end = p + bufsz;
+  int64_t nb;
+  for (;;) {
+    // the window end stays put so csv_line can keep its index
+    char *q = (end - p > MAP_WINDOW) ? p + MAP_WINDOW : end;
+    if ((nb = scan_rows(cp, cb, p, q)) < 0) {
+      goto bail;
+    }
+    p += nb;
+    if (q == end) {
+      break;
+    }
+    if (nb == 0) {
+      cb->on_error(cb->handle, CSV_EROWTOOLONG, "row too long", 0);
+      goto bail;
+    }
+  }
+
+  // one last row might remain
+  if (p < end) {
+    if ((nb = scan_last(cp, cb, p, end)) < 0) {
+      goto bail;
+    }
+    p += nb;
+  }
+
+  if (p != end) {
+    cb->on_error(cb->handle, CSV_EEXTRAINPUT, "extra data after last row", 0);
+    goto bail;
+  }
+
+  csv_close(cp);
+  return 0;
+
+bail:
+  csv_close(cp);
+  return -1;
+}
+
+/* csv_scan_file: read a pipe or other unmappable file */
+static int fd_read(intptr_t fd, char *buf, int bufsz) {
+  ssize_t nb;
+  do {
+    nb = read(fd, buf, bufsz);
+  } while (nb < 0 && errno == EINTR);
+  return nb;
+}
+
+int csv_scan_file(const char *path, int flags, intptr_t handle, int qte,
+                  int esc, int delim, const char nullstr[20],
+                  int (*on_view)(intptr_t handle, csv_parse_t *cp,
+                                 int64_t rownum, const csv_view_t *view,
+                                 int nview),
+                  void (*on_error)(intptr_t handle, int errtype,
+                                   const char *errmsg, csv_parse_t *cp)) {
+  char msg[200];
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    snprintf(msg, sizeof(msg), "open %s: %s", path, strerror(errno));
+    on_error(handle, CSV_EIO, msg, 0);
+    return -1;
+  }
+
+  scancb_t cb = {0};
+  cb.handle = handle;
+  cb.rdhandle = fd;
+  cb.on_bufempty = fd_read;
+  cb.on_view = on_view;
+  cb.on_error = on_error;
+
+  int ret;
+  struct stat st;
+  char *map = MAP_FAILED;
+  if (0 == fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+    map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  if (map != MAP_FAILED) {
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    if (flags & CSV_SCAN_HUGEPAGE) {
+      madvise(map, st.st_size, MADV_HUGEPAGE);
+    }
+#endif
+    ret = scan_map(&cb, map, st.st_size, qte, esc, delim, nullstr);
+    munmap(map, st.st_size);
+  } else {
+    /* pipes, and files that cannot be mapped */
+    ret = scan(&cb, 0, qte, esc, delim, nullstr);
+  }
+
+  close(fd);
+  return ret;
+}
+
+/* chunks smaller than this are not worth a thread */
+#ifndef CSV_PARALLEL_MINCHUNK
+#define CSV_PARALLEL_MINCHUNK (1024 * 1024)
+#endif
+
+/* largest buf[] handed to csv_feed while parsing a chunk */
+#define PARALLEL_WINDOW (1 << 30)
+
+typedef struct pscan_t pscan_t;
+struct pscan_t {
+  const kernel_t *kern;
+  dialect_t dl;
+  int eol; /* newline style of the first row */
+  char *buf;
+  int64_t bufsz;
+  int qte, esc, delim;
+  const char *nullstr;
+  int (*on_row)(intptr_t handle, int64_t rownum, char **field, int nfield);
+  void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                   csv_parse_t *cp);
+  int abort; /* set when any thread fails; read with __atomic builtins */
+};
+
+typedef struct pchunk_t pchunk_t;
+struct pchunk_t {
+  pscan_t *ps;
+  intptr_t handle;
+  int64_t lo, hi; /* the bytes buf[lo..hi) assigned to this chunk */
+
+  /* pass 1: speculate on both quote states (h = 0, 1) at buf[lo] */
+  int parity;       /* odd number of quotes in buf[lo..hi) */
+  int64_t first[2]; /* offset past the first \n outside quotes; -1 if none */
+  int64_t nnl[2];   /* number of \n outside quotes */
+
+  /* stitched: rows starting in buf[start..end) belong to this chunk */
+  int64_t start, end;
+  int64_t rowbase; /* number of rows before start */
+  int ret;
+};
+
+/* pass 1: find row boundaries in a chunk for both starting quote states */
+static void *pscan_index(void *arg) {
+  pchunk_t *ck = arg;
+  const pscan_t *ps = ck->ps;
+  ck->parity = ps->kern->nlscan(ps->buf, ps->bufsz, ck->lo, ck->hi, &ps->dl,
+                                ck->first, ck->nnl);
+  return 0;
+}
+
+static void pscan_fail(pchunk_t *ck) {
+  ck->ret = -1;
+  __atomic_store_n(&ck->ps->abort, 1, __ATOMIC_RELAXED);
+}
+
+/* pass 2: parse the rows of a chunk with the regular csv_feed */
+static void *pscan_parse(void *arg) {
+  pchunk_t *ck = arg;
+  pscan_t *ps = ck->ps;
+  const intptr_t handle = ck->handle;
+  char **field;
+  int nfield;
+  int nb = 0;
+
+  csv_parse_t *cp = csv_open(ps->qte, ps->esc, ps->delim, ps->nullstr);
+  if (!cp) {
+    ps->on_error(handle, CSV_EOUTOFMEMORY, "csv_open failed", 0);
+    pscan_fail(ck);
+    return 0;
+  }
+  cp->state.rownum = ck->rowbase;
+  cp->state.linenum = ck->rowbase;
+  cp->state.charnum = ck->start;
+  cp->eol = ps->eol;
+
+  char *p = ps->buf + ck->start;
+  char *const end = ps->buf + ck->end;
+  while (p < end) {
+    char *const top = p;
+    char *const q = end - p < PARALLEL_WINDOW ? end : p + PARALLEL_WINDOW;
+
+    // feed rows until the window runs out. The chunk ends at a row
+    // boundary, so a \r at its end is a complete row terminator.
+    cp->eob = (q == end);
+    while (p < q) {
+      if (__atomic_load_n(&ps->abort, __ATOMIC_RELAXED)) {
+        goto bail;
+      }
+      nb = csv_feed(cp, p, q - p, &field, &nfield);
+      if (unlikely(nb <= 0)) {
+        if (nb == 0) {
+          csv_feed_again(cp); /* the next window starts with this row */
+          break;
+        }
+        ps->on_error(handle, 0, 0, cp);
+        goto fail;
+      }
+      if (ps->on_row(handle, cp->state.rownum, field, nfield)) {
+        goto fail;
+      }
+      p += nb;
+    }
+
+    if (p == q || p != top) {
+      continue;
+    }
+
+    if (q != ps->buf + ps->bufsz) {
+      ps->on_error(handle, CSV_EROWTOOLONG, "row too long", 0);
+      goto fail;
+    }
+
+    // one last row might remain at the end of buf[]
+    nb = csv_feed_last(cp, p, q - p, &field, &nfield);
+    if (nb < 0) {
+      ps->on_error(handle, 0, 0, cp);
+      goto fail;
+    }
+    if (nb > 0 && ps->on_row(handle, cp->state.rownum, field, nfield)) {
+      goto fail;
+    }
+    p += nb;
+    if (p != q) {
+      ps->on_error(handle, CSV_EEXTRAINPUT, "extra data after last row", 0);
+      goto fail;
+    }
+  }
+
+bail:
+  csv_close(cp);
+  return 0;
+
+fail:
+  pscan_fail(ck);
+  csv_close(cp);
+  return 0;
+}
+
+/* run fn on each of the n elements of sz bytes in arg[], each in its
+   own thread */
+static void pscan_run(void *arg, size_t sz, int n, void *(*fn)(void *)) {
+  char *const ck = arg;
+  pthread_t tid[n];
+  int started[n];
+  for (int i = 0; i < n; i++) {
+    started[i] = (i > 0 && 0 == pthread_create(&tid[i], 0, fn, ck + i * sz));
+  }
+  for (int i = 0; i < n; i++) {
+    if (!started[i]) {
+      fn(ck + i * sz); /* element 0, or could not start a thread */
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    if (started[i]) {
+      pthread_join(tid[i], 0);
+    }
+  }
+}
+
+int csv_scan_parallel(
+    int nthread, const intptr_t handle[], char *buf, int64_t bufsz, int qte,
+    int esc, int delim, const char nullstr[20],
+    int (*on_row)(intptr_t handle, int64_t rownum, char **field, int nfield),
+    void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                     csv_parse_t *cp)) {
+  if (nthread <= 0 || bufsz < 0 || (!buf && bufsz)) {
+    on_error(handle[0], CSV_EPARAM, "bad param", 0);
+    return -1;
+  }
+
+  pscan_t ps = {0};
+  ps.kern = kernel_select();
+  ps.buf = buf;
+  ps.bufsz = bufsz;
+  ps.qte = qte ? qte : '"';
+  ps.esc = esc ? esc : ps.qte;
+  ps.delim = delim ? delim : ',';
+  ps.nullstr = nullstr;
+  ps.on_row = on_row;
+  ps.on_error = on_error;
+  dialect_init(&ps.dl, ps.qte, ps.esc, ps.delim);
+
+  /* row boundaries can only be found from quote parity if esc == qte */
+  int n = nthread;
+  if (ps.esc != ps.qte) {
+    n = 1;
+  } else if (bufsz / n < CSV_PARALLEL_MINCHUNK) {
+    n = bufsz / CSV_PARALLEL_MINCHUNK;
+    n = n > 0 ? n : 1;
+  }
+
+  pchunk_t *ck = calloc(n, sizeof(*ck));
+  if (!ck) {
+    on_error(handle[0], CSV_EOUTOFMEMORY, "out of memory", 0);
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    ck[i].ps = &ps;
+    ck[i].handle = handle[i];
+    ck[i].lo = bufsz / n * i;
+    ck[i].hi = (i == n - 1) ? bufsz : bufsz / n * (i + 1);
+  }
+
+  if (n > 1) {
+    pscan_run(ck, sizeof(*ck), n, pscan_index);
+  }
+
+  /* stitch: the true quote state at each chunk boundary is now known */
+  int inquote = 0;
+  int64_t nrow = 0;
+  for (int i = 0; i < n; i++) {
+    if (i == 0) {
+      ck[i].start = 0;
+      ck[i].rowbase = 0;
+    } else {
+      ck[i].start = ck[i].first[inquote];
+      ck[i].rowbase = nrow + 1;
+      if (!ps.eol && ck[i].start > 0) {
+        /* the row that straddles into chunk i ends here; its style is
+         * the one every chunk checks its rows against */
+        const char *t = buf + ck[i].start;
+        if (t[-1] == '\r') {
+          ps.eol = EOL_CR;
+        } else {
+          ps.eol = (ck[i].start > 1 && t[-2] == '\r') ? EOL_CRLF : EOL_LF;
+        }
+      }
+    }
+    nrow += ck[i].nnl[inquote];
+    inquote ^= ck[i].parity;
+  }
+  for (int i = n - 1; i >= 0; i--) {
+    ck[i].end = (i == n - 1) ? bufsz : ck[i + 1].start;
+    if (ck[i].start < 0) {
+      ck[i].start = ck[i].end; /* no row starts in this chunk */
+    }
+  }
+
+  pscan_run(ck, sizeof(*ck), n, pscan_parse);
+
+  int ret = 0;
+  for (int i = 0; i < n; i++) {
+    ret |= ck[i].ret;
+  }
+  free(ck);
+  return ret;
+}
+
+/* csv_count_rows when esc != qte: the quotes of the rows cannot be
+   paired by parity, so walk the bytes as csv_line does */
+static int64_t count_fsm(csv_count_t *cnt, const char *buf, int64_t bufsz,
+                         int qte, int esc) {
+  int64_t nrow = 0;
+  int state = cnt->inquote; /* 0: unquoted, 1: quoted, 2: esc in quotes */
+  int cr = cnt->cr;
+  for (int64_t i = 0; i < bufsz; i++) {
+    const char ch = buf[i];
+    if (state == 0) {
+      if (ch == '\n') {
+        nrow += !cr;
+      } else if (ch == '\r') {
+        nrow++;
+      } else if (ch == qte) {
+        state = 1;
+      }
+      cr = (ch == '\r');
+    } else if (state == 1) {
+      state = (ch == esc) ? 2 : (ch == qte) ? 0 : 1;
+    } else {
+      state = 1; /* the char after an esc never closes the quotes */
+    }
+  }
+  cnt->inquote = state;
+  cnt->cr = cr;
+  return nrow;
+}
+
+int64_t csv_count_rows(csv_count_t *cnt, int nthread, const char *buf,
+                       int64_t bufsz, int qte, int esc, int last) {
+  if (nthread <= 0 || bufsz < 0 || (!buf && bufsz)) {
+    return -1;
+  }
+  qte = qte ? qte : '"';
+  esc = esc ? esc : qte;
+
+  if (bufsz > 0) {
+    const char tail = buf[bufsz - 1];
+    if (esc != qte) {
+      cnt->nrow += count_fsm(cnt, buf, bufsz, qte, esc);
+    } else {
+      pscan_t ps = {0};
+      ps.kern = kernel_select();
+      ps.buf = (char *)buf;
+      ps.bufsz = bufsz;
+      dialect_init(&ps.dl, qte, esc, ',');
+
+      int n = nthread;
+      if (bufsz / n < CSV_PARALLEL_MINCHUNK) {
+        n = bufsz / CSV_PARALLEL_MINCHUNK;
+        n = n > 0 ? n : 1;
+      }
+      pchunk_t ck[n];
+      memset(ck, 0, sizeof(ck));
+      for (int i = 0; i < n; i++) {
+        ck[i].ps = &ps;
+        ck[i].lo = bufsz / n * i;
+        ck[i].hi = (i == n - 1) ? bufsz : bufsz / n * (i + 1);
+      }
+      pscan_run(ck, sizeof(*ck), n, pscan_index);
+
+      /* the \n of a \r\n split over two blocks ends no row of its own */
+      int inquote = cnt->inquote;
+      if (cnt->cr && buf[0] == '\n') {
+        cnt->nrow--;
+      }
+      for (int i = 0; i < n; i++) {
+        cnt->nrow += ck[i].nnl[inquote];
+        inquote ^= ck[i].parity;
+      }
+      /* tail is no quote, so it is inside quotes iff the block ends so */
+      cnt->inquote = inquote;
+      cnt->cr = !inquote && tail == '\r';
+    }
+    cnt->partial = cnt->inquote || (tail != '\n' && tail != '\r');
+  }
+
+  if (last && cnt->partial) {
+    cnt->nrow++;
+    cnt->partial = 0;
+  }
+  return cnt->nrow;
+}
+
+/* csv_split finds row ends a block at a time */
+#define SPLIT_BLOCK (1024 * 1024)
+
+typedef struct split_t split_t;
+struct split_t {
+  pscan_t ps;
+  int64_t nblk;
+  int64_t *cum;    /* cum[b] - num row terminators before block b */
+  uint8_t *inq;    /* inq[b] - block b starts inside quotes */
+  uint8_t *parity; /* parity[b] - block b has an odd num of quotes */
+};
+
+/* a thread of csv_split: count the row terminators of blocks b0..b1 */
+typedef struct splitjob_t splitjob_t;
+struct splitjob_t {
+  split_t *sp;
+  int64_t b0, b1;
+  int64_t (*nnl)[2]; /* nnl[b - b0][h] - for quote state h at the start */
+};
+
+static void *split_count(void *arg) {
+  splitjob_t *job = arg;
+  const pscan_t *ps = &job->sp->ps;
+  for (int64_t b = job->b0; b < job->b1; b++) {
+    const int64_t lo = b * SPLIT_BLOCK;
+    const int64_t hi = lo + SPLIT_BLOCK < ps->bufsz ? lo + SPLIT_BLOCK
+                                                    : ps->bufsz;
+    int64_t first[2];
+    job->sp->parity[b] = ps->kern->nlscan(ps->buf, ps->bufsz, lo, hi, &ps->dl,
+                                          first, job->nnl[b - job->b0]);
+  }
+  return 0;
+}
+
+/* num row terminators in buf[0..pos), given that row rank_s ends at s
+   (s <= pos) */
+static int64_t split_rank(const split_t *sp, int64_t s, int64_t rank_s,
+                          int64_t pos) {
+  const pscan_t *ps = &sp->ps;
+  const int64_t b = pos / SPLIT_BLOCK;
+  const int64_t lo = b * SPLIT_BLOCK;
+  int64_t first[2], nnl[2];
+  if (s >= lo) {
+    /* a row end is outside quotes */
+    ps->kern->nlscan(ps->buf, ps->bufsz, s, pos, &ps->dl, first, nnl);
+    return rank_s + nnl[0];
+  }
+  ps->kern->nlscan(ps->buf, ps->bufsz, lo, pos, &ps->dl, first, nnl);
+  return sp->cum[b] + nnl[sp->inq[b]];
+}
+
+/* the offset where row r ends, given that row rank_s < r ends at s;
+   the end of buf[] if row r is the last and has no terminator */
+static int64_t split_rowend(const split_t *sp, int64_t s, int64_t rank_s,
+                            int64_t r) {
+  const pscan_t *ps = &sp->ps;
+  if (r > sp->cum[sp->nblk]) {
+    return ps->bufsz;
+  }
+  /* the last block with fewer than r terminators before it */
+  int64_t lo = 0, hi = sp->nblk - 1;
+  while (lo < hi) {
+    const int64_t mid = lo + (hi - lo + 1) / 2;
+    if (sp->cum[mid] < r) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  const int64_t start = lo * SPLIT_BLOCK;
+  const int64_t end =
+      start + SPLIT_BLOCK < ps->bufsz ? start + SPLIT_BLOCK : ps->bufsz;
+  if (s >= start) {
+    return ps->kern->nlnth(ps->buf, ps->bufsz, s, end, &ps->dl, 0,
+                           r - rank_s);
+  }
+  return ps->kern->nlnth(ps->buf, ps->bufsz, start, end, &ps->dl,
+                         sp->inq[lo], r - sp->cum[lo]);
+}
+
+/* add a cut to *cut[], which has n of *max */
+static int split_add(int64_t **cut, int64_t *n, int64_t *max, int64_t off) {
+  if (*n == *max) {
+    const int64_t newmax = *max * 2 + 64;
+    int64_t *tmp = realloc(*cut, newmax * sizeof(*tmp));
+    if (!tmp) {
+      return -1;
+    }
+    *cut = tmp;
+    *max = newmax;
+  }
+  (*cut)[(*n)++] = off;
+  return 0;
+}
+
+/* csv_split when esc != qte, where quotes cannot be paired by parity:
+   the rows are cut one at a time by csv_line */
+static int64_t split_line(const char *buf, int64_t bufsz, int qte, int esc,
+                          int64_t nbyte, int64_t nrow, int64_t **ret_cut) {
+  int64_t ncut = 0, maxcut = 0;
+  int64_t s = 0;    /* start of the current part */
+  int64_t prev = 0; /* end of the last row */
+  int64_t nr = 0;   /* rows in the current part */
+  csv_parse_t *cp = csv_open(qte, esc, ',', 0);
+  if (!cp) {
+    return -1;
+  }
+  const char *p = buf;
+  const char *const end = buf + bufsz;
+  int nb = 0;
+  while (p < end) {
+    const char *q = (end - p > MAP_WINDOW) ? p + MAP_WINDOW : end;
+    const char *const top = p;
+    while (p < q && (nb = csv_line(cp, p, q - p)) > 0) {
+      p += nb;
+      const int64_t e = p - buf;
+      if (nrow > 0 && ++nr == nrow) {
+        if (split_add(ret_cut, &ncut, &maxcut, e)) {
+          goto bail;
+        }
+        s = e;
+        nr = 0;
+      } else if (nbyte > 0 && e - s > nbyte && prev > s) {
+        if (split_add(ret_cut, &ncut, &maxcut, prev)) {
+          goto bail;
+        }
+        s = prev;
+      }
+      prev = e;
+    }
+    if (nb < 0) {
+      goto bail;
+    }
+    csv_feed_again(cp); /* the next window starts with the row cut short */
+    if (p == top) {
+      /* the last row, or one longer than the window */
+      if (q != end || (nb = line_last(cp, p, q - p, 0)) < 0) {
+        goto bail;
+      }
+      p = nb ? p + nb : end;
+      if (nbyte > 0 && p - buf - s > nbyte && prev > s) {
+        if (split_add(ret_cut, &ncut, &maxcut, prev)) {
+          goto bail;
+        }
+      }
+    }
+  }
+  if ((ncut ? (*ret_cut)[ncut - 1] : 0) < bufsz &&
+      split_add(ret_cut, &ncut, &maxcut, bufsz)) {
+    goto bail;
+  }
+  csv_close(cp);
+  return ncut;
+
+bail:
+  csv_close(cp);
+  return -1;
+}
+
+int64_t csv_split(int nthread, const char *buf, int64_t bufsz, int qte,
+                  int esc, int64_t nbyte, int64_t nrow, int64_t **ret_cut) {
+  *ret_cut = 0;
+  if (nthread <= 0 || bufsz < 0 || (!buf && bufsz)) {
+    return -1;
+  }
+  qte = qte ? qte : '"';
+  esc = esc ? esc : qte;
+  if (bufsz == 0) {
+    return 0;
+  }
+  if (esc != qte) {
+    const int64_t n = split_line(buf, bufsz, qte, esc, nbyte, nrow, ret_cut);
+    if (n < 0) {
+      free(*ret_cut);
+      *ret_cut = 0;
+    }
+    return n;
+  }
+
+  split_t sp = {0};
+  sp.ps.kern = kernel_select();
+  sp.ps.buf = (char *)buf;
+  sp.ps.bufsz = bufsz;
+  dialect_init(&sp.ps.dl, qte, esc, ',');
+  sp.nblk = (bufsz + SPLIT_BLOCK - 1) / SPLIT_BLOCK;
+
+  int n = nthread < sp.nblk ? nthread : sp.nblk;
+  int64_t ncut = 0, maxcut = 0;
+  int64_t(*nnl)[2] = malloc(sp.nblk * sizeof(*nnl));
+  splitjob_t *job = calloc(n, sizeof(*job));
+  sp.cum = malloc((sp.nblk + 1) * sizeof(*sp.cum));
+  sp.inq = malloc(sp.nblk);
+  sp.parity = malloc(sp.nblk);
+  if (!nnl || !job || !sp.cum || !sp.inq || !sp.parity) {
+    goto bail;
+  }
+
+  /* pass 1: count the row terminators of each block for both quote
+   * states at its start, a run of blocks per thread */
+  for (int i = 0; i < n; i++) {
+    job[i].sp = &sp;
+    job[i].b0 = sp.nblk * i / n;
+    job[i].b1 = sp.nblk * (i + 1) / n;
+    job[i].nnl = nnl + job[i].b0;
+  }
+  pscan_run(job, sizeof(*job), n, split_count);
+
+  /* stitch: the true quote state at the start of each block */
+  int inquote = 0;
+  sp.cum[0] = 0;
+  for (int64_t b = 0; b < sp.nblk; b++) {
+    sp.inq[b] = inquote;
+    sp.cum[b + 1] = sp.cum[b] + nnl[b][inquote];
+    inquote ^= sp.parity[b];
+  }
+
+  /* pass 2: cut the parts, each from where the last one ended. Only
+   * the blocks where a cut falls are scanned again. */
+  int64_t s = 0, rank_s = 0;
+  while (s < bufsz) {
+    int64_t r; /* the last row of this part */
+    if (nrow > 0) {
+      r = nrow > sp.cum[sp.nblk] - rank_s ? INT64_MAX : rank_s + nrow;
+    } else if (nbyte > 0 && bufsz - s > nbyte) {
+      r = split_rank(&sp, s, rank_s, s + nbyte);
+      r = r > rank_s ? r : rank_s + 1;
+    } else {
+      r = INT64_MAX;
+    }
+    const int64_t e = split_rowend(&sp, s, rank_s, r);
+    if (e <= s || split_add(ret_cut, &ncut, &maxcut, e)) {
+      goto bail;
+    }
+    s = e;
+    rank_s = r;
+  }
+
+  free(nnl);
+  free(job);
+  free(sp.cum);
+  free(sp.inq);
+  free(sp.parity);
+  return ncut;
+
+bail:
+  free(nnl);
+  free(job);
+  free(sp.cum);
+  free(sp.inq);
+  free(sp.parity);
+  free(*ret_cut);
+  *ret_cut = 0;
+  return -1;
+}
+
+/* pass len bytes at ptr to on_write, in pieces that fit an int */
+static int write_all(int (*on_write)(intptr_t handle, const char *buf,
+                                     int bufsz),
+                     intptr_t handle, const void *ptr, int64_t len) {
+  const char *p = ptr;
+  while (len > 0) {
+    const int n = len < (1 << 30) ? len : (1 << 30);
+    if (on_write(handle, p, n)) {
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* check the column types given to a writer; returns an error message,
+   or NULL if they are good */
+static const char *check_types(int ncol, const int *type, const int *scale) {
+  for (int c = 0; type && c < ncol; c++) {
+    if (type[c] < CSV_STRING || type[c] > CSV_TIMESTAMP) {
+      return "bad column type";
+    }
+    if (type[c] == CSV_DECIMAL && scale && (scale[c] < 0 || scale[c] > 18)) {
+      return "bad decimal scale";
+    }
+  }
+  return 0;
+}
+
+/* make room for n bytes in *p, which has *max */
+static int buf_reserve(char **p, int64_t *max, int64_t n) {
+  if (n > *max) {
+    const int64_t newmax = n + n / 2 + 1024;
+    char *tmp = realloc(*p, newmax);
+    if (!tmp) {
+      return -1;
+    }
+    *p = tmp;
+    *max = newmax;
+  }
+  return 0;
+}
+
+/*
+ * The sidecar index written by csv_index_build. All of it is little
+ * endian:
+ *
+ *   char    magic[8]     "CSVINDX1"
+ *   int64   filesize     of the csv file indexed
+ *   int64   mtime        of the csv file, in ns
+ *   int64   nrow         num rows in the csv file
+ *   int64   nent         num offsets that follow
+ *   int32   every        row i * every + 1 has offset i
+ *   uint8   qte, esc     the rows were cut with these
+ *   uint8   eol          EOL_xx of the rows, or 0 if unknown
+ *   uint8   pad
+ *   varint  delta[nent]  each offset less the one before it
+ *
+ * A varint holds 7 bits per byte, low bits first, with the high bit
+ * set on all but the last byte; deltas between rows far apart still
+ * mostly take 2-3 bytes.
+ */
+#define INDEX_MAGIC "CSVINDX1"
+#define INDEX_HDRSZ 48
+
+struct csv_index_t {
+  int64_t filesize;
+  int64_t mtime;
+  int64_t nrow;
+  int64_t nent;
+  int every;
+  char qte, esc;
+  int eol;
+  int64_t *off; /* off[i] - offset of row i * every + 1 */
+};
+
+static int64_t stat_mtime(const struct stat *st) {
+  return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+/* store the low n bytes of v at p, little endian on any host */
+static void put_le(char *p, uint64_t v, int n) {
+  for (int i = 0; i < n; i++, v >>= 8) {
+    p[i] = (char)(v & 0xff);
+  }
+}
+
+/* load n bytes from p, little endian on any host */
+static uint64_t get_le(const unsigned char *p, int n) {
+  uint64_t v = 0;
+  for (int i = n - 1; i >= 0; i--) {
+    v = v << 8 | p[i];
+  }
+  return v;
+}
+
+/* append the varint of v to *p, which has *len of *max bytes used */
+static int varint_put(char **p, int64_t *len, int64_t *max, uint64_t v) {
+  if (buf_reserve(p, max, *len + 10)) {
+    return -1;
+  }
+  unsigned char *q = (unsigned char *)*p + *len;
+  for (; v >= 0x80; v >>= 7) {
+    *q++ = (v & 0x7f) | 0x80;
+  }
+  *q++ = v;
+  *len = (char *)q - *p;
+  return 0;
+}
+
+int csv_index_build(const char *path, const char *ixpath, int every,
+                    intptr_t handle, int qte, int esc, int delim,
+                    void (*on_error)(intptr_t handle, int errtype,
+                                     const char *errmsg, csv_parse_t *cp)) {
+  char msg[200];
+  char *map = 0;
+  char *ent = 0; /* the varints */
+  int64_t entlen = 0, entmax = 0;
+  FILE *fp = 0;
+  csv_parse_t *cp = 0;
+  struct stat st;
+
+  if (every <= 0) {
+    on_error(handle, CSV_EPARAM, "bad param", 0);
+    return -1;
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    snprintf(msg, sizeof(msg), "open %s: %s", path,
+             fd < 0 ? strerror(errno) : "not a regular file");
+    on_error(handle, CSV_EIO, msg, 0);
+    goto bail;
+  }
+  if (st.st_size > 0) {
+    map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      map = 0;
+      snprintf(msg, sizeof(msg), "mmap %s: %s", path, strerror(errno));
+      on_error(handle, CSV_EIO, msg, 0);
+      goto bail;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+  }
+  if (!(cp = csv_open(qte, esc, delim, 0))) {
+    on_error(handle, CSV_EOUTOFMEMORY, "csv_open failed", 0);
+    goto bail;
+  }
+
+  /* cut the rows with csv_line, which only indexes buf[], and note the
+   * offset of every every-th one */
+  const char *p = map;
+  const char *const end = map + st.st_size;
+  int64_t nrow = 0, nent = 0, prev = 0;
+  int nb = 0;
+  for (;;) {
+    const char *q = (end - p > MAP_WINDOW) ? p + MAP_WINDOW : end;
+    const char *const top = p;
+    while (p < q && (nb = csv_line(cp, p, q - p)) > 0) {
+      if (nrow++ % every == 0) {
+        if (varint_put(&ent, &entlen, &entmax, (p - map) - prev)) {
+          goto oom;
+        }
+        prev = p - map;
+        nent++;
+      }
+      p += nb;
+    }
+    if (nb < 0) {
+      on_error(handle, 0, 0, cp);
+      goto bail;
+    }
+    csv_feed_again(cp); /* the next window starts with the row cut short */
+    if (q == end) {
+      break;
+    }
+    if (p == top) {
+      on_error(handle, CSV_EROWTOOLONG, "row too long", 0);
+      goto bail;
+    }
+  }
+
+  // one last row might remain
+  if (p < end) {
+    if ((nb = line_last(cp, p, end - p, 0)) < 0) {
+      on_error(handle, 0, 0, cp);
+      goto bail;
+    }
+    if (nb > 0 && nrow++ % every == 0) {
+      if (varint_put(&ent, &entlen, &entmax, (p - map) - prev)) {
+        goto oom;
+      }
+      nent++;
+    }
+    p += nb;
+  }
+  if (p != end) {
+    on_error(handle, CSV_EEXTRAINPUT, "extra data after last row", 0);
+    goto bail;
+  }
+
+  char hdr[INDEX_HDRSZ] = {0};
+  memcpy(hdr, INDEX_MAGIC, 8);
+  put_le(hdr + 8, st.st_size, 8);
+  put_le(hdr + 16, stat_mtime(&st), 8);
+  put_le(hdr + 24, nrow, 8);
+  put_le(hdr + 32, nent, 8);
+  put_le(hdr + 40, (uint32_t)every, 4);
+  hdr[44] = cp->qte;
+  hdr[45] = cp->esc;
+  hdr[46] = cp->eol;
+
+  if (!(fp = fopen(ixpath, "wb")) || 1 != fwrite(hdr, sizeof(hdr), 1, fp) ||
+      (entlen && 1 != fwrite(ent, entlen, 1, fp)) || fclose(fp)) {
+    snprintf(msg, sizeof(msg), "write %s: %s", ixpath, strerror(errno));
+    fp = 0;
+    on_error(handle, CSV_EIO, msg, 0);
+    goto bail;
+  }
+
+  free(ent);
+  csv_close(cp);
+  munmap(map, st.st_size);
+  close(fd);
+  return 0;
+
+oom:
+  on_error(handle, CSV_EOUTOFMEMORY, "out of memory", 0);
+bail:
+  if (fp) {
+    fclose(fp);
+  }
+  free(ent);
+  csv_close(cp);
+  if (map) {
+    munmap(map, st.st_size);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  return -1;
+}
+
+csv_index_t *csv_index_open(const char *ixpath, const char *path,
+                            const char **errmsg) {
+  csv_index_t *ix = 0;
+  unsigned char *buf = 0;
+  struct stat st;
+  FILE *fp = fopen(ixpath, "rb");
+  if (!fp || fstat(fileno(fp), &st)) {
+    *errmsg = "cannot open index";
+    goto bail;
+  }
+  if (!(buf = malloc(st.st_size + 1)) || !(ix = calloc(1, sizeof(*ix)))) {
+    *errmsg = "out of memory";
+    goto bail;
+  }
+  if (st.st_size < INDEX_HDRSZ ||
+      1 != fread(buf, st.st_size, 1, fp) ||
+      memcmp(buf, INDEX_MAGIC, 8)) {
+    *errmsg = "not a csv index";
+    goto bail;
+  }
+  ix->filesize = (int64_t)get_le(buf + 8, 8);
+  ix->mtime = (int64_t)get_le(buf + 16, 8);
+  ix->nrow = (int64_t)get_le(buf + 24, 8);
+  ix->nent = (int64_t)get_le(buf + 32, 8);
+  ix->every = (int32_t)get_le(buf + 40, 4);
+  ix->qte = buf[44];
+  ix->esc = buf[45];
+  ix->eol = buf[46];
+
+  /* every entry takes at least one byte */
+  if (ix->every <= 0 || ix->nrow < 0 ||
+      ix->nent != (ix->nrow + ix->every - 1) / ix->every ||
+      ix->nent > st.st_size - INDEX_HDRSZ) {
+    *errmsg = "corrupt index";
+    goto bail;
+  }
+  if (!(ix->off = malloc((ix->nent + 1) * sizeof(*ix->off)))) {
+    *errmsg = "out of memory";
+    goto bail;
+  }
+  const unsigned char *p = buf + INDEX_HDRSZ;
+  const unsigned char *const end = buf + st.st_size;
+  int64_t off = 0;
+  for (int64_t i = 0; i < ix->nent; i++) {
+    uint64_t v = 0;
+    int shift = 0;
+    do {
+      if (p == end || shift > 63) {
+        *errmsg = "corrupt index";
+        goto bail;
+      }
+      v |= (uint64_t)(*p & 0x7f) << shift;
+      shift += 7;
+    } while (*p++ & 0x80);
+    off += v;
+    if ((i == 0 && v) || (i > 0 && !v) || off >= ix->filesize) {
+      *errmsg = "corrupt index";
+      goto bail;
+    }
+    ix->off[i] = off;
+  }
+  if (p != end) {
+    *errmsg = "corrupt index";
+    goto bail;
+  }
+
+  /* the index goes with one version of the file */
+  if (path) {
+    if (stat(path, &st)) {
+      *errmsg = "cannot stat the indexed file";
+      goto bail;
+    }
+    if (st.st_size != ix->filesize || stat_mtime(&st) != ix->mtime) {
+      *errmsg = "stale index: the file has changed";
+      goto bail;
+    }
+  }
+
+  fclose(fp);
+  free(buf);
+  return ix;
+
+bail:
+  if (fp) {
+    fclose(fp);
+  }
+  free(buf);
+  csv_index_close(ix);
+  return 0;
+}
+
+void csv_index_close(csv_index_t *ix) {
+  if (ix) {
+    free(ix->off);
+    free(ix);
+  }
+}
+
+int64_t csv_index_nrow(const csv_index_t *ix) { return ix->nrow; }
+
+int64_t csv_seek_row(csv_parse_t *cp, const csv_index_t *ix, int64_t rownum,
+                     int64_t *ret_rownum) {
+  if (rownum < 1 || rownum > ix->nrow) {
+    return reterr(cp, CSV_EPARAM, "row not in the index", 0, 0, 0);
+  }
+  if (cp->qte != ix->qte || cp->esc != ix->esc) {
+    return reterr(cp, CSV_EPARAM, "index made with other quote or escape",
+                  0, 0, 0);
+  }
+  const int64_t i = (rownum - 1) / ix->every;
+  const int64_t row = i * ix->every + 1;
+
+  /* start over as if the rows before were parsed */
+  cp->resume.ok = cp->resume.again = 0;
+  cp->six.buf = 0;
+  cp->eol = ix->eol;
+  cp->state.rownum = row - 1;
+  cp->state.linenum = row - 1;
+  cp->state.charnum = ix->off[i];
+  *ret_rownum = row;
+  return ix->off[i];
+}
+
+/*
+ * A flatbuffer, built front to back: a table or vector is written
+ * before the objects it refers to, and its uoffset slots are patched
+ * once those are written, so every uoffset points forward as the
+ * format requires. Scalars are little endian, as on every target.
+ */
+typedef struct fbuf_t fbuf_t;
+struct fbuf_t {
+  char *buf;
+  int len;
+  int max;
+  int oom; /* a fb_put failed; the buffer is incomplete */
+};
+
+/* append n bytes of p, or n zeros if p is NULL; returns where they go */
+static int fb_put(fbuf_t *fb, const void *p, int n) {
+  const int pos = fb->len;
+  if (pos + n > fb->max) {
+    const int max = (pos + n) * 2;
+    char *buf = realloc(fb->buf, max);
+    if (!buf) {
+      fb->oom = 1;
+      return pos;
+    }
+    fb->buf = buf;
+    fb->max = max;
+  }
+  if (p) {
+    memcpy(fb->buf + pos, p, n);
+  } else {
+    memset(fb->buf + pos, 0, n);
+  }
+  fb->len += n;
+  return pos;
+}
+
+/* store n bytes of p at pos, which was returned by fb_put */
+static void fb_set(fbuf_t *fb, int pos, const void *p, int n) {
+  if (!fb->oom) {
+    memcpy(fb->buf + pos, p, n);
+  }
+}
+
+/* point the uoffset at slot to pos */
+static void fb_patch(fbuf_t *fb, int slot, int pos) {
+  const uint32_t off = pos - slot;
+  fb_set(fb, slot, &off, 4);
+}
+
+static void fb_align(fbuf_t *fb, int n) {
+  fb_put(fb, 0, (n - fb->len % n) % n);
+}
+
+/* a field of a table: a scalar of 1, 2, 4 or 8 bytes, or a uoffset
+   if size is 0 */
+typedef struct fbfield_t fbfield_t;
+struct fbfield_t {
+  int id;
+  int size;
+  int64_t val;
+};
+
+#define FB_MAXFIELD 8
+
+/**
+ *  fb_table - write a table of nf fields, preceded by its vtable.
+ *  slot[i] is set to the position of field i, to fb_patch it if it is
+ *  a uoffset. Returns the position of the table.
+ */
+static int fb_table(fbuf_t *fb, const fbfield_t *f, int nf, int *slot) {
+  uint16_t vt[2 + FB_MAXFIELD] = {0};
+  int off[FB_MAXFIELD];
+  int nid = 0;
+  int tsz = 4; /* the soffset to the vtable */
+
+  /* biggest fields first; the table starts 8-aligned, so each field is
+     aligned to its size */
+  for (int size = 8; size >= 1; size /= 2) {
+    for (int i = 0; i < nf; i++) {
+      if ((f[i].size ? f[i].size : 4) == size) {
+        tsz = (tsz + size - 1) / size * size;
+        off[i] = tsz;
+        tsz += size;
+      }
+    }
+  }
+  for (int i = 0; i < nf; i++) {
+    assert(f[i].id < FB_MAXFIELD);
+    vt[2 + f[i].id] = off[i];
+    nid = f[i].id + 1 > nid ? f[i].id + 1 : nid;
+  }
+  vt[0] = 2 * (2 + nid);
+  vt[1] = tsz;
+
+  fb_align(fb, 2);
+  const int vpos = fb_put(fb, vt, vt[0]);
+  fb_align(fb, 8);
+  const int tpos = fb_put(fb, 0, tsz);
+  const int32_t soff = tpos - vpos;
+  fb_set(fb, tpos, &soff, 4);
+  for (int i = 0; i < nf; i++) {
+    slot[i] = tpos + off[i];
+    if (f[i].size) {
+      fb_set(fb, slot[i], &f[i].val, f[i].size);
+    }
+  }
+  return tpos;
+}
+
+/* write the length of a vector of n elements that are aligned to
+   align, and room for sz bytes of them; returns its position. The
+   elements start 4 bytes after. */
+static int fb_vector(fbuf_t *fb, int n, int sz, int align) {
+  const uint32_t len = n;
+  fb_align(fb, 4);
+  if ((fb->len + 4) % align) {
+    fb_put(fb, 0, 4);
+  }
+  const int pos = fb_put(fb, &len, 4);
+  fb_put(fb, 0, sz);
+  return pos;
+}
+
+static int fb_string(fbuf_t *fb, const char *s) {
+  const int n = strlen(s);
+  const int pos = fb_vector(fb, n, n + 1, 4);
+  fb_set(fb, pos + 4, s, n);
+  return pos;
+}
+
+/* header types and metadata version of Arrow's Message.fbs */
+#define ARROW_SCHEMA 1
+#define ARROW_DICTIONARY 2
+#define ARROW_RECORDBATCH 3
+#define ARROW_V5 4
+
+/* the Type union of Arrow's Schema.fbs */
+#define ARROW_INT 2
+#define ARROW_FLOAT 3
+#define ARROW_UTF8 5
+#define ARROW_BOOL 6
+#define ARROW_DECIMAL 7
+#define ARROW_DATE 8
+#define ARROW_TIMESTAMP 10
+
+/* csv_arrowopt_t defaults */
+#define ARROW_BATCHROWS 65536
+
+/* a column of csv_scan_arrow */
+typedef struct arrowcol_t arrowcol_t;
+struct arrowcol_t {
+  csv_column_t x; /* values of the current batch */
+  char *name;
+  char *aux;      /* bools as bits, decimals as int128, or dict indexes */
+  int64_t auxmax;
+  /* CSV_ARROW_DICT */
+  csv_column_t dict; /* distinct values, in index order */
+  int *slot;         /* hash table of index+1 of the values in dict */
+  int nslot;
+  int nsent; /* dict values written out */
+  int ndict; /* dictionary batches written out */
+};
+
+/* a buffer in the body of a message */
+typedef struct arrowbuf_t arrowbuf_t;
+struct arrowbuf_t {
+  const void *ptr;
+  int64_t off; /* offset in the body */
+  int64_t len;
+};
+
+/* a dictionary or record batch message, for the footer of a file */
+typedef struct arrowblock_t arrowblock_t;
+struct arrowblock_t {
+  int64_t off;     /* where the message starts in the file */
+  int32_t metalen; /* prefix and metadata, in bytes */
+  int32_t dict;    /* 1 if a dictionary batch */
+  int64_t bodylen;
+};
+
+typedef struct arrow_t arrow_t;
+struct arrow_t {
+  intptr_t handle;
+  int (*on_write)(intptr_t handle, const char *buf, int bufsz);
+  void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                   csv_parse_t *cp);
+  const csv_arrowopt_t *opt;
+  csv_parse_t *cp;
+  int batchrows;
+  int started; /* the columns are set up and the schema written */
+  int ncol;
+  arrowcol_t *col;
+  int64_t *node; /* length and null count of each column */
+  int nrow;      /* rows in the current batch */
+  int64_t pos;   /* bytes written */
+  fbuf_t fb;     /* metadata of the current message */
+  arrowbuf_t *buf; /* body of the current message */
+  int nbuf;
+  int maxbuf;
+  int64_t bodylen;
+  char *tmp; /* rebased dictionary offsets */
+  int64_t tmpmax;
+  arrowblock_t *block;
+  int nblock;
+  int maxblock;
+};
+
+static int arrow_oom(arrow_t *a) {
+  a->on_error(a->handle, CSV_EOUTOFMEMORY, "out of memory", 0);
+  return -1;
+}
 
-  /* alloc parse struct and init it */
-  csv_parse_t *cp;
-  if (!(cp = calloc(1, sizeof(csv_parse_t)))) {
-    return 0;
+static int arrow_write(arrow_t *a, const void *ptr, int64_t len) {
+  if (write_all(a->on_write, a->handle, ptr, len)) {
+    return -1;
   }
-  strncpy(cp->nullstr, nullstr, sizeof(cp->nullstr));
-  cp->nullstr[sizeof(cp->nullstr) - 1] = 0;
-  cp->nullstrsz = strlen(cp->nullstr);
+  a->pos += len;
+  return 0;
+}
 
-  cp->qte = qte;
-  cp->esc = esc;
-  cp->delim = delim;
+static int arrow_pad(arrow_t *a) {
+  static const char zero[8] = {0};
+  return arrow_write(a, zero, (8 - a->pos % 8) % 8);
+}
 
-  return cp;
+/* add len bytes at ptr to the body of the current message */
+static int arrow_addbuf(arrow_t *a, const void *ptr, int64_t len) {
+  if (a->nbuf == a->maxbuf) {
+    const int max = a->maxbuf * 2 + 16;
+    arrowbuf_t *buf = realloc(a->buf, max * sizeof(*buf));
+    if (!buf) {
+      return -1;
+    }
+    a->buf = buf;
+    a->maxbuf = max;
+  }
+  arrowbuf_t *b = &a->buf[a->nbuf++];
+  b->ptr = ptr;
+  b->off = a->bodylen;
+  b->len = len;
+  a->bodylen += (len + 7) / 8 * 8;
+  return 0;
 }
 
-void csv_close(csv_parse_t *cp) {
-  if (cp) {
-    free(cp->fld);
-    free(cp->len);
-    free(cp->quoted);
-    free(cp->lastbuf);
-    free(cp);
+static int arrow_typeid(int type) {
+  switch (type) {
+  case CSV_INT64:
+    return ARROW_INT;
+  case CSV_FLOAT64:
+    return ARROW_FLOAT;
+  case CSV_DECIMAL:
+    return ARROW_DECIMAL;
+  case CSV_BOOL:
+    return ARROW_BOOL;
+  case CSV_DATE:
+    return ARROW_DATE;
+  case CSV_TIMESTAMP:
+    return ARROW_TIMESTAMP;
+  default:
+    return ARROW_UTF8;
   }
 }
 
-int csv_errnum(csv_parse_t *cp) { return cp->state.errnum; }
-const char *csv_errmsg(csv_parse_t *cp) { return cp->state.errmsg; }
-int csv_errlinenum(csv_parse_t *cp) { return cp->state.elinenum; }
-int csv_errcharnum(csv_parse_t *cp) { return cp->state.echarnum; }
-int csv_errrownum(csv_parse_t *cp) { return cp->state.erownum; }
-int csv_errfldnum(csv_parse_t *cp) { return cp->state.efldnum; }
+/* write the Int table of a signed int type */
+static int arrow_fbint(fbuf_t *fb, int bitwidth) {
+  const fbfield_t f[] = {{0, 4, bitwidth}, {1, 1, 1}};
+  int slot[2];
+  return fb_table(fb, f, 2, slot);
+}
 
-int csv_scan(intptr_t handle, int qte, int esc, int delim,
-             const char nullstr[20],
-             int (*on_bufempty)(intptr_t handle, char *buf, int bufsz),
-             int (*on_row)(intptr_t handle, int64_t rownum, char **field,
-                           int nfield),
-             void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
-                              csv_parse_t *cp)) {
-  int bufsz = 1024 * 1024;
-  char *buf = 0;
-  char *p = buf;
-  char *q = buf;
-  int eof = 0;
-  csv_parse_t *cp = 0;
-  int nb;
-  int nfield;
-  char **field;
-  char msg[100];
+/* write the type table of x */
+static int arrow_fbtype(fbuf_t *fb, const csv_column_t *x) {
+  int slot[3];
+  switch (x->type) {
+  case CSV_INT64:
+    return arrow_fbint(fb, 64);
+  case CSV_FLOAT64: {
+    const fbfield_t f[] = {{0, 2, 2}}; /* DOUBLE */
+    return fb_table(fb, f, 1, slot);
+  }
+  case CSV_DECIMAL: {
+    /* 19 digits hold every int64 */
+    const fbfield_t f[] = {{0, 4, 19}, {1, 4, x->scale}, {2, 4, 128}};
+    return fb_table(fb, f, 3, slot);
+  }
+  case CSV_DATE: {
+    const fbfield_t f[] = {{0, 2, 0}}; /* DAY */
+    return fb_table(fb, f, 1, slot);
+  }
+  case CSV_TIMESTAMP: {
+    const fbfield_t f[] = {{0, 2, 2}, {1, 0, 0}}; /* MICROSECOND */
+    const int t = fb_table(fb, f, 2, slot);
+    fb_patch(fb, slot[1], fb_string(fb, "UTC"));
+    return t;
+  }
+  default: /* Bool and Utf8 have no fields */
+    return fb_table(fb, 0, 0, slot);
+  }
+}
 
-  if (0 == (buf = malloc(bufsz))) {
-    on_error(handle, CSV_EOUTOFMEMORY, "out of memory", 0);
-    goto bail;
+/* write the Field table of column c */
+static int arrow_fbfield(arrow_t *a, int c) {
+  fbuf_t *fb = &a->fb;
+  const arrowcol_t *col = &a->col[c];
+  const int dict =
+      (a->opt->flags & CSV_ARROW_DICT) && col->x.type == CSV_STRING;
+  const fbfield_t f[] = {{0, 0, 0},
+                         {1, 1, 1},
+                         {2, 1, arrow_typeid(col->x.type)},
+                         {3, 0, 0},
+                         {5, 0, 0},
+                         {4, 0, 0}};
+  int slot[6];
+  const int t = fb_table(fb, f, dict ? 6 : 5, slot);
+  fb_patch(fb, slot[0], fb_string(fb, col->name));
+  fb_patch(fb, slot[3], arrow_fbtype(fb, &col->x));
+  fb_patch(fb, slot[4], fb_vector(fb, 0, 0, 4));
+  if (dict) {
+    /* DictionaryEncoding, with the column number as id */
+    const fbfield_t d[] = {{0, 8, c}, {1, 0, 0}};
+    int dslot[2];
+    fb_patch(fb, slot[5], fb_table(fb, d, 2, dslot));
+    fb_patch(fb, dslot[1], arrow_fbint(fb, 32));
   }
+  return t;
+}
 
-  cp = csv_open(qte, esc, delim, nullstr);
-  if (!cp) {
-    on_error(handle, CSV_EOUTOFMEMORY, "csv_open failed", 0);
-    goto bail;
+/* write the Schema table */
+static int arrow_fbschema(arrow_t *a) {
+  fbuf_t *fb = &a->fb;
+  const fbfield_t f[] = {{1, 0, 0}};
+  int slot[1];
+  const int t = fb_table(fb, f, 1, slot);
+  const int v = fb_vector(fb, a->ncol, 4 * a->ncol, 4);
+  fb_patch(fb, slot[0], v);
+  for (int c = 0; c < a->ncol; c++) {
+    fb_patch(fb, v + 4 + 4 * c, arrow_fbfield(a, c));
   }
+  return t;
+}
 
-  // keep filling up buf[] and feeding csv until eof
-  while (!eof) {
-    // shift p..q to start of buf
-    if (p != buf) {
-      memmove(buf, p, q - p);
-      q = buf + (q - p);
-      p = buf;
-    }
-    assert(p == buf);
-
-    // expand buf[] if p..q fills up the whole buf
-    if (q - p == bufsz) {
-      char *newbuf;
-      int newsz = bufsz * 1.5;
-
-      if (!(newbuf = realloc(buf, newsz))) {
-        sprintf(msg, "cannot expand buffer beyond %d bytes", bufsz);
-        on_error(handle, CSV_EOUTOFMEMORY, msg, 0);
-        goto bail;
+/* write a RecordBatch table of nrow rows, with nnode field nodes and
+   the buffers of the current body */
+static int arrow_fbbatch(arrow_t *a, int64_t nrow, int nnode,
+                         const int64_t *node) {
+  fbuf_t *fb = &a->fb;
+  const fbfield_t f[] = {{0, 8, nrow}, {1, 0, 0}, {2, 0, 0}};
+  int slot[3];
+  const int t = fb_table(fb, f, 3, slot);
+  int v = fb_vector(fb, nnode, 16 * nnode, 8);
+  fb_set(fb, v + 4, node, 16 * nnode);
+  fb_patch(fb, slot[1], v);
+  v = fb_vector(fb, a->nbuf, 16 * a->nbuf, 8);
+  for (int i = 0; i < a->nbuf; i++) {
+    const int64_t b[2] = {a->buf[i].off, a->buf[i].len};
+    fb_set(fb, v + 4 + 16 * i, b, 16);
+  }
+  fb_patch(fb, slot[2], v);
+  return t;
+}
+
+/* start the Message of a message with an htype header and the current
+   body; returns the slot of the header */
+static int arrow_fbmessage(arrow_t *a, int htype) {
+  fbuf_t *fb = &a->fb;
+  const fbfield_t f[] = {
+      {0, 2, ARROW_V5}, {1, 1, htype}, {2, 0, 0}, {3, 8, a->bodylen}};
+  int slot[4];
+  fb->len = 0;
+  fb_put(fb, 0, 4); /* root uoffset */
+  fb_patch(fb, 0, fb_table(fb, f, 4, slot));
+  return slot[2];
+}
+
+/* start the body of a message */
+static void arrow_body(arrow_t *a) {
+  a->nbuf = 0;
+  a->bodylen = 0;
+}
+
+/**
+ *  arrow_message - write out the Message in a->fb, as an encapsulated
+ *  message followed by the body. Block is 0 for the schema, or 1 or 2
+ *  for a dictionary or record batch, which the footer of a file lists.
+ */
+static int arrow_message(arrow_t *a, int block) {
+  fbuf_t *fb = &a->fb;
+  fb_align(fb, 8);
+  if (fb->oom) {
+    return arrow_oom(a);
+  }
+  if (block && (a->opt->flags & CSV_ARROW_FILE)) {
+    if (a->nblock == a->maxblock) {
+      const int max = a->maxblock * 2 + 16;
+      arrowblock_t *p = realloc(a->block, max * sizeof(*p));
+      if (!p) {
+        return arrow_oom(a);
       }
-      buf = newbuf;
-      bufsz = newsz;
-      q = buf + (q - p);
-      p = buf;
+      a->block = p;
+      a->maxblock = max;
     }
+    arrowblock_t *b = &a->block[a->nblock++];
+    b->off = a->pos;
+    b->metalen = 8 + fb->len;
+    b->dict = (block == 1);
+    b->bodylen = a->bodylen;
+  }
 
-    // fill
-    assert(!eof);
-    nb = on_bufempty(handle, q, bufsz - (q - p));
-    if (nb < 0)
-      goto bail;
+  const int32_t prefix[2] = {-1, fb->len}; /* continuation, length */
+  if (arrow_write(a, prefix, 8) || arrow_write(a, fb->buf, fb->len)) {
+    return -1;
+  }
+  for (int i = 0; i < a->nbuf; i++) {
+    if (arrow_write(a, a->buf[i].ptr, a->buf[i].len) || arrow_pad(a)) {
+      return -1;
+    }
+  }
+  return 0;
+}
 
-    eof |= (nb == 0);
-    q += nb;
+static uint32_t arrow_hash(const char *p, int n) {
+  uint64_t h = n * 0x9e3779b97f4a7c15ull;
+  uint64_t w;
+  for (; n >= 8; n -= 8, p += 8) {
+    memcpy(&w, p, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdull;
+    h ^= h >> 32;
+  }
+  w = 0;
+  memcpy(&w, p, n);
+  h = (h ^ w) * 0xff51afd7ed558ccdull;
+  return h ^ h >> 32;
+}
 
-    // keep feeding until there is no more complete row in buf[]
-    while (p < q) {
-      nb = csv_feed(cp, p, q - p, &field, &nfield);
-      if (unlikely(nb <= 0)) {
-        if (nb == 0)
-          break;
-        else {
-          on_error(handle, 0, 0, cp);
-          goto bail;
-        }
+/* index of s[0..n) in the dictionary of col, which it is added to if
+   new; -1 if out of memory */
+static int arrow_dictfind(arrowcol_t *col, const char *s, int n) {
+  csv_column_t *d = &col->dict;
+  if (2 * (d->nrow + 1) > col->nslot) {
+    const int nslot = col->nslot ? col->nslot * 2 : 1024;
+    int *slot = calloc(nslot, sizeof(*slot));
+    if (!slot) {
+      return -1;
+    }
+    const int *off = d->data;
+    for (int i = 0; i < d->nrow; i++) {
+      uint32_t h = arrow_hash(d->str + off[i], off[i + 1] - off[i]);
+      while (slot[h & (nslot - 1)]) {
+        h++;
       }
-      if (on_row(handle, cp->state.rownum, field, nfield)) {
-        goto bail;
+      slot[h & (nslot - 1)] = i + 1;
+    }
+    free(col->slot);
+    col->slot = slot;
+    col->nslot = nslot;
+  }
+
+  const uint32_t mask = col->nslot - 1;
+  uint32_t h = arrow_hash(s, n) & mask;
+  for (; col->slot[h]; h = (h + 1) & mask) {
+    const int i = col->slot[h] - 1;
+    const int *off = d->data;
+    if (off[i + 1] - off[i] == n && 0 == memcmp(d->str + off[i], s, n)) {
+      return i;
+    }
+  }
+
+  if (column_reserve(d, d->nrow + 1, d->strsz + n)) {
+    return -1;
+  }
+  int *off = d->data;
+  off[0] = d->nrow ? off[0] : 0;
+  memcpy(d->str + d->strsz, s, n);
+  d->strsz += n;
+  off[d->nrow + 1] = d->strsz;
+  col->slot[h] = ++d->nrow;
+  return d->nrow - 1;
+}
+
+/* replace the strings of column c by indexes into its dictionary, and
+   write out the values new to the dictionary */
+static int arrow_dict(arrow_t *a, int c) {
+  arrowcol_t *col = &a->col[c];
+  const csv_column_t *x = &col->x;
+  if (buf_reserve(&col->aux, &col->auxmax, 4 * (int64_t)x->nrow)) {
+    return arrow_oom(a);
+  }
+  int32_t *idx = (int32_t *)col->aux;
+  const int *off = x->data;
+  for (int r = 0; r < x->nrow; r++) {
+    idx[r] = 0;
+    if (x->valid[r >> 3] >> (r & 7) & 1) {
+      idx[r] = arrow_dictfind(col, x->str + off[r], off[r + 1] - off[r]);
+      if (idx[r] < 0) {
+        return arrow_oom(a);
       }
-      p += nb;
     }
   }
 
-  // one last row might remain in buf[]
-  if (p < q) {
-    nb = csv_feed_last(cp, p, q - p, &field, &nfield);
-    if (nb < 0) {
-      on_error(handle, 0, 0, cp);
-      goto bail;
+  /* a record batch needs its dictionary, even if empty, to come first */
+  const csv_column_t *d = &col->dict;
+  const int n = d->nrow - col->nsent;
+  if (col->ndict && !n) {
+    return 0;
+  }
+  if (buf_reserve(&a->tmp, &a->tmpmax, 4 * (int64_t)(n + 1))) {
+    return arrow_oom(a);
+  }
+  const int *doff = d->data;
+  const int base = n ? doff[col->nsent] : 0;
+  int32_t *toff = (int32_t *)a->tmp;
+  for (int i = 0; i <= n; i++) {
+    toff[i] = n ? doff[col->nsent + i] - base : 0;
+  }
+  arrow_body(a);
+  if (arrow_addbuf(a, 0, 0) || arrow_addbuf(a, toff, 4 * (n + 1)) ||
+      arrow_addbuf(a, d->str + base, toff[n])) {
+    return arrow_oom(a);
+  }
+
+  const int64_t node[2] = {n, 0};
+  const fbfield_t f[] = {{0, 8, c}, {1, 0, 0}, {2, 1, col->ndict > 0}};
+  int slot[3];
+  const int hslot = arrow_fbmessage(a, ARROW_DICTIONARY);
+  fb_patch(&a->fb, hslot, fb_table(&a->fb, f, 3, slot));
+  fb_patch(&a->fb, slot[1], arrow_fbbatch(a, n, 1, node));
+  if (arrow_message(a, 1)) {
+    return -1;
+  }
+  col->nsent = d->nrow;
+  col->ndict++;
+  return 0;
+}
+
+/* write out the rows of the current batch as a record batch */
+static int arrow_flush(arrow_t *a) {
+  if (a->nrow == 0) {
+    return 0;
+  }
+  for (int c = 0; c < a->ncol; c++) {
+    if ((a->opt->flags & CSV_ARROW_DICT) && a->col[c].x.type == CSV_STRING &&
+        arrow_dict(a, c)) {
+      return -1;
     }
-    if (on_row(handle, cp->state.rownum, field, nfield)) {
-      goto bail;
+  }
+
+  arrow_body(a);
+  for (int c = 0; c < a->ncol; c++) {
+    arrowcol_t *col = &a->col[c];
+    csv_column_t *x = &col->x;
+    const int nrow = x->nrow;
+    int err = 0;
+    a->node[2 * c] = nrow;
+    a->node[2 * c + 1] = x->nnull;
+    err |= arrow_addbuf(a, x->valid, x->nnull ? (nrow + 7) / 8 : 0);
+    switch (x->type) {
+    case CSV_STRING:
+      if (a->opt->flags & CSV_ARROW_DICT) {
+        err |= arrow_addbuf(a, col->aux, 4 * (int64_t)nrow);
+      } else {
+        err |= arrow_addbuf(a, x->data, 4 * (int64_t)(nrow + 1));
+        err |= arrow_addbuf(a, x->str, x->strsz);
+      }
+      break;
+    case CSV_BOOL: {
+      /* one bit per value */
+      if (buf_reserve(&col->aux, &col->auxmax, (nrow + 7) / 8)) {
+        return arrow_oom(a);
+      }
+      const uint8_t *v = x->data;
+      uint8_t *bit = (uint8_t *)col->aux;
+      memset(bit, 0, (nrow + 7) / 8);
+      for (int r = 0; r < nrow; r++) {
+        bit[r >> 3] |= v[r] << (r & 7);
+      }
+      err |= arrow_addbuf(a, bit, (nrow + 7) / 8);
+      break;
+    }
+    case CSV_DECIMAL: {
+      /* sign extended to 128 bits */
+      if (buf_reserve(&col->aux, &col->auxmax, 16 * (int64_t)nrow)) {
+        return arrow_oom(a);
+      }
+      const int64_t *v = x->data;
+      int64_t *w = (int64_t *)col->aux;
+      for (int r = 0; r < nrow; r++) {
+        w[2 * r] = v[r];
+        w[2 * r + 1] = v[r] < 0 ? -1 : 0;
+      }
+      err |= arrow_addbuf(a, w, 16 * (int64_t)nrow);
+      break;
+    }
+    case CSV_DATE:
+      err |= arrow_addbuf(a, x->data, 4 * (int64_t)nrow);
+      break;
+    default:
+      err |= arrow_addbuf(a, x->data, 8 * (int64_t)nrow);
+      break;
+    }
+    if (err) {
+      return arrow_oom(a);
     }
-    p += nb;
   }
 
-  if (p != q) {
-    on_error(handle, CSV_EEXTRAINPUT, "extra data after last row", 0);
-    goto bail;
+  const int hslot = arrow_fbmessage(a, ARROW_RECORDBATCH);
+  fb_patch(&a->fb, hslot, arrow_fbbatch(a, a->nrow, a->ncol, a->node));
+  if (arrow_message(a, 2)) {
+    return -1;
+  }
+  for (int c = 0; c < a->ncol; c++) {
+    csv_column_t *x = &a->col[c].x;
+    x->nrow = x->nnull = x->strsz = 0;
   }
+  a->nrow = 0;
+  return 0;
+}
 
-  free(buf);
+/* set up the columns from the options and the first rows in b, which
+   may be NULL, and write out the schema */
+static int arrow_start(arrow_t *a, const csv_batch_t *b) {
+  const csv_arrowopt_t *opt = a->opt;
+  const int nfield = b && b->nrow ? b->row[1] - b->row[0] : 0;
+  const int nhdr = (opt->flags & CSV_ARROW_HEADER) ? nfield : 0;
+  a->started = 1;
+  a->ncol = opt->ncol > 0 ? opt->ncol : nfield;
+  a->col = calloc(a->ncol + 1, sizeof(*a->col));
+  a->node = calloc(2 * a->ncol + 1, sizeof(*a->node));
+  if (!a->col || !a->node) {
+    return arrow_oom(a);
+  }
+  for (int c = 0; c < a->ncol; c++) {
+    arrowcol_t *col = &a->col[c];
+    char name[20];
+    const char *s = name;
+    int len;
+    col->x.type = opt->ncol > 0 && opt->type ? opt->type[c] : CSV_STRING;
+    col->x.scale = opt->ncol > 0 && opt->scale ? opt->scale[c] : 0;
+    if (opt->ncol > 0 && opt->name) {
+      s = opt->name[c];
+      len = strlen(s);
+    } else if (c < nhdr) {
+      const int j = b->row[0] + c;
+      s = b->buf + b->off[j];
+      len = b->len[j] > 0 ? b->len[j] : 0;
+    } else {
+      len = sprintf(name, "f%d", c + 1);
+    }
+    if (!(col->name = malloc(len + 1))) {
+      return arrow_oom(a);
+    }
+    memcpy(col->name, s, len);
+    col->name[len] = 0;
+  }
+
+  if ((opt->flags & CSV_ARROW_FILE) && arrow_write(a, "ARROW1\0\0", 8)) {
+    return -1;
+  }
+  arrow_body(a);
+  const int hslot = arrow_fbmessage(a, ARROW_SCHEMA);
+  fb_patch(&a->fb, hslot, arrow_fbschema(a));
+  return arrow_message(a, 0);
+}
+
+/* write out the last batch, the end of stream, and the footer of a file */
+static int arrow_finish(arrow_t *a) {
+  if ((!a->started && arrow_start(a, 0)) || arrow_flush(a)) {
+    return -1;
+  }
+  const int32_t eos[2] = {-1, 0};
+  if (arrow_write(a, eos, 8)) {
+    return -1;
+  }
+  if (!(a->opt->flags & CSV_ARROW_FILE)) {
+    return 0;
+  }
+
+  /* the footer lists the schema and where the batches are */
+  int ndict = 0;
+  for (int i = 0; i < a->nblock; i++) {
+    ndict += a->block[i].dict;
+  }
+  fbuf_t *fb = &a->fb;
+  const fbfield_t f[] = {{0, 2, ARROW_V5}, {1, 0, 0}, {2, 0, 0}, {3, 0, 0}};
+  int slot[4];
+  fb->len = 0;
+  fb_put(fb, 0, 4);
+  fb_patch(fb, 0, fb_table(fb, f, 4, slot));
+  fb_patch(fb, slot[1], arrow_fbschema(a));
+  for (int dict = 1; dict >= 0; dict--) {
+    const int n = dict ? ndict : a->nblock - ndict;
+    const int v = fb_vector(fb, n, 24 * n, 8);
+    int i = 0;
+    fb_patch(fb, slot[dict ? 2 : 3], v);
+    for (int k = 0; k < a->nblock; k++) {
+      const arrowblock_t *b = &a->block[k];
+      if (b->dict == dict) {
+        const int32_t metalen[2] = {b->metalen, 0};
+        fb_set(fb, v + 4 + 24 * i, &b->off, 8);
+        fb_set(fb, v + 4 + 24 * i + 8, metalen, 8);
+        fb_set(fb, v + 4 + 24 * i + 16, &b->bodylen, 8);
+        i++;
+      }
+    }
+  }
+  if (fb->oom) {
+    return arrow_oom(a);
+  }
+  const int32_t len = fb->len;
+  if (arrow_write(a, fb->buf, fb->len) || arrow_write(a, &len, 4) ||
+      arrow_write(a, "ARROW1", 6)) {
+    return -1;
+  }
   return 0;
+}
 
-bail:
-  free(buf);
-  return -1;
+static void arrow_free(arrow_t *a) {
+  for (int c = 0; a->col && c < a->ncol; c++) {
+    arrowcol_t *col = &a->col[c];
+    csv_column_free(&col->x);
+    csv_column_free(&col->dict);
+    free(col->name);
+    free(col->aux);
+    free(col->slot);
+  }
+  free(a->col);
+  free(a->node);
+  free(a->fb.buf);
+  free(a->buf);
+  free(a->tmp);
+  free(a->block);
+}
+
+static void arrow_open(intptr_t handle, csv_parse_t *cp) {
+  arrow_t *a = (arrow_t *)handle;
+  a->cp = cp;
+}
+
+static int arrow_rows(intptr_t handle, const csv_batch_t *batch) {
+  arrow_t *a = (arrow_t *)handle;
+  int r = 0;
+  if (!a->started) {
+    if (arrow_start(a, batch)) {
+      return -1;
+    }
+    r = (a->opt->flags & CSV_ARROW_HEADER) ? 1 : 0;
+  }
+
+  /* fill the current batch up to batchrows, then write it out */
+  while (r < batch->nrow) {
+    int n = batch->nrow - r;
+    n = n < a->batchrows - a->nrow ? n : a->batchrows - a->nrow;
+    for (int c = 0; c < a->ncol; c++) {
+      if (convert1(a->cp, batch, r, r + n, c, &a->col[c].x)) {
+        a->on_error(a->handle, 0, 0, a->cp);
+        return -1;
+      }
+    }
+    a->nrow += n;
+    r += n;
+    if (a->nrow == a->batchrows && arrow_flush(a)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void arrow_error(intptr_t handle, int errtype, const char *errmsg,
+                        csv_parse_t *cp) {
+  arrow_t *a = (arrow_t *)handle;
+  a->on_error(a->handle, errtype, errmsg, cp);
+}
+
+int csv_scan_arrow(const csv_arrowopt_t *opt, intptr_t handle, int qte,
+                   int esc, int delim, const char nullstr[20],
+                   int (*on_bufempty)(intptr_t handle, char *buf, int bufsz),
+                   int (*on_write)(intptr_t handle, const char *buf,
+                                   int bufsz),
+                   void (*on_error)(intptr_t handle, int errtype,
+                                    const char *errmsg, csv_parse_t *cp)) {
+  static const csv_arrowopt_t defopt = {0};
+  opt = opt ? opt : &defopt;
+  const char *msg = check_types(opt->ncol, opt->type, opt->scale);
+  if (msg) {
+    on_error(handle, CSV_EPARAM, msg, 0);
+    return -1;
+  }
+
+  arrow_t a = {0};
+  a.handle = handle;
+  a.on_write = on_write;
+  a.on_error = on_error;
+  a.opt = opt;
+  a.batchrows = opt->batchrows > 0 ? opt->batchrows : ARROW_BATCHROWS;
+
+  csv_scanopt_t scanopt = {0};
+  scanopt.nreadahead = opt->nreadahead;
+  scancb_t cb = {0};
+  cb.handle = (intptr_t)&a;
+  cb.rdhandle = handle;
+  cb.on_bufempty = on_bufempty;
+  cb.on_rows = arrow_rows;
+  cb.on_error = arrow_error;
+  cb.on_open = arrow_open;
+  int ret = scan(&cb, &scanopt, qte, esc, delim, nullstr);
+  if (ret == 0) {
+    ret = arrow_finish(&a);
+  }
+  arrow_free(&a);
+  return ret;
+}
+
+/* the PostgreSQL epoch, 2000-01-01, in days and microseconds since 1970 */
+#define PG_EPOCH_DAYS 10957
+#define PG_EPOCH_USEC (PG_EPOCH_DAYS * (int64_t)86400000000)
+
+/* bytes of the binary numeric of a CSV_DECIMAL value, at most */
+#define PG_NUMERIC_MAX 32
+
+typedef struct pgcopy_t pgcopy_t;
+struct pgcopy_t {
+  intptr_t handle;
+  int (*on_write)(intptr_t handle, const char *buf, int bufsz);
+  void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                   csv_parse_t *cp);
+  const csv_pgcopyopt_t *opt;
+  csv_parse_t *cp;
+  int started; /* the columns are set up and the header written */
+  int ncol;
+  csv_column_t *col;
+  char *out; /* the rows of a batch, ready to write */
+  int64_t outmax;
+};
+
+/* store v in network byte order at p; returns p past it */
+INLINE char *put16(char *p, uint16_t v) {
+  v = __builtin_bswap16(v);
+  memcpy(p, &v, 2);
+  return p + 2;
+}
+
+INLINE char *put32(char *p, uint32_t v) {
+  v = __builtin_bswap32(v);
+  memcpy(p, &v, 4);
+  return p + 4;
+}
+
+INLINE char *put64(char *p, uint64_t v) {
+  v = __builtin_bswap64(v);
+  memcpy(p, &v, 8);
+  return p + 8;
+}
+
+/**
+ *  pg_numeric - store v / 10^scale as a length and a binary numeric:
+ *  ndigits, weight, sign and dscale, then ndigits base-10000 digits,
+ *  the first of which is worth 10000^weight. Returns p past it.
+ */
+static char *pg_numeric(char *p, int64_t v, int scale) {
+  uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+  char tmp[20];
+  int n = 0;
+  do {
+    tmp[n++] = u % 10;
+    u /= 10;
+  } while (u);
+
+  /* the decimal digits, padded to whole groups of 4 on both sides of
+     the point */
+  const int nint = n > scale ? n - scale : 0;
+  const int lpad = (4 - nint % 4) % 4;
+  const int len = lpad + nint + (scale + 3) / 4 * 4;
+  char dig[44] = {0};
+  for (int i = 0; i < n; i++) {
+    dig[lpad + nint + scale - 1 - i] = tmp[i];
+  }
+
+  int16_t group[11];
+  int ng = 0;
+  int weight = (lpad + nint) / 4 - 1;
+  for (int i = 0; i < len; i += 4) {
+    group[ng] = dig[i] * 1000 + dig[i + 1] * 100 + dig[i + 2] * 10 + dig[i + 3];
+    if (ng == 0 && group[0] == 0) {
+      weight--; /* leading zero group */
+    } else {
+      ng++;
+    }
+  }
+  while (ng > 0 && group[ng - 1] == 0) {
+    ng--;
+  }
+
+  p = put32(p, 8 + 2 * ng);
+  p = put16(p, ng);
+  p = put16(p, ng ? weight : 0);
+  p = put16(p, v < 0 ? 0x4000 : 0);
+  p = put16(p, scale);
+  for (int i = 0; i < ng; i++) {
+    p = put16(p, group[i]);
+  }
+  return p;
+}
+
+/* set up the columns from the options and the first rows in b, which
+   may be NULL, and write out the header */
+static int pgcopy_start(pgcopy_t *g, const csv_batch_t *b) {
+  static const char sig[19] = "PGCOPY\n\377\r\n"; /* flags, extension 0 */
+  const csv_pgcopyopt_t *opt = g->opt;
+  const int nfield = b && b->nrow ? b->row[1] - b->row[0] : 0;
+  g->started = 1;
+  g->ncol = opt->ncol > 0 ? opt->ncol : nfield;
+  if (g->ncol > 32767) {
+    g->on_error(g->handle, CSV_EPARAM, "too many columns", 0);
+    return -1;
+  }
+  if (!(g->col = calloc(g->ncol + 1, sizeof(*g->col)))) {
+    g->on_error(g->handle, CSV_EOUTOFMEMORY, "out of memory", 0);
+    return -1;
+  }
+  for (int c = 0; c < g->ncol; c++) {
+    g->col[c].type = opt->ncol > 0 && opt->type ? opt->type[c] : CSV_STRING;
+    g->col[c].scale = opt->ncol > 0 && opt->scale ? opt->scale[c] : 0;
+  }
+  return write_all(g->on_write, g->handle, sig, sizeof(sig));
+}
+
+/* convert the rows of batch, and write them out as tuples */
+static int pgcopy_rows(intptr_t handle, const csv_batch_t *batch) {
+  pgcopy_t *g = (pgcopy_t *)handle;
+  int r0 = 0;
+  if (!g->started) {
+    if (pgcopy_start(g, batch)) {
+      return -1;
+    }
+    r0 = (g->opt->flags & CSV_PGCOPY_HEADER) ? 1 : 0;
+  }
+  const int nrow = batch->nrow - r0;
+  if (nrow <= 0) {
+    return 0;
+  }
+
+  /* a field count per tuple, and a length and value per field */
+  int64_t sz = 2 * (int64_t)nrow;
+  for (int c = 0; c < g->ncol; c++) {
+    csv_column_t *x = &g->col[c];
+    x->nrow = x->nnull = x->strsz = 0;
+    if (convert1(g->cp, batch, r0, batch->nrow, c, x)) {
+      g->on_error(g->handle, 0, 0, g->cp);
+      return -1;
+    }
+    sz += 4 * (int64_t)nrow;
+    sz += x->type == CSV_STRING    ? x->strsz
+          : x->type == CSV_DECIMAL ? PG_NUMERIC_MAX * (int64_t)nrow
+                                   : 8 * (int64_t)nrow;
+  }
+  if (buf_reserve(&g->out, &g->outmax, sz)) {
+    g->on_error(g->handle, CSV_EOUTOFMEMORY, "out of memory", 0);
+    return -1;
+  }
+
+  char *p = g->out;
+  for (int r = 0; r < nrow; r++) {
+    p = put16(p, g->ncol);
+    for (int c = 0; c < g->ncol; c++) {
+      const csv_column_t *x = &g->col[c];
+      if (!(x->valid[r >> 3] >> (r & 7) & 1)) {
+        p = put32(p, -1);
+        continue;
+      }
+      switch (x->type) {
+      case CSV_STRING: {
+        const int *off = x->data;
+        const int len = off[r + 1] - off[r];
+        p = put32(p, len);
+        memcpy(p, x->str + off[r], len);
+        p += len;
+        break;
+      }
+      case CSV_INT64:
+        p = put32(p, 8);
+        p = put64(p, ((const int64_t *)x->data)[r]);
+        break;
+      case CSV_FLOAT64: {
+        uint64_t w;
+        memcpy(&w, (const double *)x->data + r, 8);
+        p = put32(p, 8);
+        p = put64(p, w);
+        break;
+      }
+      case CSV_DECIMAL:
+        p = pg_numeric(p, ((const int64_t *)x->data)[r], x->scale);
+        break;
+      case CSV_BOOL:
+        p = put32(p, 1);
+        *p++ = ((const uint8_t *)x->data)[r];
+        break;
+      case CSV_DATE:
+        p = put32(p, 4);
+        p = put32(p, ((const int32_t *)x->data)[r] - PG_EPOCH_DAYS);
+        break;
+      case CSV_TIMESTAMP:
+        p = put32(p, 8);
+        p = put64(p, ((const int64_t *)x->data)[r] - PG_EPOCH_USEC);
+        break;
+      }
+    }
+  }
+  return write_all(g->on_write, g->handle, g->out, p - g->out);
+}
+
+static void pgcopy_open(intptr_t handle, csv_parse_t *cp) {
+  pgcopy_t *g = (pgcopy_t *)handle;
+  g->cp = cp;
+}
+
+static void pgcopy_error(intptr_t handle, int errtype, const char *errmsg,
+                         csv_parse_t *cp) {
+  pgcopy_t *g = (pgcopy_t *)handle;
+  g->on_error(g->handle, errtype, errmsg, cp);
+}
+
+int csv_scan_pgcopy(const csv_pgcopyopt_t *opt, intptr_t handle, int qte,
+                    int esc, int delim, const char nullstr[20],
+                    int (*on_bufempty)(intptr_t handle, char *buf, int bufsz),
+                    int (*on_write)(intptr_t handle, const char *buf,
+                                    int bufsz),
+                    void (*on_error)(intptr_t handle, int errtype,
+                                     const char *errmsg, csv_parse_t *cp)) {
+  static const csv_pgcopyopt_t defopt = {0};
+  opt = opt ? opt : &defopt;
+  const char *msg = check_types(opt->ncol, opt->type, opt->scale);
+  if (msg) {
+    on_error(handle, CSV_EPARAM, msg, 0);
+    return -1;
+  }
+
+  pgcopy_t g = {0};
+  g.handle = handle;
+  g.on_write = on_write;
+  g.on_error = on_error;
+  g.opt = opt;
+
+  csv_scanopt_t scanopt = {0};
+  scanopt.nreadahead = opt->nreadahead;
+  scancb_t cb = {0};
+  cb.handle = (intptr_t)&g;
+  cb.rdhandle = handle;
+  cb.on_bufempty = on_bufempty;
+  cb.on_rows = pgcopy_rows;
+  cb.on_error = pgcopy_error;
+  cb.on_open = pgcopy_open;
+  int ret = scan(&cb, &scanopt, qte, esc, delim, nullstr);
+
+  /* the trailer is a field count of -1 */
+  const char trailer[2] = {-1, -1};
+  if (ret == 0 && ((!g.started && pgcopy_start(&g, 0)) ||
+                   write_all(on_write, handle, trailer, 2))) {
+    ret = -1;
+  }
+  for (int c = 0; g.col && c < g.ncol; c++) {
+    csv_column_free(&g.col[c]);
+  }
+  free(g.col);
+  free(g.out);
+  return ret;
 }
@@ -44,8 +44,71 @@
 #define CSV_EOUTOFMEMORY -104 /* OOM */
 #define CSV_EROWTOOLONG -105  /* for csv_scan, buffer overflow */
 #define CSV_EEXTRAINPUT -106  /* for csv_scan, parse error  */
+#define CSV_EIO -107          /* for csv_scan_file, cannot read file */
+#define CSV_ECONVERT -108     /* for csv_convert, bad value */
 
 typedef struct csv_parse_t csv_parse_t;
+typedef struct csv_sindex_t csv_sindex_t;
+typedef struct csv_batch_t csv_batch_t;
+typedef struct csv_view_t csv_view_t;
+typedef struct csv_scanopt_t csv_scanopt_t;
+typedef struct csv_grep_t csv_grep_t;
+typedef struct csv_column_t csv_column_t;
+typedef struct csv_arrowopt_t csv_arrowopt_t;
+typedef struct csv_pgcopyopt_t csv_pgcopyopt_t;
+
+/**
+ * Structural index of a buffer. The buffer is classified 64 bytes at a
+ * time; the quote bitmap is turned into an in-quote mask with a
+ * carry-less multiply (prefix xor), and the offset of every delim,
+ * \n and \r outside quotes is appended to pos[].
+ *
+ * Bit 31 of a pos[] element (CSV_SINDEX_QUOTED) is set if the field
+ * ending at that delim or newline contains a quote char.
+ */
+struct csv_sindex_t {
+  const char *buf;  /* the indexed buffer */
+  int bufsz;        /* size of buf[] */
+  int top;          /* buf[0..top) has been indexed */
+  int npos;         /* num used elements in pos[] */
+  int maxpos;       /* num allocated elements in pos[] */
+  uint32_t *pos;    /* pos[] - offsets of structural chars in buf[] */
+  uint64_t inquote; /* all ones if buf[top-1] is inside quotes */
+  int qpend;        /* a quote was seen after the last pos[] element */
+};
+
+#define CSV_SINDEX_QUOTED 0x80000000u
+
+/**
+ * Rows returned by csv_feed_batch, in struct-of-arrays form. Field j
+ * starts at buf + off[j] and has len[j] bytes, followed by a NUL; it
+ * has been unescaped and unquoted. A NULL field has len[j] == -1, and
+ * off[j] still tells where it was.
+ * The fields of row r are j = row[r] .. row[r+1]-1.
+ */
+struct csv_batch_t {
+  char *buf;      /* off[] is relative to buf */
+  int64_t rownum; /* row number of the first row in the batch */
+  int nrow;       /* num rows in the batch */
+  int nfield;     /* num fields in the batch */
+  int *row;       /* row[] - index of first field of each row; nrow+1 used */
+  int *off;       /* off[] - offset of each field in buf[] */
+  int *len;       /* len[] - length of each field; -1 if NULL */
+  int maxrow;     /* num allocated elements in row[] */
+  int maxfield;   /* num allocated elements in off[] and len[] */
+};
+
+/**
+ * A field as it appears in the input: ptr[0..len) is the raw field,
+ * quotes and escapes included. Read its value with csv_view_get().
+ */
+struct csv_view_t {
+  const char *ptr; /* start of the field in buf[] */
+  int len;         /* raw length */
+  int flags;       /* CSV_VIEW_xx */
+};
+
+#define CSV_VIEW_QUOTED 1 /* field has quotes; its value must be unescaped */
 
 /**
  * Create a parser. Returns NULL on out-of-memory error.
@@ -66,11 +129,42 @@ csv_open(int qte,                 /* quote char */
          int esc,                 /* escape char */
          int delim,               /* delim char */
          const char nullstr[20]); /* sql NULL representation */
-                                  /**
-                                   * Destroy the parser
-                                   */
+
+/**
+ * Same as csv_open, for rows of about ncol fields (0 if not known).
+ * The per-field arrays are sized for ncol up front instead of growing
+ * while the first rows are parsed.
+ */
+CSV_EXTERN csv_parse_t *csv_open_ex(int qte, int esc, int delim,
+                                    const char nullstr[20], int ncol);
+
+/**
+ * Select the columns returned by csv_feed and csv_feed_last: col[] has
+ * ncol 0-based column numbers, in any order. field[] then holds only
+ * the selected fields present in the row, in column order, and nfield
+ * is their number. The other fields are only delimited; they are not
+ * unescaped, NUL terminated or checked for nullstr.
+ *
+ * ncol <= 0 selects all columns again. Returns 0 on success, -1 on
+ * error. Views and batches always have all the fields.
+ */
+CSV_EXTERN int csv_project(csv_parse_t *cp, const int *col, int ncol);
+
+/**
+ * Destroy the parser
+ */
 CSV_EXTERN void csv_close(csv_parse_t *cp);
 
+/**
+ * After csv_line or a csv_feed* call returned 0, say that the next
+ * call passes the same incomplete row again at the start of buf, maybe
+ * moved to another buffer, with more data after it. Only the new bytes
+ * are then scanned, which keeps a row spanning many refills linear to
+ * parse. Without it, or for any call after the next, the row is parsed
+ * from its first byte.
+ */
+CSV_EXTERN void csv_feed_again(csv_parse_t *cp);
+
 /**
  * Parse the next row.
  * Returns
@@ -83,6 +177,13 @@ CSV_EXTERN void csv_close(csv_parse_t *cp);
  *
  * NULL fields are indicated by null pointers in field[].
  *
+ * Rows may end in \n, \r\n or a bare \r. The first row decides which;
+ * a later row that ends differently fails with CSV_ECRLF.
+ *
+ * After a 0 return, buf is as it was, and cp remembers how far it got
+ * into the incomplete row; see csv_feed_again. Otherwise every call
+ * parses buf from its first byte.
+ *
  */
 CSV_EXTERN int csv_feed(csv_parse_t *const cp, char *buf, int bufsz,
                         char ***ret_field, int *ret_nfield);
@@ -94,10 +195,158 @@ CSV_EXTERN int csv_feed(csv_parse_t *const cp, char *buf, int bufsz,
  *
  * If the returned #bytes consumed in buf is not equal to bufsz, then there
  * are extra bytes at the end of buffer.
+ *
+ * The end of buf[] ends a row that has no newline. The row is parsed in
+ * place; only its last field is copied, as buf[] has no room for its
+ * NUL. csv_feed_view_last copies nothing.
+ *
+ * A row of up to 64 fields whose last field is under 256 bytes, such
+ * as a single message off a bus, is parsed without heap allocation.
  */
 CSV_EXTERN int csv_feed_last(csv_parse_t *const cp, char *buf, int bufsz,
                              char ***ret_field, int *ret_nfield);
 
+/**
+ * Parse as many complete rows of buf[] as possible, up to maxrow rows
+ * (no limit if maxrow <= 0). Returns the #bytes consumed like csv_feed,
+ * and the rows in *ret_batch. The batch belongs to cp and is valid
+ * until the next call. If a row fails to parse after some rows have
+ * been returned, the error is reported by the next call.
+ */
+CSV_EXTERN int csv_feed_batch(csv_parse_t *const cp, char *buf, int bufsz,
+                              int maxrow, const csv_batch_t **ret_batch);
+
+/**
+ * Same as csv_feed and csv_feed_last, but buf[] is not modified. The
+ * fields of the row are returned as views into buf[]; the views belong
+ * to cp and are valid until the next call.
+ */
+CSV_EXTERN int csv_feed_view(csv_parse_t *const cp, const char *buf,
+                             int bufsz, const csv_view_t **ret_view,
+                             int *ret_nview);
+CSV_EXTERN int csv_feed_view_last(csv_parse_t *const cp, const char *buf,
+                                  int bufsz, const csv_view_t **ret_view,
+                                  int *ret_nview);
+
+/**
+ * A row predicate for csv_feed_grep: a field whose value contains,
+ * equals or starts with pat[0..patsz). A NULL field never matches.
+ */
+struct csv_grep_t {
+  const char *pat; /* pattern to look for */
+  int patsz;       /* strlen(pat) */
+  int how;         /* CSV_GREP_xx */
+  int col;         /* 0-based column to test, or -1 for any column */
+};
+
+#define CSV_GREP_CONTAINS 0
+#define CSV_GREP_EQUALS 1
+#define CSV_GREP_PREFIX 2
+
+/**
+ * Parse the next row of buf[] that matches grep, skipping the others.
+ * Returns the #bytes consumed, up to the end of the matching row, or
+ * up to the last complete row if none matched; 0 if buf[] does not
+ * start with a complete row; -1 on error. The fields of the matching
+ * row are returned as in csv_feed; *ret_field is NULL if no row in the
+ * bytes consumed matched.
+ *
+ * The pattern is searched for in the raw bytes of buf[] first, and only
+ * the rows it occurs in are touched up and tested. The rows in between
+ * are only delimited. A pattern holding a quote or escape char cannot
+ * be found this way; then every row is tested.
+ *
+ * If last is set, buf[] ends the input as in csv_feed_last, and
+ * buf[bufsz] must be writable.
+ */
+CSV_EXTERN int csv_feed_grep(csv_parse_t *const cp, char *buf, int bufsz,
+                             int last, const csv_grep_t *grep,
+                             char ***ret_field, int *ret_nfield);
+
+/**
+ * Parse the last row of the input into a batch of one row. Same as
+ * csv_feed_last, but buf[bufsz] must be writable, so nothing is
+ * copied.
+ */
+CSV_EXTERN int csv_feed_batch_last(csv_parse_t *const cp, char *buf,
+                                   int bufsz, const csv_batch_t **ret_batch);
+
+/**
+ * Column types for csv_convert, and what each value becomes in data[]
+ */
+#define CSV_STRING 0    /* int offsets; see csv_column_t */
+#define CSV_INT64 1     /* int64_t */
+#define CSV_FLOAT64 2   /* double */
+#define CSV_DECIMAL 3   /* int64_t; the value times 10^scale */
+#define CSV_BOOL 4      /* uint8_t 0 or 1: false/true, f/t, no/yes, n/y, 0/1 */
+#define CSV_DATE 5      /* int32_t days since 1970-01-01; YYYY-MM-DD */
+#define CSV_TIMESTAMP 6 /* int64_t microseconds since 1970-01-01 UTC;
+                           YYYY-MM-DD[(T| )HH:MM:SS[.ffffff][Z]] */
+
+/**
+ * A column of typed values. Zero it and set type (and scale) before
+ * the first csv_convert; free it with csv_column_free.
+ *
+ * Bit r of valid[] (valid[r/8] >> r%8) is set unless value r is NULL;
+ * a NULL value is 0 in data[]. The string value r is
+ * str[off[r]..off[r+1]), where off is data[] as int[nrow+1]; it is
+ * not NUL terminated.
+ */
+struct csv_column_t {
+  int type;       /* CSV_xx */
+  int scale;      /* CSV_DECIMAL: digits after the point, 0..18 */
+  int nrow;       /* num values */
+  int nnull;      /* num NULL values */
+  uint8_t *valid; /* validity bitmap */
+  void *data;     /* values */
+  char *str;      /* CSV_STRING: bytes of the values */
+  int strsz;      /* num used bytes in str[] */
+  int maxrow;     /* num values allocated in data[] */
+  int maxstr;     /* num bytes allocated in str[] */
+};
+
+/**
+ * Convert the first ncol fields of the rows in batch into col[0..ncol),
+ * replacing what they held. Returns 0 on success, or -1 on error. A
+ * value that does not convert, or a row that is short of fields, fails
+ * with CSV_ECONVERT; csv_errrownum and csv_errfldnum tell the row and
+ * the 0-based column.
+ *
+ * Digits are parsed eight at a time. Floats with up to 19 significant
+ * digits and a small exponent are converted exactly without strtod.
+ */
+CSV_EXTERN int csv_convert(csv_parse_t *const cp, const csv_batch_t *batch,
+                           int ncol, csv_column_t col[]);
+CSV_EXTERN void csv_column_free(csv_column_t *col);
+
+/**
+ * Convert one value s[0..len) to type as csv_convert does, into *ret,
+ * which is what a value of that type becomes in data[] (nothing for
+ * CSV_STRING). Returns 0 on success, or -1 if it does not convert.
+ * s[] need not be NUL terminated. A float must be a decimal, as in
+ * -1.5e3; nan, inf, hex floats and blanks do not convert.
+ */
+CSV_EXTERN int csv_parse_value(int type, int scale, const char *s, int len,
+                               void *ret);
+
+/**
+ * Get the value of a field view. An unquoted value is returned in
+ * place; a quoted one is unescaped into scratch[], which needs room
+ * for v->len bytes. The value is not NUL terminated.
+ *
+ * Returns the length of the value and points *ret at it, or sets *ret
+ * to NULL for a sql NULL field. Returns -1 if scratch[] is too small.
+ */
+CSV_EXTERN int csv_view_get(csv_parse_t *const cp, const csv_view_t *v,
+                            char *scratch, int scratchsz, const char **ret);
+
+/**
+ * Name of the SIMD kernel picked by csv_open for this cpu: avx512, avx2,
+ * sse42 or scalar. Set the CSV_SIMD environment variable to one of these
+ * names to force a kernel, e.g. for benchmarking.
+ */
+CSV_EXTERN const char *csv_kernel(csv_parse_t *cp);
+
 /**
  * Get error info.
  */
@@ -112,9 +361,24 @@ CSV_EXTERN int csv_errfldnum(csv_parse_t *cp);
  * Parse the next row quickly while disregarding fields. Great
  * for locating row boundaries or counting rows without processing
  * the data.
+ *
+ * When esc == qte, csv_line indexes buf[] ahead of the current row and
+ * reuses that index if the next call passes the rest of the same buffer
+ * (buf advanced by the #bytes consumed, same end). Do not modify the
+ * unconsumed part of buf[] between such calls.
  */
 CSV_EXTERN int csv_line(csv_parse_t *const cp, const char *buf, int bufsz);
 
+/**
+ * Build the structural index of buf[] into ix, assuming buf[] starts at
+ * a row boundary. Only dialects with esc == qte can be indexed this way.
+ * An ix that is zeroed or was used before may be passed in; release it
+ * with csv_sindex_free(). Returns 0 on success, -1 on error.
+ */
+CSV_EXTERN int csv_sindex(csv_parse_t *const cp, const char *buf, int bufsz,
+                          csv_sindex_t *ix);
+CSV_EXTERN void csv_sindex_free(csv_sindex_t *ix);
+
 /**
  *  Scan using callbacks. Maximum row size is fixed at 10MB.
  *
@@ -137,4 +401,261 @@ CSV_EXTERN int csv_scan(
     void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
                      csv_parse_t *cp));
 
+/**
+ *  Options for csv_scan_ex. A field that is 0 takes its default.
+ */
+struct csv_scanopt_t {
+  int bufsz;      /* initial buffer size; default 1MB */
+  int maxrowsz;   /* rows longer than this fail with CSV_EROWTOOLONG;
+                     default 10MB */
+  int growpct;    /* grow the buffer by this percent when a row does not
+                     fit, up to maxrowsz; default 50 */
+  int nreadahead; /* if > 0, on_bufempty is called by a reader thread
+                     that keeps up to this many buffers of bufsz bytes
+                     filled ahead of the parser; default 0 */
+  int ncol;       /* expected #fields per row, as in csv_open_ex */
+  const int *col; /* if ncolsel > 0, on_row gets only these columns, */
+  int ncolsel;    /* as in csv_project */
+};
+
+/**
+ *  Same as csv_scan, with options. opt may be NULL.
+ *
+ *  The buffer is a ring mapped twice back to back in memory (on linux),
+ *  so the partial row at the end of a fill is never moved.
+ *
+ *  With nreadahead, on_bufempty runs in a thread of its own, while the
+ *  other callbacks run in the caller's thread. After an error the scan
+ *  waits for a pending on_bufempty call to return.
+ */
+CSV_EXTERN int csv_scan_ex(
+    const csv_scanopt_t *opt, intptr_t handle, int qte, int esc, int delim,
+    const char nullstr[20],
+    int (*on_bufempty)(intptr_t handle, char *buf, int bufsz),
+    int (*on_row)(intptr_t handle, int64_t rownum, char **field, int nfield),
+    void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                     csv_parse_t *cp));
+
+/**
+ *  Same as csv_scan, but rows are passed to on_rows many at a time.
+ *  The batch is valid until on_rows returns.
+ */
+CSV_EXTERN int csv_scan_batch(
+    intptr_t handle, int qte, int esc, int delim, const char nullstr[20],
+    int (*on_bufempty)(intptr_t handle, char *buf, int bufsz),
+    int (*on_rows)(intptr_t handle, const csv_batch_t *batch),
+    void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                     csv_parse_t *cp));
+
+/**
+ *  Same as csv_scan_batch, with options as in csv_scan_ex. opt may be
+ *  NULL.
+ */
+CSV_EXTERN int csv_scan_batch_ex(
+    const csv_scanopt_t *opt, intptr_t handle, int qte, int esc, int delim,
+    const char nullstr[20],
+    int (*on_bufempty)(intptr_t handle, char *buf, int bufsz),
+    int (*on_rows)(intptr_t handle, const csv_batch_t *batch),
+    void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                     csv_parse_t *cp));
+
+/**
+ *  Scan the file at path. A regular file is mapped and parsed in place
+ *  without copying; anything else, e.g. a pipe, is read through a
+ *  buffer as in csv_scan. The fields of each row are passed to on_view
+ *  as views; read them with csv_view_get(cp, ...).
+ *
+ *  flags: CSV_SCAN_HUGEPAGE asks for huge pages on the mapping.
+ *
+ *  Returns 0 on success, -1 on error.
+ */
+#define CSV_SCAN_HUGEPAGE 1
+CSV_EXTERN int csv_scan_file(
+    const char *path, int flags, intptr_t handle, int qte, int esc, int delim,
+    const char nullstr[20],
+    int (*on_view)(intptr_t handle, csv_parse_t *cp, int64_t rownum,
+                   const csv_view_t *view, int nview),
+    void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                     csv_parse_t *cp));
+
+/**
+ *  Options for csv_scan_arrow. A field that is 0 takes its default.
+ */
+#define CSV_ARROW_FILE 1   /* write the IPC file format, not the stream */
+#define CSV_ARROW_DICT 2   /* dictionary-encode the CSV_STRING columns */
+#define CSV_ARROW_HEADER 4 /* the first row holds the column names */
+struct csv_arrowopt_t {
+  int ncol;                /* num columns; default to the fields of the
+                              first row */
+  const int *type;         /* CSV_xx of each column; default CSV_STRING */
+  const int *scale;        /* scale of each CSV_DECIMAL column */
+  const char *const *name; /* column names; default to the header row if
+                              CSV_ARROW_HEADER, or f1, f2, ... */
+  int batchrows;           /* rows per record batch; default 65536 */
+  int nreadahead;          /* as in csv_scanopt_t */
+  int flags;               /* CSV_ARROW_xx */
+};
+
+/**
+ *  Scan as in csv_scan, converting the first ncol fields of each row
+ *  as in csv_convert, and write them out in the Arrow IPC format
+ *  through on_write, which returns 0 on success or -1 on error.
+ *
+ *  Every record batch but the last has batchrows rows. Values are
+ *  nullable; CSV_DECIMAL becomes decimal128 with precision 19,
+ *  CSV_DATE date32 and CSV_TIMESTAMP timestamp[us, UTC]. With
+ *  CSV_ARROW_DICT, each string column has one dictionary that grows
+ *  by delta batches.
+ *
+ *  Returns 0 on success, -1 on error.
+ */
+CSV_EXTERN int csv_scan_arrow(
+    const csv_arrowopt_t *opt, intptr_t handle, int qte, int esc, int delim,
+    const char nullstr[20],
+    int (*on_bufempty)(intptr_t handle, char *buf, int bufsz),
+    int (*on_write)(intptr_t handle, const char *buf, int bufsz),
+    void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                     csv_parse_t *cp));
+
+/**
+ *  Options for csv_scan_pgcopy. A field that is 0 takes its default.
+ */
+#define CSV_PGCOPY_HEADER 1 /* skip the first row */
+struct csv_pgcopyopt_t {
+  int ncol;         /* num columns; default to the fields of the first row */
+  const int *type;  /* CSV_xx of each column; default CSV_STRING */
+  const int *scale; /* scale of each CSV_DECIMAL column */
+  int nreadahead;   /* as in csv_scanopt_t */
+  int flags;        /* CSV_PGCOPY_xx */
+};
+
+/**
+ *  Scan as in csv_scan, converting the first ncol fields of each row
+ *  as in csv_convert, and write them out in the PostgreSQL binary COPY
+ *  format through on_write, which returns 0 on success or -1 on error.
+ *
+ *  A NULL field is written with a length of -1. The columns of the
+ *  target table must be of the matching type: text (or varchar) for
+ *  CSV_STRING, bigint, double precision, numeric, boolean, date, and
+ *  timestamp or timestamptz.
+ *
+ *  Returns 0 on success, -1 on error.
+ */
+CSV_EXTERN int csv_scan_pgcopy(
+    const csv_pgcopyopt_t *opt, intptr_t handle, int qte, int esc, int delim,
+    const char nullstr[20],
+    int (*on_bufempty)(intptr_t handle, char *buf, int bufsz),
+    int (*on_write)(intptr_t handle, const char *buf, int bufsz),
+    void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                     csv_parse_t *cp));
+
+/**
+ *  Scan buf[] using nthread threads. buf[] is cut into nthread chunks;
+ *  each chunk is first indexed for both possible quote states at its
+ *  start, then the chunks are stitched together and the rows of each
+ *  chunk are parsed in parallel.
+ *
+ *  Rows of chunk i are passed to on_row with handle[i]; handle[] must
+ *  have nthread elements. Rownum is the global row number. Small inputs
+ *  use fewer threads, and dialects where esc != qte are parsed by a
+ *  single thread. Fields are touched up in place, so buf[] must be
+ *  writable (a MAP_PRIVATE mapping will do).
+ *
+ *  Returns 0 on success, -1 on error.
+ */
+CSV_EXTERN int csv_scan_parallel(
+    int nthread, const intptr_t handle[], char *buf, int64_t bufsz, int qte,
+    int esc, int delim, const char nullstr[20],
+    int (*on_row)(intptr_t handle, int64_t rownum, char **field, int nfield),
+    void (*on_error)(intptr_t handle, int errtype, const char *errmsg,
+                     csv_parse_t *cp));
+
+/* where csv_count_rows left off in the input; zero it to start */
+typedef struct csv_count_t csv_count_t;
+struct csv_count_t {
+  int64_t nrow; /* num rows counted so far */
+  int inquote;  /* the input so far ends inside quotes */
+  int cr;       /* the input so far ends with a \r outside quotes */
+  int partial;  /* the input so far ends in a row with no terminator */
+};
+
+/**
+ *  Count the rows in buf[] without parsing them: only the row
+ *  terminators outside quotes are found, 64 bytes at a time from the
+ *  parity of the quotes, and counted by popcount. No field is split
+ *  or touched up and the rows are not checked, so a bad input gets
+ *  the count of the rows it appears to have.
+ *
+ *  Buf[] may be all of the input, or the next block of it; cnt
+ *  carries the quote state from one block to the next. Set last on
+ *  the last block, which may be empty, to count a last row that has
+ *  no terminator. Big blocks are cut into nthread chunks counted in
+ *  parallel; dialects where esc != qte are counted by one thread.
+ *
+ *  Returns the num rows counted so far (cnt->nrow), or -1 on bad
+ *  params.
+ */
+CSV_EXTERN int64_t csv_count_rows(csv_count_t *cnt, int nthread,
+                                  const char *buf, int64_t bufsz, int qte,
+                                  int esc, int last);
+
+/**
+ *  Cut buf[] into parts at row ends, without parsing the rows. With
+ *  nrow > 0, each part has nrow rows (the last may have fewer); with
+ *  nbyte > 0, each part has as many rows as fit in nbyte bytes, but
+ *  at least one; otherwise buf[] is one part. Row ends are found as
+ *  csv_count_rows finds them, by nthread threads, and the rows are
+ *  not checked. Where esc != qte, the rows are cut one at a time by
+ *  csv_line instead.
+ *
+ *  The offset where each part ends goes to (*ret_cut)[], which the
+ *  caller frees. Returns the num parts, or -1 on error.
+ */
+CSV_EXTERN int64_t csv_split(int nthread, const char *buf, int64_t bufsz,
+                             int qte, int esc, int64_t nbyte, int64_t nrow,
+                             int64_t **ret_cut);
+
+/* a sidecar index of the rows of a csv file; see csv_index_build */
+typedef struct csv_index_t csv_index_t;
+
+/**
+ *  Write an index of the csv file at path to ixpath. The index has the
+ *  offset of row 1 and of every every-th row after it, delta encoded,
+ *  and the size and mtime of the file so that a changed file is not
+ *  read with a stale index. The rows are cut with csv_line and not
+ *  touched up.
+ *
+ *  Returns 0 on success, -1 on error.
+ */
+CSV_EXTERN int csv_index_build(const char *path, const char *ixpath,
+                               int every, intptr_t handle, int qte, int esc,
+                               int delim,
+                               void (*on_error)(intptr_t handle, int errtype,
+                                                const char *errmsg,
+                                                csv_parse_t *cp));
+
+/**
+ *  Read the index at ixpath. If path is given, the index must have
+ *  been made from the file at path as it is now. Returns NULL on
+ *  error, with the reason in *errmsg.
+ */
+CSV_EXTERN csv_index_t *csv_index_open(const char *ixpath, const char *path,
+                                       const char **errmsg);
+CSV_EXTERN void csv_index_close(csv_index_t *ix);
+
+/* num rows in the indexed file */
+CSV_EXTERN int64_t csv_index_nrow(const csv_index_t *ix);
+
+/**
+ *  Get cp ready to parse from the indexed row at or before rownum
+ *  (rows are numbered from 1, as csv_scan passes them). Its number
+ *  goes to *ret_rownum; the rows fed to cp from there on are numbered
+ *  on from it, as in a csv_feed from the start of the file.
+ *
+ *  Returns the offset in the file where that row starts, or -1 if
+ *  rownum is out of range or cp has another quote or escape char.
+ */
+CSV_EXTERN int64_t csv_seek_row(csv_parse_t *cp, const csv_index_t *ix,
+                                int64_t rownum, int64_t *ret_rownum);
+
 #endif /*CSV_H*/
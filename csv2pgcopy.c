@@ -0,0 +1,266 @@
+/*
+  CSVC99 - SIMD-accelerated csv parser in C99
+  Copyright (c) 2019-2020 CK Tan
+  cktanx@gmail.com
+
+  CSVC99 can be used for free under the GNU General Public License
+  version 3, where anything released into public must be open source,
+  or under a commercial license. The commercial license does not
+  cover derived or ported versions created by third parties under
+  GPL. To inquire about commercial license, please send email to
+  cktanx@gmail.com.
+*/
+
+const char *usagestr = "\n\
+  USAGE: %s [-h] [-H] [-t types] [-o outfile] [-d delim] [-q quote] \n\
+            [-e esc] [-n nullstr] [FILE]\n\
+                        \n\
+  Convert a csv file to the PostgreSQL binary COPY format, to load  \n\
+  with COPY ... FROM ... WITH (FORMAT binary). Columns are text     \n\
+  unless -t gives their types, which must match those of the table: \n\
+  text, bigint, double precision, numeric, boolean, date, and       \n\
+  timestamp or timestamptz.                                         \n\
+                        \n\
+  OPTIONS:              \n\
+                        \n\
+      -h         : print this message          \n\
+      -H         : skip the first row, which holds the column names \n\
+      -t types   : convert the first columns to these types, and    \n\
+                   write only those; a comma separated list of      \n\
+                   s(tring), i(nt64), f(loat64), dN (decimal with N \n\
+                   digits after the point), b(ool), D(ate) or       \n\
+                   T(imestamp)                                      \n\
+      -o outfile : write to outfile; default to stdout              \n\
+      -d delim   : specify delim char; default to comma              \n\
+      -q quote   : specify quote char; default to double-quote       \n\
+      -e esc     : specify escape char; default to the quote char    \n\
+      -n nullstr : specify string representing null; default to \"\" \n\
+      \n\
+";
+
+#define _GNU_SOURCE
+#include "csv.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const char *pname = 0;
+const char *fname = 0;
+const char *oname = 0;
+int qte = '"';
+int esc = 0;
+int delim = ',';
+char nullstr[20] = {0};
+csv_pgcopyopt_t aopt = {0};
+int *type = 0; /* -t: the column types */
+int *scale = 0;
+
+#define perr(M, ...) fprintf(stderr, M, ##__VA_ARGS__)
+#define pout(M, ...) fprintf(stdout, M, ##__VA_ARGS__)
+#define fatal(M, ...)                                                          \
+  do {                                                                         \
+    fprintf(stderr, M, ##__VA_ARGS__);                                         \
+    exit(1);                                                                   \
+  } while (0)
+
+void usage(int exitcode, const char *msg) {
+  perr(usagestr, pname);
+  if (msg) {
+    perr("\n%s\n", msg);
+  }
+  exit(exitcode);
+}
+
+static void parse_types(char *s) {
+  for (; *s; s++) {
+    const int n = aopt.ncol++;
+    if (!(type = realloc(type, aopt.ncol * sizeof(*type))) ||
+        !(scale = realloc(scale, aopt.ncol * sizeof(*scale)))) {
+      fatal("ERROR: out of memory\n");
+    }
+    scale[n] = 0;
+    switch (*s) {
+    case 's':
+      type[n] = CSV_STRING;
+      break;
+    case 'i':
+      type[n] = CSV_INT64;
+      break;
+    case 'f':
+      type[n] = CSV_FLOAT64;
+      break;
+    case 'd':
+      type[n] = CSV_DECIMAL;
+      scale[n] = strtol(s + 1, &s, 10);
+      s--;
+      break;
+    case 'b':
+      type[n] = CSV_BOOL;
+      break;
+    case 'D':
+      type[n] = CSV_DATE;
+      break;
+    case 'T':
+      type[n] = CSV_TIMESTAMP;
+      break;
+    default:
+      usage(1, "Error: -t expects a list of s, i, f, dN, b, D or T.");
+    }
+    if (s[1] == ',') {
+      s++;
+    } else if (s[1]) {
+      usage(1, "Error: -t expects a list of s, i, f, dN, b, D or T.");
+    }
+  }
+  aopt.type = type;
+  aopt.scale = scale;
+}
+
+void parse_cmdline(int argc, char *const *argv) {
+  pname = argv[0];
+  int opt;
+  char *q, *e, *d, *n, *t;
+  q = e = d = n = t = 0;
+  while ((opt = getopt(argc, argv, "Ht:o:d:q:e:n:h")) != -1) {
+    switch (opt) {
+    case 'H':
+      aopt.flags |= CSV_PGCOPY_HEADER;
+      break;
+    case 't':
+      t = optarg;
+      break;
+    case 'o':
+      oname = optarg;
+      break;
+    case 'd':
+      d = optarg;
+      break;
+    case 'q':
+      q = optarg;
+      break;
+    case 'e':
+      e = optarg;
+      break;
+    case 'n':
+      n = optarg;
+      break;
+    case 'h':
+      usage(0, 0);
+      break;
+    default:
+      usage(1, 0);
+      break;
+    }
+  }
+
+  /* fname */
+  if (optind == argc)
+    ; /* read from stdin */
+  else if (optind + 1 == argc)
+    fname = argv[optind];
+  else
+    usage(1, "Error: please supply only one filename");
+
+  /* types */
+  if (t) {
+    parse_types(t);
+  }
+
+  /* qte */
+  if (q) {
+    if (strlen(q) != 1) {
+      usage(1, "Error: -q quote-char expects a single char.");
+    }
+    qte = q[0];
+  }
+
+  /* esc */
+  esc = qte;
+  if (e) {
+    if (strlen(e) != 1) {
+      usage(1, "Error: -e escape-char expects a single char.");
+    }
+    esc = e[0];
+  }
+
+  /* delim */
+  if (d) {
+    if (strlen(d) != 1) {
+      usage(1, "Error: -d delim-char expects a single char.");
+    }
+    delim = d[0];
+  }
+
+  /* nullstr */
+  if (n) {
+    if (strlen(n) >= 20) {
+      usage(1, "Error: -n nullstr is too long. max is 19 chars");
+    }
+    strcpy(nullstr, n);
+  }
+}
+
+/* the input and output of the scan */
+typedef struct io_t io_t;
+struct io_t {
+  FILE *in;
+  FILE *out;
+};
+
+int do_read(intptr_t handle, char *buf, int bufsz) {
+  io_t *io = (io_t *)handle;
+  return fread(buf, 1, bufsz, io->in);
+}
+
+int do_write(intptr_t handle, const char *buf, int bufsz) {
+  io_t *io = (io_t *)handle;
+  if (bufsz != (int)fwrite(buf, 1, bufsz, io->out)) {
+    perr("ERROR: fwrite - %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+void do_error(intptr_t handle, int errtype, const char *errmsg,
+              csv_parse_t *cp) {
+  (void)handle;
+  (void)errtype;
+  if (cp && csv_errnum(cp) == CSV_ECONVERT) {
+    fatal("ERROR: row %d column %d: %s\n", csv_errrownum(cp),
+          csv_errfldnum(cp) + 1, csv_errmsg(cp));
+  }
+  errmsg = cp ? csv_errmsg(cp) : errmsg;
+  fatal("ERROR: %s\n", errmsg);
+}
+
+int main(int argc, char *argv[]) {
+  parse_cmdline(argc, argv);
+  io_t io = {stdin, stdout};
+
+  if (fname && !(io.in = fopen(fname, "r"))) {
+    perr("ERROR: fopen %s - %s\n", fname, strerror(errno));
+    exit(1);
+  }
+  if (oname && !(io.out = fopen(oname, "w"))) {
+    perr("ERROR: fopen %s - %s\n", oname, strerror(errno));
+    exit(1);
+  }
+
+  /* read ahead in a thread so fread overlaps with conversion */
+  aopt.nreadahead = 4;
+  if (csv_scan_pgcopy(&aopt, (intptr_t)&io, qte, esc, delim, nullstr,
+                      do_read, do_write, do_error)) {
+    exit(1);
+  }
+
+  if (fclose(io.out)) {
+    perr("ERROR: fclose - %s\n", strerror(errno));
+    exit(1);
+  }
+  fclose(io.in);
+  free(type);
+  free(scale);
+  return 0;
+}
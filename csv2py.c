@@ -12,7 +12,8 @@
 */
 
 const char *usagestr = "\n\
-  USAGE: %s [-h] [-d delim] [-q quote] [-e esc] [-n nullstr] [FILE]\n\
+  USAGE: %s [-h] [-d delim] [-q quote] [-e esc] [-n nullstr] [-t types] \n\
+            [FILE]\n\
                         \n\
                         \n\
   Print a csv file in a format that can be read into a \n\
@@ -35,15 +36,21 @@ const char *usagestr = "\n\
       -q quote   : specify quote char; default to double-quote           \n\
       -e esc     : specify escape char; default to the quote char        \n\
       -n nullstr : specify string representing null; default to \"\"     \n\
+      -t types   : convert the first columns to these types, and print  \n\
+                   only those; a comma separated list of s(tring),      \n\
+                   i(nt64), f(loat64), dN (decimal with N digits after  \n\
+                   the point), b(ool), D(ate) or T(imestamp)            \n\
       \n\
 ";
 
 #define _GNU_SOURCE
 #include "csv.h"
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 const char *pname = 0;
@@ -52,6 +59,8 @@ int qte = '"';
 int esc = '"';
 int delim = ',';
 char nullstr[20] = {0};
+csv_column_t *column = 0; /* -t: the typed columns */
+int ncolumn = 0;
 
 #define perr(M, ...) fprintf(stderr, M, ##__VA_ARGS__)
 #define pout(M, ...) fprintf(stdout, M, ##__VA_ARGS__)
@@ -72,10 +81,13 @@ void usage(int exitcode, const char *msg) {
 void parse_cmdline(int argc, char *const *argv) {
   pname = argv[0];
   int opt;
-  char *q, *e, *d, *n;
-  q = e = d = n = 0;
-  while ((opt = getopt(argc, argv, "d:q:e:n:h")) != -1) {
+  char *q, *e, *d, *n, *t;
+  q = e = d = n = t = 0;
+  while ((opt = getopt(argc, argv, "d:q:e:n:t:h")) != -1) {
     switch (opt) {
+    case 't':
+      t = optarg;
+      break;
     case 'd':
       d = optarg;
       break;
@@ -136,6 +148,47 @@ void parse_cmdline(int argc, char *const *argv) {
     }
     strcpy(nullstr, n);
   }
+
+  /* types */
+  for (char *s = t; s && *s; s++) {
+    if (!(column = realloc(column, (ncolumn + 1) * sizeof(*column)))) {
+      fatal("ERROR: out of memory\n");
+    }
+    csv_column_t *x = &column[ncolumn++];
+    memset(x, 0, sizeof(*x));
+    switch (*s) {
+    case 's':
+      x->type = CSV_STRING;
+      break;
+    case 'i':
+      x->type = CSV_INT64;
+      break;
+    case 'f':
+      x->type = CSV_FLOAT64;
+      break;
+    case 'd':
+      x->type = CSV_DECIMAL;
+      x->scale = strtol(s + 1, &s, 10);
+      s--;
+      break;
+    case 'b':
+      x->type = CSV_BOOL;
+      break;
+    case 'D':
+      x->type = CSV_DATE;
+      break;
+    case 'T':
+      x->type = CSV_TIMESTAMP;
+      break;
+    default:
+      usage(1, "Error: -t expects a list of s, i, f, dN, b, D or T.");
+    }
+    if (s[1] == ',') {
+      s++;
+    } else if (s[1]) {
+      usage(1, "Error: -t expects a list of s, i, f, dN, b, D or T.");
+    }
+  }
 }
 
 void print_special(const char *s) {
@@ -155,6 +208,160 @@ void print_special(const char *s) {
   }
 }
 
+/* print the value r of a typed column */
+void print_value(const csv_column_t *x, int r) {
+  if (!(x->valid[r >> 3] >> (r & 7) & 1)) {
+    printf("None");
+    return;
+  }
+  switch (x->type) {
+  case CSV_STRING: {
+    const int *off = x->data;
+    printf("'");
+    for (int i = off[r]; i < off[r + 1]; i++) {
+      const char ch = x->str[i];
+      if (ch == '\n') {
+        printf("\\n");
+      } else {
+        printf("%s%c", (ch == '\'' || ch == '\\') ? "\\" : "", ch);
+      }
+    }
+    printf("'");
+    break;
+  }
+  case CSV_INT64:
+    printf("%" PRId64, ((const int64_t *)x->data)[r]);
+    break;
+  case CSV_FLOAT64:
+    printf("%.17g", ((const double *)x->data)[r]);
+    break;
+  case CSV_DECIMAL: {
+    const int64_t v = ((const int64_t *)x->data)[r];
+    uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+    uint64_t p10 = 1;
+    for (int i = 0; i < x->scale; i++) {
+      p10 *= 10;
+    }
+    printf("%s%" PRIu64, v < 0 ? "-" : "", u / p10);
+    if (x->scale) {
+      printf(".%0*" PRIu64, x->scale, u % p10);
+    }
+    break;
+  }
+  case CSV_BOOL:
+    printf("%s", ((const uint8_t *)x->data)[r] ? "True" : "False");
+    break;
+  case CSV_DATE:
+  case CSV_TIMESTAMP: {
+    int64_t us = x->type == CSV_DATE
+                     ? ((const int32_t *)x->data)[r] * (int64_t)86400000000
+                     : ((const int64_t *)x->data)[r];
+    int64_t sec = us / 1000000 - (us % 1000000 < 0);
+    struct tm tm;
+    char str[40];
+    time_t tt = sec;
+    gmtime_r(&tt, &tm);
+    strftime(str, sizeof(str),
+             x->type == CSV_DATE ? "%Y-%m-%d" : "%Y-%m-%d %H:%M:%S", &tm);
+    printf("'%s", str);
+    if (x->type == CSV_TIMESTAMP) {
+      printf(".%06d", (int)(us - sec * 1000000));
+    }
+    printf("'");
+    break;
+  }
+  }
+}
+
+/* convert a batch of rows to the typed columns and print them */
+void print_batch(csv_parse_t *cp, const csv_batch_t *batch) {
+  if (csv_convert(cp, batch, ncolumn, column)) {
+    fatal("ERROR: row %d column %d: %s\n", csv_errrownum(cp),
+          csv_errfldnum(cp) + 1, csv_errmsg(cp));
+  }
+  for (int r = 0; r < batch->nrow; r++) {
+    printf("%s", batch->rownum + r > 1 ? ",\n" : "");
+    printf("	[");
+    for (int c = 0; c < ncolumn; c++) {
+      printf("%s", c ? "," : "");
+      print_value(&column[c], r);
+    }
+    printf("]");
+  }
+}
+
+/* read fp a buffer at a time, and print the typed rows */
+void do_typed(FILE *fp) {
+  csv_parse_t *cp = csv_open(qte, esc, delim, nullstr);
+  if (!cp) {
+    fatal("ERROR: csv_open failed\n");
+  }
+
+  /* one spare byte past the end of buf[] for csv_feed_batch_last */
+  int bufsz = 1024 * 1024;
+  char *buf = malloc(bufsz + 1);
+  char *p = buf;
+  char *q = buf;
+  int eof = 0;
+  if (!buf) {
+    fatal("ERROR: out of memory\n");
+  }
+
+  while (!eof) {
+    // shift forward
+    if (p != buf) {
+      memmove(buf, p, q - p);
+      q = buf + (q - p);
+      p = buf;
+    }
+
+    // expand
+    if (q - p == bufsz) {
+      if (bufsz >= 1024 * 1024 * 128) {
+        fatal("ERROR: row bigger than 128MB\n");
+      }
+      char *tmp;
+      if (!(tmp = realloc(buf, bufsz * 2 + 1))) {
+        fatal("ERROR: out of memory\n");
+      }
+      q = tmp + (q - p);
+      p = buf = tmp;
+      bufsz *= 2;
+    }
+
+    // fill
+    int n = fread(q, 1, bufsz - (q - p), fp);
+    if (ferror(fp)) {
+      perror("fread");
+      exit(1);
+    }
+    eof = (n == 0);
+    q += n;
+
+    // print the complete rows in p..q
+    while (p < q) {
+      const csv_batch_t *batch;
+      n = eof ? csv_feed_batch_last(cp, p, q - p, &batch)
+              : csv_feed_batch(cp, p, q - p, 0, &batch);
+      if (n < 0) {
+        fatal("ERROR: %s\n", csv_errmsg(cp));
+      }
+      if (n == 0) {
+        if (eof) {
+          fatal("ERROR: extra data after last row\n");
+        }
+        csv_feed_again(cp); /* the row continues in the next read */
+        break;
+      }
+      print_batch(cp, batch);
+      p += n;
+    }
+  }
+
+  free(buf);
+  csv_close(cp);
+}
+
 int do_read(intptr_t handle, char *buf, int bufsz) {
   FILE *fp = (FILE *)handle;
   return fread(buf, 1, bufsz, fp);
@@ -202,10 +409,22 @@ int main(int argc, char *argv[]) {
   }
 
   printf("[\n");
-  csv_scan((intptr_t)fp, qte, esc, delim, nullstr, do_read, do_row, do_error);
+  if (ncolumn) {
+    do_typed(fp);
+  } else {
+    /* read ahead in a thread so fread overlaps with parsing */
+    csv_scanopt_t opt = {0};
+    opt.nreadahead = 4;
+    csv_scan_ex(&opt, (intptr_t)fp, qte, esc, delim, nullstr, do_read, do_row,
+                do_error);
+  }
   printf("\n]\n\n");
 
   fclose(fp);
+  for (int c = 0; c < ncolumn; c++) {
+    csv_column_free(&column[c]);
+  }
+  free(column);
 
   return 0;
 }
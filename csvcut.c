@@ -0,0 +1,251 @@
+/*
+  CSVC99 - SIMD-accelerated csv parser in C99
+  Copyright (c) 2019-2020 CK Tan
+  cktanx@gmail.com
+
+  CSVC99 can be used for free under the GNU General Public License
+  version 3, where anything released into public must be open source,
+  or under a commercial license. The commercial license does not
+  cover derived or ported versions created by third parties under
+  GPL. To inquire about commercial license, please send email to
+  cktanx@gmail.com.
+*/
+
+const char *usagestr = "\n\
+  USAGE: %s [-h] [-d delim] [-q quote] [-e esc] [-n nullstr] -f LIST [FILE]\n\
+                        \n\
+  Print the selected columns of a csv file. LIST is made of column \n\
+  numbers and ranges, separated by commas, e.g. 1,3,5-7. Columns   \n\
+  are numbered from 1, and are printed in the order they appear in \n\
+  the file. Rows keep the delim, quote and escape chars of FILE.   \n\
+                        \n\
+  OPTIONS:              \n\
+                        \n\
+      -h         : print this message          \n\
+      -f LIST    : columns to print            \n\
+      -d delim   : specify delim char; default to comma              \n\
+      -q quote   : specify quote char; default to double-quote       \n\
+      -e esc     : specify escape char; default to the quote char    \n\
+      -n nullstr : specify string representing null; default to \"\" \n\
+      \n\
+";
+
+#define _GNU_SOURCE
+#include "csv.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const char *pname = 0;
+const char *fname = 0;
+int qte = '"';
+int esc = 0;
+int delim = ',';
+char nullstr[20] = {0};
+int *col = 0; /* 0-based column numbers to print */
+int ncol = 0;
+
+#define perr(M, ...) fprintf(stderr, M, ##__VA_ARGS__)
+#define pout(M, ...) fprintf(stdout, M, ##__VA_ARGS__)
+#define fatal(M, ...)                                                          \
+  do {                                                                         \
+    fprintf(stderr, M, ##__VA_ARGS__);                                         \
+    exit(1);                                                                   \
+  } while (0)
+
+void usage(int exitcode, const char *msg) {
+  perr(usagestr, pname);
+  if (msg) {
+    perr("\n%s\n", msg);
+  }
+  exit(exitcode);
+}
+
+/* add columns lo..hi, 1-based and inclusive, to col[] */
+static void addcols(int lo, int hi) {
+  if (lo < 1 || hi < lo) {
+    usage(1, "Error: -f expects column numbers or ranges from 1.");
+  }
+  if (!(col = realloc(col, (ncol + hi - lo + 1) * sizeof(*col)))) {
+    fatal("ERROR: out of memory\n");
+  }
+  for (int i = lo; i <= hi; i++) {
+    col[ncol++] = i - 1;
+  }
+}
+
+static void parse_list(const char *s) {
+  while (*s) {
+    char *e;
+    int lo = strtol(s, &e, 10);
+    int hi = lo;
+    if (e == s) {
+      usage(1, "Error: -f expects column numbers or ranges from 1.");
+    }
+    if (*e == '-') {
+      s = e + 1;
+      hi = strtol(s, &e, 10);
+      if (e == s) {
+        usage(1, "Error: -f expects column numbers or ranges from 1.");
+      }
+    }
+    addcols(lo, hi);
+    s = e;
+    if (*s == ',') {
+      s++;
+    } else if (*s) {
+      usage(1, "Error: -f expects column numbers or ranges from 1.");
+    }
+  }
+}
+
+void parse_cmdline(int argc, char *const *argv) {
+  pname = argv[0];
+  int opt;
+  char *q, *e, *d, *n, *f;
+  q = e = d = n = f = 0;
+  while ((opt = getopt(argc, argv, "f:d:q:e:n:h")) != -1) {
+    switch (opt) {
+    case 'f':
+      f = optarg;
+      break;
+    case 'd':
+      d = optarg;
+      break;
+    case 'q':
+      q = optarg;
+      break;
+    case 'e':
+      e = optarg;
+      break;
+    case 'n':
+      n = optarg;
+      break;
+    case 'h':
+      usage(0, 0);
+      break;
+    default:
+      usage(1, 0);
+      break;
+    }
+  }
+
+  /* fname */
+  if (optind == argc)
+    ; /* read from stdin */
+  else if (optind + 1 == argc)
+    fname = argv[optind];
+  else
+    usage(1, "Error: please supply only one filename");
+
+  /* col */
+  if (!f) {
+    usage(1, "Error: please supply -f LIST");
+  }
+  parse_list(f);
+
+  /* qte */
+  if (q) {
+    if (strlen(q) != 1) {
+      usage(1, "Error: -q quote-char expects a single char.");
+    }
+    qte = q[0];
+  }
+
+  /* esc */
+  esc = qte;
+  if (e) {
+    if (strlen(e) != 1) {
+      usage(1, "Error: -e escape-char expects a single char.");
+    }
+    esc = e[0];
+  }
+
+  /* delim */
+  if (d) {
+    if (strlen(d) != 1) {
+      usage(1, "Error: -d delim-char expects a single char.");
+    }
+    delim = d[0];
+  }
+
+  /* nullstr */
+  if (n) {
+    if (strlen(n) >= 20) {
+      usage(1, "Error: -n nullstr is too long. max is 19 chars");
+    }
+    strcpy(nullstr, n);
+  }
+}
+
+void print_special(const char *s) {
+  putchar(qte);
+  for (; *s; s++) {
+    if (*s == qte || *s == esc) {
+      putchar(esc);
+    }
+    putchar(*s);
+  }
+  putchar(qte);
+}
+
+int do_read(intptr_t handle, char *buf, int bufsz) {
+  FILE *fp = (FILE *)handle;
+  return fread(buf, 1, bufsz, fp);
+}
+
+int do_row(intptr_t handle, int64_t rownum, char **field, int nfield) {
+  (void)handle;
+  (void)rownum;
+  const char special[] = {qte, esc, delim, '\r', '\n', 0};
+  for (int i = 0; i < nfield; i++) {
+    const char *s = field[i];
+    if (i) {
+      putchar(delim);
+    }
+    if (!s) {
+      fputs(nullstr, stdout);
+    } else if (!*s || strpbrk(s, special) || 0 == strcmp(s, nullstr)) {
+      /* quoted, so it does not read back as a NULL or as many fields */
+      print_special(s);
+    } else {
+      fputs(s, stdout);
+    }
+  }
+  putchar('\n');
+  return 0;
+}
+
+void do_error(intptr_t handle, int errtype, const char *errmsg,
+              csv_parse_t *cp) {
+  (void)handle;
+  (void)errtype;
+  errmsg = cp ? csv_errmsg(cp) : errmsg;
+  fatal("ERROR: %s\n", errmsg);
+}
+
+int main(int argc, char *argv[]) {
+  parse_cmdline(argc, argv);
+  FILE *fp = stdin;
+
+  if (fname && !(fp = fopen(fname, "r"))) {
+    perr("ERROR: fopen %s - %s\n", fname, strerror(errno));
+    exit(1);
+  }
+
+  /* only the selected columns are touched up by the parser */
+  csv_scanopt_t opt = {0};
+  opt.nreadahead = 4;
+  opt.col = col;
+  opt.ncolsel = ncol;
+  if (csv_scan_ex(&opt, (intptr_t)fp, qte, esc, delim, nullstr, do_read,
+                  do_row, do_error)) {
+    exit(1);
+  }
+
+  fclose(fp);
+  free(col);
+  return 0;
+}
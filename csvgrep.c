@@ -0,0 +1,277 @@
+/*
+  CSVC99 - SIMD-accelerated csv parser in C99
+  Copyright (c) 2019-2020 CK Tan
+  cktanx@gmail.com
+
+  CSVC99 can be used for free under the GNU General Public License
+  version 3, where anything released into public must be open source,
+  or under a commercial license. The commercial license does not
+  cover derived or ported versions created by third parties under
+  GPL. To inquire about commercial license, please send email to
+  cktanx@gmail.com.
+*/
+
+const char *usagestr = "\n\
+  USAGE: %s [-h] [-x | -p] [-c col] [-d delim] [-q quote] [-e esc] \n\
+            [-n nullstr] PATTERN [FILE]\n\
+                        \n\
+  Print the rows of a csv file that have a field containing PATTERN. \n\
+  Only the rows where PATTERN occurs in the raw input are parsed in  \n\
+  full and tested. Rows keep the delim, quote and escape chars of    \n\
+  FILE.                 \n\
+                        \n\
+  OPTIONS:              \n\
+                        \n\
+      -h         : print this message          \n\
+      -x         : the field must equal PATTERN               \n\
+      -p         : the field must start with PATTERN          \n\
+      -c col     : test only column col, numbered from 1      \n\
+      -d delim   : specify delim char; default to comma              \n\
+      -q quote   : specify quote char; default to double-quote       \n\
+      -e esc     : specify escape char; default to the quote char    \n\
+      -n nullstr : specify string representing null; default to \"\" \n\
+      \n\
+";
+
+#define _GNU_SOURCE
+#include "csv.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const char *pname = 0;
+const char *fname = 0;
+int qte = '"';
+int esc = 0;
+int delim = ',';
+char nullstr[20] = {0};
+csv_grep_t grep = {0, 0, CSV_GREP_CONTAINS, -1};
+
+#define perr(M, ...) fprintf(stderr, M, ##__VA_ARGS__)
+#define pout(M, ...) fprintf(stdout, M, ##__VA_ARGS__)
+#define fatal(M, ...)                                                          \
+  do {                                                                         \
+    fprintf(stderr, M, ##__VA_ARGS__);                                         \
+    exit(1);                                                                   \
+  } while (0)
+
+void usage(int exitcode, const char *msg) {
+  perr(usagestr, pname);
+  if (msg) {
+    perr("\n%s\n", msg);
+  }
+  exit(exitcode);
+}
+
+void parse_cmdline(int argc, char *const *argv) {
+  pname = argv[0];
+  int opt;
+  char *q, *e, *d, *n, *c;
+  q = e = d = n = c = 0;
+  while ((opt = getopt(argc, argv, "xpc:d:q:e:n:h")) != -1) {
+    switch (opt) {
+    case 'x':
+      grep.how = CSV_GREP_EQUALS;
+      break;
+    case 'p':
+      grep.how = CSV_GREP_PREFIX;
+      break;
+    case 'c':
+      c = optarg;
+      break;
+    case 'd':
+      d = optarg;
+      break;
+    case 'q':
+      q = optarg;
+      break;
+    case 'e':
+      e = optarg;
+      break;
+    case 'n':
+      n = optarg;
+      break;
+    case 'h':
+      usage(0, 0);
+      break;
+    default:
+      usage(1, 0);
+      break;
+    }
+  }
+
+  /* pattern and fname */
+  if (optind == argc)
+    usage(1, "Error: please supply a PATTERN");
+  grep.pat = argv[optind++];
+  grep.patsz = strlen(grep.pat);
+  if (optind == argc)
+    ; /* read from stdin */
+  else if (optind + 1 == argc)
+    fname = argv[optind];
+  else
+    usage(1, "Error: please supply only one filename");
+
+  /* col */
+  if (c) {
+    grep.col = strtol(c, 0, 0) - 1;
+    if (grep.col < 0) {
+      usage(1, "Error: -c col expects a column number from 1.");
+    }
+  }
+
+  /* qte */
+  if (q) {
+    if (strlen(q) != 1) {
+      usage(1, "Error: -q quote-char expects a single char.");
+    }
+    qte = q[0];
+  }
+
+  /* esc */
+  esc = qte;
+  if (e) {
+    if (strlen(e) != 1) {
+      usage(1, "Error: -e escape-char expects a single char.");
+    }
+    esc = e[0];
+  }
+
+  /* delim */
+  if (d) {
+    if (strlen(d) != 1) {
+      usage(1, "Error: -d delim-char expects a single char.");
+    }
+    delim = d[0];
+  }
+
+  /* nullstr */
+  if (n) {
+    if (strlen(n) >= 20) {
+      usage(1, "Error: -n nullstr is too long. max is 19 chars");
+    }
+    strcpy(nullstr, n);
+  }
+}
+
+void print_special(const char *s) {
+  putchar(qte);
+  for (; *s; s++) {
+    if (*s == qte || *s == esc) {
+      putchar(esc);
+    }
+    putchar(*s);
+  }
+  putchar(qte);
+}
+
+void print_row(char **field, int nfield) {
+  const char special[] = {qte, esc, delim, '\r', '\n', 0};
+  for (int i = 0; i < nfield; i++) {
+    const char *s = field[i];
+    if (i) {
+      putchar(delim);
+    }
+    if (!s) {
+      fputs(nullstr, stdout);
+    } else if (!*s || strpbrk(s, special) || 0 == strcmp(s, nullstr)) {
+      /* quoted, so it does not read back as a NULL or as many fields */
+      print_special(s);
+    } else {
+      fputs(s, stdout);
+    }
+  }
+  putchar('\n');
+}
+
+void do_grep(FILE *fp) {
+  csv_parse_t *cp = csv_open(qte, esc, delim, nullstr);
+  if (!cp) {
+    fatal("ERROR: csv_open failed\n");
+  }
+
+  /* one spare byte past the end of buf[] for csv_feed_grep(last) */
+  int bufsz = 1024 * 1024;
+  char *buf = malloc(bufsz + 1);
+  char *p = buf;
+  char *q = buf;
+  int eof = 0;
+  if (!buf) {
+    fatal("ERROR: out of memory\n");
+  }
+
+  while (!eof || p < q) {
+    // shift forward
+    if (p != buf) {
+      memmove(buf, p, q - p);
+      q = buf + (q - p);
+      p = buf;
+    }
+
+    // expand
+    if (q - p == bufsz) {
+      if (bufsz >= 1024 * 1024 * 128) {
+        fatal("ERROR: row bigger than 128MB\n");
+      }
+      char *tmp;
+      if (!(tmp = realloc(buf, bufsz * 2 + 1))) {
+        fatal("ERROR: out of memory\n");
+      }
+      q = tmp + (q - p);
+      p = buf = tmp;
+      bufsz *= 2;
+    }
+
+    // fill
+    if (!eof) {
+      int n = fread(q, 1, bufsz - (q - p), fp);
+      if (n < 0 || ferror(fp)) {
+        perror("fread");
+        exit(1);
+      }
+      eof = (n == 0);
+      q += n;
+    }
+
+    // print the matching rows in p..q
+    while (p < q) {
+      char **field;
+      int nfield;
+      int n = csv_feed_grep(cp, p, q - p, eof, &grep, &field, &nfield);
+      if (n < 0) {
+        fatal("ERROR: %s\n", csv_errmsg(cp));
+      }
+      if (n == 0) {
+        if (eof) {
+          fatal("ERROR: extra data after last row\n");
+        }
+        csv_feed_again(cp); /* the row continues in the next read */
+        break;
+      }
+      if (field) {
+        print_row(field, nfield);
+      }
+      p += n;
+    }
+  }
+
+  free(buf);
+  csv_close(cp);
+}
+
+int main(int argc, char *argv[]) {
+  parse_cmdline(argc, argv);
+  FILE *fp = stdin;
+
+  if (fname && !(fp = fopen(fname, "r"))) {
+    perr("ERROR: fopen %s - %s\n", fname, strerror(errno));
+    exit(1);
+  }
+
+  do_grep(fp);
+
+  fclose(fp);
+  return 0;
+}
@@ -0,0 +1,344 @@
+/*
+  CSVC99 - SIMD-accelerated csv parser in C99
+  Copyright (c) 2019-2020 CK Tan
+  cktanx@gmail.com
+
+  CSVC99 can be used for free under the GNU General Public License
+  version 3, where anything released into public must be open source,
+  or under a commercial license. The commercial license does not
+  cover derived or ported versions created by third parties under
+  GPL. To inquire about commercial license, please send email to
+  cktanx@gmail.com.
+*/
+
+const char *usagestr = "\n\
+  USAGE: %s [-h] [-k every] [-o ixfile] [-r row [-c count]] [-d delim] \n\
+            [-q quote] [-e esc] [-n nullstr] FILE\n\
+                        \n\
+  Write an index of FILE to FILE.idx, with the byte offset of row 1  \n\
+  and of every k-th row after it, and the size and mtime of FILE. A  \n\
+  changed FILE needs a new index.                                    \n\
+                        \n\
+  With -r, print the rows of FILE from row on instead, reading FILE  \n\
+  from the nearest indexed row. Rows keep the delim, quote and escape \n\
+  chars of FILE.        \n\
+                        \n\
+  OPTIONS:              \n\
+                        \n\
+      -h         : print this message          \n\
+      -k every   : index every k-th row; default 4096          \n\
+      -o ixfile  : specify the index file; default FILE.idx     \n\
+      -r row     : print the rows from row on, numbered from 1  \n\
+      -c count   : with -r, print at most count rows            \n\
+      -d delim   : specify delim char; default to comma              \n\
+      -q quote   : specify quote char; default to double-quote       \n\
+      -e esc     : specify escape char; default to the quote char    \n\
+      -n nullstr : specify string representing null; default to \"\" \n\
+      \n\
+";
+
+#define _GNU_SOURCE
+#include "csv.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const char *pname = 0;
+const char *fname = 0;
+char *ixname = 0;
+int qte = '"';
+int esc = 0;
+int delim = ',';
+char nullstr[20] = {0};
+int every = 4096;
+int64_t fromrow = 0; /* print from this row on; 0 to write the index */
+int64_t count = -1;  /* num rows to print; -1 for all */
+
+#define perr(M, ...) fprintf(stderr, M, ##__VA_ARGS__)
+#define pout(M, ...) fprintf(stdout, M, ##__VA_ARGS__)
+#define fatal(M, ...)                                                          \
+  do {                                                                         \
+    fprintf(stderr, M, ##__VA_ARGS__);                                         \
+    exit(1);                                                                   \
+  } while (0)
+
+void usage(int exitcode, const char *msg) {
+  perr(usagestr, pname);
+  if (msg) {
+    perr("\n%s\n", msg);
+  }
+  exit(exitcode);
+}
+
+void parse_cmdline(int argc, char *const *argv) {
+  pname = argv[0];
+  int opt;
+  char *q, *e, *d, *n, *k, *r, *c;
+  q = e = d = n = k = r = c = 0;
+  while ((opt = getopt(argc, argv, "k:o:r:c:d:q:e:n:h")) != -1) {
+    switch (opt) {
+    case 'k':
+      k = optarg;
+      break;
+    case 'o':
+      ixname = optarg;
+      break;
+    case 'r':
+      r = optarg;
+      break;
+    case 'c':
+      c = optarg;
+      break;
+    case 'd':
+      d = optarg;
+      break;
+    case 'q':
+      q = optarg;
+      break;
+    case 'e':
+      e = optarg;
+      break;
+    case 'n':
+      n = optarg;
+      break;
+    case 'h':
+      usage(0, 0);
+      break;
+    default:
+      usage(1, 0);
+      break;
+    }
+  }
+
+  /* fname */
+  if (optind + 1 != argc)
+    usage(1, "Error: please supply one filename");
+  fname = argv[optind];
+
+  /* ixname */
+  if (!ixname) {
+    if (!(ixname = malloc(strlen(fname) + 5))) {
+      fatal("ERROR: out of memory\n");
+    }
+    sprintf(ixname, "%s.idx", fname);
+  }
+
+  /* every */
+  if (k) {
+    every = strtol(k, 0, 0);
+    if (every < 1) {
+      usage(1, "Error: -k every expects a number from 1.");
+    }
+  }
+
+  /* fromrow and count */
+  if (r) {
+    fromrow = strtoll(r, 0, 0);
+    if (fromrow < 1) {
+      usage(1, "Error: -r row expects a row number from 1.");
+    }
+  }
+  if (c) {
+    if (!r) {
+      usage(1, "Error: -c count goes with -r row.");
+    }
+    count = strtoll(c, 0, 0);
+    if (count < 0) {
+      usage(1, "Error: -c count expects a number from 0.");
+    }
+  }
+
+  /* qte */
+  if (q) {
+    if (strlen(q) != 1) {
+      usage(1, "Error: -q quote-char expects a single char.");
+    }
+    qte = q[0];
+  }
+
+  /* esc */
+  esc = qte;
+  if (e) {
+    if (strlen(e) != 1) {
+      usage(1, "Error: -e escape-char expects a single char.");
+    }
+    esc = e[0];
+  }
+
+  /* delim */
+  if (d) {
+    if (strlen(d) != 1) {
+      usage(1, "Error: -d delim-char expects a single char.");
+    }
+    delim = d[0];
+  }
+
+  /* nullstr */
+  if (n) {
+    if (strlen(n) >= 20) {
+      usage(1, "Error: -n nullstr is too long. max is 19 chars");
+    }
+    strcpy(nullstr, n);
+  }
+}
+
+void print_special(const char *s) {
+  putchar(qte);
+  for (; *s; s++) {
+    if (*s == qte || *s == esc) {
+      putchar(esc);
+    }
+    putchar(*s);
+  }
+  putchar(qte);
+}
+
+void print_row(char **field, int nfield) {
+  const char special[] = {qte, esc, delim, '\r', '\n', 0};
+  for (int i = 0; i < nfield; i++) {
+    const char *s = field[i];
+    if (i) {
+      putchar(delim);
+    }
+    if (!s) {
+      fputs(nullstr, stdout);
+    } else if (!*s || strpbrk(s, special) || 0 == strcmp(s, nullstr)) {
+      /* quoted, so it does not read back as a NULL or as many fields */
+      print_special(s);
+    } else {
+      fputs(s, stdout);
+    }
+  }
+  putchar('\n');
+}
+
+void do_error(intptr_t handle, int errtype, const char *errmsg,
+              csv_parse_t *cp) {
+  (void)handle;
+  (void)errtype;
+  errmsg = cp ? csv_errmsg(cp) : errmsg;
+  fatal("ERROR: %s\n", errmsg);
+}
+
+/* print the rows from fromrow on, with fp at the start of row rownum */
+void do_print(FILE *fp, csv_parse_t *cp, int64_t rownum) {
+  int bufsz = 1024 * 1024;
+  char *buf = malloc(bufsz);
+  char *p = buf;
+  char *q = buf;
+  int eof = 0;
+  if (!buf) {
+    fatal("ERROR: out of memory\n");
+  }
+
+  while (count && (!eof || p < q)) {
+    // shift forward
+    if (p != buf) {
+      memmove(buf, p, q - p);
+      q = buf + (q - p);
+      p = buf;
+    }
+
+    // expand
+    if (q - p == bufsz) {
+      if (bufsz >= 1024 * 1024 * 128) {
+        fatal("ERROR: row bigger than 128MB\n");
+      }
+      char *tmp;
+      if (!(tmp = realloc(buf, bufsz * 2))) {
+        fatal("ERROR: out of memory\n");
+      }
+      q = tmp + (q - p);
+      p = buf = tmp;
+      bufsz *= 2;
+    }
+
+    // fill
+    if (!eof) {
+      int n = fread(q, 1, bufsz - (q - p), fp);
+      if (n < 0 || ferror(fp)) {
+        perror("fread");
+        exit(1);
+      }
+      eof = (n == 0);
+      q += n;
+    }
+
+    // the rows in p..q; the parser numbers them on from the index
+    while (count && p < q) {
+      char **field;
+      int nfield;
+      int n = csv_feed(cp, p, q - p, &field, &nfield);
+      if (n == 0 && eof) {
+        n = csv_feed_last(cp, p, q - p, &field, &nfield);
+        if (n == 0) {
+          fatal("ERROR: extra data after last row\n");
+        }
+      }
+      if (n < 0) {
+        fatal("ERROR: row %d: %s\n", csv_errrownum(cp), csv_errmsg(cp));
+      }
+      if (n == 0) {
+        csv_feed_again(cp); /* the row continues in the next read */
+        break;
+      }
+      if (rownum++ >= fromrow) {
+        print_row(field, nfield);
+        count--;
+      }
+      p += n;
+    }
+  }
+
+  free(buf);
+}
+
+int main(int argc, char *argv[]) {
+  parse_cmdline(argc, argv);
+
+  if (!fromrow) {
+    if (csv_index_build(fname, ixname, every, 0, qte, esc, delim, do_error)) {
+      exit(1);
+    }
+    return 0;
+  }
+
+  const char *errmsg;
+  csv_index_t *ix = csv_index_open(ixname, fname, &errmsg);
+  if (!ix) {
+    fatal("ERROR: %s: %s\n", ixname, errmsg);
+  }
+  if (fromrow > csv_index_nrow(ix)) {
+    csv_index_close(ix);
+    return 0; /* past the last row */
+  }
+
+  csv_parse_t *cp = csv_open(qte, esc, delim, nullstr);
+  if (!cp) {
+    fatal("ERROR: csv_open failed\n");
+  }
+  int64_t rownum;
+  int64_t off = csv_seek_row(cp, ix, fromrow, &rownum);
+  if (off < 0) {
+    fatal("ERROR: %s\n", csv_errmsg(cp));
+  }
+
+  FILE *fp = fopen(fname, "r");
+  if (!fp) {
+    perr("ERROR: fopen %s - %s\n", fname, strerror(errno));
+    exit(1);
+  }
+  if (fseeko(fp, off, SEEK_SET)) {
+    perr("ERROR: fseeko %s - %s\n", fname, strerror(errno));
+    exit(1);
+  }
+
+  do_print(fp, cp, rownum);
+
+  fclose(fp);
+  csv_close(cp);
+  csv_index_close(ix);
+  return 0;
+}
@@ -0,0 +1,295 @@
+/*
+  CSVC99 - SIMD-accelerated csv parser in C99
+  Copyright (c) 2019-2020 CK Tan
+  cktanx@gmail.com
+
+  CSVC99 can be used for free under the GNU General Public License
+  version 3, where anything released into public must be open source,
+  or under a commercial license. The commercial license does not
+  cover derived or ported versions created by third parties under
+  GPL. To inquire about commercial license, please send email to
+  cktanx@gmail.com.
+*/
+
+const char *usagestr = "\n\
+  USAGE: %s [-h] [-v] [-c count] [-d delim] [-q quote] [-e esc] [FILE]\n\
+                        \n\
+  Measure the latency of parsing single csv messages, the way a   \n\
+  message bus consumer would: each message sits in its own buffer \n\
+  of exactly its size, with no trailing newline, and is parsed    \n\
+  with one call to csv_feed_last. Prints the percentiles of the   \n\
+  time per message.                                               \n\
+                        \n\
+  The messages are the lines of FILE, or if no FILE is given,     \n\
+  random rows of 50 to 200 bytes.                                 \n\
+                        \n\
+  OPTIONS:              \n\
+                        \n\
+      -h         : print this message          \n\
+      -v         : parse with csv_feed_view_last instead          \n\
+      -c count   : number of messages to parse; default 1000000   \n\
+      -d delim   : specify delim char; default to comma           \n\
+      -q quote   : specify quote char; default to double-quote    \n\
+      -e esc     : specify escape char; default to the quote char \n\
+      \n\
+";
+
+#define _GNU_SOURCE
+#include "csv.h"
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+const char *pname = 0;
+const char *fname = 0;
+int qte = '"';
+int esc = '"';
+int delim = ',';
+int count = 1000000;
+int useview = 0;
+
+#define perr(M, ...) fprintf(stderr, M, ##__VA_ARGS__)
+#define pout(M, ...) fprintf(stdout, M, ##__VA_ARGS__)
+#define fatal(M, ...)                                                          \
+  do {                                                                         \
+    fprintf(stderr, M, ##__VA_ARGS__);                                         \
+    exit(1);                                                                   \
+  } while (0)
+
+/* number of distinct messages; each one is used count / NMSG times */
+#define NMSG 4096
+
+typedef struct msg_t msg_t;
+struct msg_t {
+  char *buf; /* parsed in place, so it is restored from src each time */
+  char *src;
+  int len;
+};
+
+msg_t msg[NMSG];
+int nmsg = 0;
+
+void usage(int exitcode, const char *msg) {
+  perr(usagestr, pname);
+  if (msg) {
+    perr("\n%s\n", msg);
+  }
+  exit(exitcode);
+}
+
+void parse_cmdline(int argc, char *const *argv) {
+  pname = argv[0];
+  int opt;
+  char *q, *e, *d;
+  q = e = d = 0;
+  while ((opt = getopt(argc, argv, "c:d:q:e:vh")) != -1) {
+    switch (opt) {
+    case 'c':
+      count = strtol(optarg, 0, 0);
+      if (count <= 0) {
+        usage(1, "Error: -c count expects a +ve integer.");
+      }
+      break;
+    case 'd':
+      d = optarg;
+      break;
+    case 'q':
+      q = optarg;
+      break;
+    case 'e':
+      e = optarg;
+      break;
+    case 'v':
+      useview = 1;
+      break;
+    case 'h':
+      usage(0, 0);
+      break;
+    default:
+      usage(1, 0);
+      break;
+    }
+  }
+
+  /* fname */
+  if (optind == argc)
+    ; /* make up the messages */
+  else if (optind + 1 == argc)
+    fname = argv[optind];
+  else
+    usage(1, "Error: please supply only one filename");
+
+  /* qte */
+  if (q) {
+    if (strlen(q) != 1) {
+      usage(1, "Error: -q quote-char expects a single char.");
+    }
+    qte = q[0];
+  }
+
+  /* esc */
+  if (e) {
+    if (strlen(e) != 1) {
+      usage(1, "Error: -e escape-char expects a single char.");
+    }
+    esc = e[0];
+  }
+
+  /* delim */
+  if (d) {
+    if (strlen(d) != 1) {
+      usage(1, "Error: -d delim-char expects a single char.");
+    }
+    delim = d[0];
+  }
+}
+
+/* keep a copy of s[0..len) in a buffer of its own */
+static void addmsg(const char *s, int len) {
+  char *p = malloc(len);
+  char *src = malloc(len);
+  if (!p || !src) {
+    fatal("out of memory\n");
+  }
+  memcpy(src, s, len);
+  msg[nmsg].buf = p;
+  msg[nmsg].src = src;
+  msg[nmsg].len = len;
+  nmsg++;
+}
+
+static void read_msgs(void) {
+  FILE *fp = fopen(fname, "r");
+  if (!fp) {
+    perror("fopen");
+    exit(1);
+  }
+  char *line = 0;
+  size_t linesz = 0;
+  ssize_t n;
+  while (nmsg < NMSG && (n = getline(&line, &linesz, fp)) > 0) {
+    while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) {
+      n--;
+    }
+    if (n > 0) {
+      addmsg(line, n);
+    }
+  }
+  free(line);
+  fclose(fp);
+  if (nmsg == 0) {
+    fatal("%s: no messages\n", fname);
+  }
+}
+
+/* random rows of 50..200 bytes: words, numbers and some quoted text */
+static void make_msgs(void) {
+  char row[256];
+  srand(1);
+  for (int i = 0; i < NMSG; i++) {
+    int want = 50 + rand() % 151;
+    int n = 0;
+    while (n < want) {
+      if (n > 0) {
+        row[n++] = delim;
+      }
+      int k = 1 + rand() % 12;
+      int quote = (rand() % 4 == 0);
+      if (quote) {
+        row[n++] = qte;
+      }
+      for (int j = 0; j < k && n < want; j++) {
+        if (quote && rand() % 8 == 0) {
+          row[n++] = esc;
+          row[n++] = qte;
+        } else {
+          row[n++] = quote ? "ab ,c"[rand() % 5] : 'a' + rand() % 26;
+        }
+      }
+      if (quote) {
+        row[n++] = qte;
+      }
+    }
+    addmsg(row, n);
+  }
+}
+
+static int64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* parse one message; returns #fields */
+static int parse1(csv_parse_t *cp, msg_t *m) {
+  int nfield, n;
+  if (useview) {
+    const csv_view_t *view;
+    n = csv_feed_view_last(cp, m->buf, m->len, &view, &nfield);
+  } else {
+    char **field;
+    n = csv_feed_last(cp, m->buf, m->len, &field, &nfield);
+  }
+  if (n != m->len) {
+    fatal("cannot parse message: %.*s\n", m->len, m->buf);
+  }
+  return nfield;
+}
+
+int main(int argc, char *argv[]) {
+  parse_cmdline(argc, argv);
+  if (fname) {
+    read_msgs();
+  } else {
+    make_msgs();
+  }
+
+  int64_t *lat = malloc(count * sizeof(*lat));
+  if (!lat) {
+    fatal("out of memory\n");
+  }
+  csv_parse_t *cp = csv_open(qte, esc, delim, 0);
+  if (!cp) {
+    fatal("csv_open failed\n");
+  }
+
+  /* warm up the caches and cp */
+  int64_t nfield = 0;
+  for (int i = 0; i < nmsg; i++) {
+    memcpy(msg[i].buf, msg[i].src, msg[i].len);
+    nfield += parse1(cp, &msg[i]);
+  }
+
+  int64_t nbyte = 0;
+  for (int i = 0; i < count; i++) {
+    msg_t *m = &msg[i % nmsg];
+    memcpy(m->buf, m->src, m->len);
+    int64_t t0 = now_ns();
+    nfield += parse1(cp, m);
+    lat[i] = now_ns() - t0;
+    nbyte += m->len;
+  }
+
+  qsort(lat, count, sizeof(*lat), cmp64);
+  pout("kernel %s, %d messages, %.1f bytes avg, %s\n", csv_kernel(cp), count,
+       (double)nbyte / count, useview ? "views" : "fields");
+  pout("p50 %" PRId64 " ns, p90 %" PRId64 " ns, p99 %" PRId64
+       " ns, p99.9 %" PRId64 " ns, max %" PRId64 " ns\n",
+       lat[count / 2], lat[(int64_t)count * 90 / 100],
+       lat[(int64_t)count * 99 / 100], lat[(int64_t)count * 999 / 1000],
+       lat[count - 1]);
+
+  csv_close(cp);
+  free(lat);
+  return nfield < 0;
+}
@@ -127,9 +127,9 @@ void parse_cmdline(int argc, char *const *argv) {
   }
 }
 
-void print_special(char *s) {
+void print_special(const char *s, int len) {
   putchar('"');
-  for (; *s; s++) {
+  for (const char *q = s + len; s < q; s++) {
     if (*s == '"') {
       putchar('"');
     }
@@ -138,23 +138,31 @@ void print_special(char *s) {
   putchar('"');
 }
 
-int do_read(intptr_t handle, char *buf, int bufsz) {
-  FILE *fp = (FILE *)handle;
-  return fread(buf, 1, bufsz, fp);
-}
+/* scratch space for quoted values */
+char *scratch = 0;
+int scratchsz = 0;
 
-int do_row(intptr_t handle, int64_t rownum, char **col, int ncol) {
+int do_view(intptr_t handle, csv_parse_t *cp, int64_t rownum,
+            const csv_view_t *view, int nview) {
   (void)handle;
   (void)rownum;
-  for (int i = 0; i < ncol; i++) {
-    char *s = col[i];
+  for (int i = 0; i < nview; i++) {
+    if (view[i].len > scratchsz) {
+      scratchsz = view[i].len * 2;
+      if (!(scratch = realloc(scratch, scratchsz))) {
+        fatal("ERROR: out of memory\n");
+      }
+    }
+    const char *s;
+    int len = csv_view_get(cp, &view[i], scratch, scratchsz, &s);
     printf("%s", i ? "," : "");
     if (s) {
       /* search for dquote, comma, newline, or empty string */
-      if (strpbrk(s, "\",\r\n") || *s == 0) {
-        print_special(s);
+      if (len == 0 || memchr(s, '"', len) || memchr(s, ',', len) ||
+          memchr(s, '\r', len) || memchr(s, '\n', len)) {
+        print_special(s, len);
       } else {
-        printf("%s", s);
+        fwrite(s, 1, len, stdout);
       }
     } else {
       printf("NULL");
@@ -175,17 +183,12 @@ void do_error(intptr_t handle, int errtype, const char *errmsg,
 
 int main(int argc, char *argv[]) {
   parse_cmdline(argc, argv);
-  FILE *fp = stdin;
-  if (fname) {
-    if (0 == (fp = fopen(fname, "r"))) {
-      fprintf(stderr, "fopen(%s): %s", fname, strerror(errno));
-      exit(1);
-    }
-  }
-
-  csv_scan((intptr_t)fp, qte, esc, delim, nullstr, do_read, do_row, do_error);
 
-  fclose(fp);
+  if (csv_scan_file(fname ? fname : "/dev/stdin", 0, 0, qte, esc, delim,
+                    nullstr, do_view, do_error)) {
+    exit(1);
+  }
 
+  free(scratch);
   return 0;
 }
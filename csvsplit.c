@@ -13,10 +13,16 @@
 #define _GNU_SOURCE
 #include "csv.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 const char *g_pname = 0;
@@ -24,6 +30,7 @@ const char *g_prefix = "x";
 int g_part = 0;
 int64_t g_nbyte = 0;
 int64_t g_nrec = 0;
+int g_nthread = 0;
 
 #define perr(M, ...) fprintf(stderr, M, ##__VA_ARGS__)
 #define pout(M, ...) fprintf(stdout, M, ##__VA_ARGS__)
@@ -38,40 +45,164 @@ static void outofmemory() {
   exit(1);
 }
 
-static void prow(char *ptr, int len) {
-  static FILE *fp = 0;
-  static int64_t nb = 0;
-  static int64_t nr = 0;
+static int open_part(int part) {
+  char fname[PATH_MAX];
+  snprintf(fname, sizeof(fname), "%s0%d", g_prefix, part);
+  int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    perror("open");
+    fatal("ERROR: ... while trying to create output file\n");
+  }
+  return fd;
+}
 
-  if (fp && ((g_nbyte > 0 && nb + len > g_nbyte) || (g_nrec > 0 && nr >= g_nrec))) {
-     fclose(fp);
-     fp = 0;
-     nb = 0;
-     nr = 0;
+static void close_part(int fd) {
+  if (close(fd)) {
+    fatal("ERROR: cannot write to file\n");
   }
+}
 
-  if (!fp) {
-    char fname[100];
-    sprintf(fname, "%s0%d", g_prefix, g_part++);
-    fp = fopen(fname, "w");
-    if (!fp) {
-      perror("fopen");
-      fatal("ERROR: ... while trying to create output file\n");
-      exit(1);
+static void write_all(int fd, const char *p, int64_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, p, len < (1 << 30) ? len : (1 << 30));
+    if (n < 0 && errno == EINTR) {
+      continue;
     }
-    nb = nr = 0;
+    if (n <= 0) {
+      fatal("ERROR: cannot write to file\n");
+    }
+    p += n;
+    len -= n;
   }
+}
 
-  int n = fwrite(ptr, len, 1, fp);
-  if (n != 1) {
-    fatal("ERROR: cannot write to file\n");
+/*
+ * Copy src[off..off+len) to dst without passing the bytes through user
+ * space: by copy_file_range, which may even share the blocks, else by
+ * sendfile. Where neither works, the bytes are written from the map.
+ */
+static void copy_part(int src, const char *map, int64_t off, int64_t len,
+                      int dst) {
+  int how = 0; /* 0: copy_file_range, 1: sendfile, 2: write */
+  while (len > 0) {
+    ssize_t n = -1;
+    if (how == 0) {
+      off64_t in = off;
+      n = copy_file_range(src, &in, dst, 0, len, 0);
+    } else if (how == 1) {
+      off_t in = off;
+      n = sendfile(dst, src, &in, len);
+    } else {
+      write_all(dst, map + off, len);
+      n = len;
+    }
+    if (n < 0) {
+      how += (errno != EINTR);
+      continue;
+    }
+    if (n == 0) {
+      fatal("ERROR: input file was truncated\n");
+    }
+    off += n;
+    len -= n;
+  }
+}
+
+/* the parts of a mapped file, written by many threads */
+typedef struct parts_t parts_t;
+struct parts_t {
+  int src;
+  const char *map;
+  const int64_t *cut; /* cut[i] - where part i ends */
+  int64_t ncut;
+  int64_t next; /* next part to write; taken with __atomic builtins */
+};
+
+static void *write_parts(void *arg) {
+  parts_t *pt = arg;
+  int64_t i;
+  while ((i = __atomic_fetch_add(&pt->next, 1, __ATOMIC_RELAXED)) <
+         pt->ncut) {
+    const int64_t lo = i ? pt->cut[i - 1] : 0;
+    int fd = open_part(i);
+    copy_part(pt->src, pt->map, lo, pt->cut[i] - lo, fd);
+    close_part(fd);
+  }
+  return 0;
+}
+
+/*
+ * Split a regular file. The parts are cut at row ends found by
+ * csv_split from the quotes, in parallel; the rows are never parsed,
+ * as each part is a slice of the file copied as is.
+ */
+static void split_file(int fd, int64_t size) {
+  if (size == 0) {
+    return;
   }
+  char *map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  int64_t *cut;
+  int64_t ncut = csv_split(g_nthread, map, size, '"', '"', g_nbyte, g_nrec,
+                           &cut);
+  if (ncut < 0) {
+    fatal("ERROR: csv_split failed");
+  }
+
+  parts_t pt = {fd, map, cut, ncut, 0};
+  int n = g_nthread < ncut ? g_nthread : ncut;
+  pthread_t tid[n > 0 ? n : 1];
+  int started[n > 0 ? n : 1];
+  for (int i = 1; i < n; i++) {
+    started[i] = (0 == pthread_create(&tid[i], 0, write_parts, &pt));
+  }
+  write_parts(&pt);
+  for (int i = 1; i < n; i++) {
+    if (started[i]) {
+      pthread_join(tid[i], 0);
+    }
+  }
+  g_part = ncut;
 
-  nb += len;
-  nr += 1;
+  free(cut);
+  munmap(map, size);
 }
 
-void do_split(FILE *fp) {
+/* the part being written by split_stream */
+static int g_fd = -1;
+static int64_t g_nb = 0;
+static int64_t g_nr = 0;
+
+/* the row at p of len bytes goes to the current part, or starts a new
+   one; the rows from *w on are not written yet */
+static void prow(char *p, int len, char **w) {
+  if (g_fd >= 0 && ((g_nbyte > 0 && g_nb + len > g_nbyte) ||
+                    (g_nrec > 0 && g_nr >= g_nrec))) {
+    write_all(g_fd, *w, p - *w);
+    close_part(g_fd);
+    *w = p;
+    g_fd = -1;
+  }
+
+  if (g_fd < 0) {
+    g_fd = open_part(g_part++);
+    g_nb = g_nr = 0;
+  }
+
+  g_nb += len;
+  g_nr += 1;
+}
+
+/*
+ * Split a pipe. Rows are cut by csv_line in a big buffer, and the rows
+ * of a part that are in the buffer go out in one write.
+ */
+static void split_stream(int fd) {
   char nullstr[20];
   nullstr[0] = 0;
   csv_parse_t *cp = csv_open('"', '"', ',', nullstr);
@@ -79,22 +210,25 @@ void do_split(FILE *fp) {
     fatal("csv_open failed");
   }
 
-  int bufsz = 1024 * 64;
-  char *buf = calloc(1, bufsz);
+  int bufsz = 1024 * 1024 * 4;
+  char *buf = malloc(bufsz);
   char *p = buf;
   char *q = buf;
+  char *w = buf; /* rows in w..p are not written yet */
+  int eof = 0;
 
   if (!buf) {
     outofmemory();
   }
 
-  while (!feof(fp)) {
+  while (!eof) {
 
-    // shift forward
+    // write out and shift forward
     if (p != buf) {
+      write_all(g_fd, w, p - w);
       memmove(buf, p, q - p);
       q = buf + (q - p);
-      p = buf;
+      p = w = buf;
     }
 
     // expand
@@ -104,20 +238,25 @@ void do_split(FILE *fp) {
       }
       char *tmp;
       int newsz = bufsz * 2;
+      int len = q - p;
       if (!(tmp = realloc(buf, newsz))) {
         outofmemory();
       }
-      buf = tmp;
+      q = tmp + len;
+      p = w = buf = tmp;
       bufsz = newsz;
     }
 
     // fill
-    int avail = bufsz - (q - p);
-    int n = fread(q, 1, avail, fp);
+    ssize_t n = read(fd, q, bufsz - (q - p));
     if (n < 0) {
-      perror("fread");
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("read");
       exit(1);
     }
+    eof = (n == 0);
     q += n;
 
     // parse p..q
@@ -125,15 +264,22 @@ void do_split(FILE *fp) {
       n = csv_line(cp, p, q - p);
       if (n < 0)
         fatal("ERROR: csv_feed failed\n");
-      if (n == 0)
+      if (n == 0) {
+        csv_feed_again(cp); /* the row continues in the next read */
         break;
-      prow(p, n);
+      }
+      prow(p, n, &w);
       p += n;
     }
   }
 
   if (p < q) {
-    prow(p, q - p);
+    prow(p, q - p, &w);
+    p = q;
+  }
+  if (g_fd >= 0) {
+    write_all(g_fd, w, p - w);
+    close_part(g_fd);
   }
 
   free(buf);
@@ -150,6 +296,10 @@ void usage(int exitcode, const char *msg) {
        "record)\n");
   perr("    -r nrecs\n");
   perr("        split into files of at most nrecs records each\n");
+  perr("    -p nthread\n");
+  perr("        find the splits of a regular file and write them with "
+       "nthread\n");
+  perr("        threads; default to one per cpu\n");
   perr("\n");
   perr("%s", msg ? msg : "");
   exit(exitcode);
@@ -159,7 +309,7 @@ int main(int argc, char *argv[]) {
   int opt;
 
   g_pname = argv[0];
-  while ((opt = getopt(argc, argv, "hb:r:")) != -1) {
+  while ((opt = getopt(argc, argv, "hb:r:p:")) != -1) {
     switch (opt) {
     case 'h':
       usage(0, 0);
@@ -178,6 +328,13 @@ int main(int argc, char *argv[]) {
               "ERROR: invalid -r nrecs option. Please supply a +ve integer\n");
       }
       break;
+    case 'p':
+      g_nthread = strtol(optarg, 0, 0);
+      if (g_nthread <= 0 || g_nthread > 256) {
+        usage(1, "ERROR: invalid -p nthread option. Please supply an "
+                 "integer from 1 to 256\n");
+      }
+      break;
     default:
       usage(1, "ERROR: unknown option\n");
       break;
@@ -207,6 +364,18 @@ int main(int argc, char *argv[]) {
     usage(1, "ERROR: unexpected arguments at end of command\n");
   }
 
-  do_split(fp);
+  if (g_nthread == 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    g_nthread = ncpu < 1 ? 1 : ncpu > 256 ? 256 : ncpu;
+  }
+
+  /* a regular file is split from a map; anything else is streamed */
+  int fd = fileno(fp);
+  struct stat st;
+  if (0 == fstat(fd, &st) && S_ISREG(st.st_mode)) {
+    split_file(fd, st.st_size);
+  } else {
+    split_stream(fd);
+  }
   return 0;
 }
@@ -12,28 +12,31 @@
 */
 
 const char *usagestr = "\n\
-  USAGE: %s [-h] [-d delim] [-q quote] [-e esc] [-n nullstr] [FILE]\n\
+  USAGE: %s [-h] [-jH] [-c [-p nthread]] [-d delim] [-q quote] [-e esc] \n\
+            [-n nullstr] [FILE ...]\n\
                         \n\
+  Print the stats of csv files: the number of bytes and rows, the   \n\
+  number of columns and the row sizes, and a profile of each column \n\
+  made in the same pass: the type all of its values convert to, the \n\
+  number of NULLs, the min/max/avg length, the min/max of numeric    \n\
+  values, an estimate of the number of distinct values, and the      \n\
+  quantiles of numeric values within 1%%. The stats of many files are \n\
+  merged into one.      \n\
                         \n\
-  Print a csv file in a format that can be read into a \n\
-  python program and eval() into a python object\n\
-                                           \n\
-  For example, a csv file with these lines:\n\
-    1|2|(null)|3                           \n\
-    \"abcd\"|efg|hij|klm                   \n\
-                                           \n\
-  will be printed as:                      \n\
-                                           \n\
-   [                                       \n\
-     ['1','2',None,'3'],                   \n\
-     ['abcd','efg','hij','klm']            \n\
-   ]                                       \n\
+  With -c, only the bytes and rows are counted. The rows are not    \n\
+  parsed, only their newlines outside quotes are counted, so this is \n\
+  much faster but does not check the input.                         \n\
                         \n\
   OPTIONS:              \n\
                         \n\
       -h         : print this message          \n\
-      -q quote   : specify quote char; default to double-quote           \n\
-      -e esc     : specify escape char; default to the quote char        \n\
+      -j         : print in JSON               \n\
+      -H         : the first row of each file holds the column names \n\
+      -c         : count the rows only      \n\
+      -p nthread : with -c, count each file by nthread threads; default 1 \n\
+      -d delim   : specify delim char; default to comma              \n\
+      -q quote   : specify quote char; default to double-quote       \n\
+      -e esc     : specify escape char; default to the quote char    \n\
       -n nullstr : specify string representing null; default to \"\"     \n\
       \n\
 ";
@@ -41,18 +44,27 @@ const char *usagestr = "\n\
 #define _GNU_SOURCE
 #include "csv.h"
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 const char *pname = 0;
-const char *fname = 0;
+char *const *fname = 0; /* the files; none for stdin */
+int nfname = 0;
 int qte = '"';
 int esc = '"';
 int delim = ',';
 char nullstr[20] = {0};
+int json = 0;
+int header = 0;
+int countonly = 0;
+int nthread = 1;
 
 #define perr(M, ...) fprintf(stderr, M, ##__VA_ARGS__)
 #define pout(M, ...) fprintf(stdout, M, ##__VA_ARGS__)
@@ -73,10 +85,22 @@ void usage(int exitcode, const char *msg) {
 void parse_cmdline(int argc, char *const *argv) {
   pname = argv[0];
   int opt;
-  char *q, *e, *d, *n;
-  q = e = d = n = 0;
-  while ((opt = getopt(argc, argv, "d:q:e:n:h")) != -1) {
+  char *q, *e, *d, *n, *p;
+  q = e = d = n = p = 0;
+  while ((opt = getopt(argc, argv, "jHcp:d:q:e:n:h")) != -1) {
     switch (opt) {
+    case 'c':
+      countonly = 1;
+      break;
+    case 'p':
+      p = optarg;
+      break;
+    case 'j':
+      json = 1;
+      break;
+    case 'H':
+      header = 1;
+      break;
     case 'd':
       d = optarg;
       break;
@@ -99,12 +123,16 @@ void parse_cmdline(int argc, char *const *argv) {
   }
 
   /* fname */
-  if (optind == argc)
-    ; /* read from stdin */
-  else if (optind + 1 == argc)
-    fname = argv[optind];
-  else
-    usage(1, "Error: please supply only one filename");
+  fname = argv + optind;
+  nfname = argc - optind;
+
+  /* nthread */
+  if (p) {
+    nthread = strtol(p, 0, 0);
+    if (nthread < 1 || nthread > 256) {
+      usage(1, "Error: -p nthread expects a number from 1 to 256.");
+    }
+  }
 
   /* qte */
   if (q) {
@@ -139,39 +167,391 @@ void parse_cmdline(int argc, char *const *argv) {
   }
 }
 
-struct {
+/* HyperLogLog of 2^HLL_P registers; its standard error is
+   1.04 / sqrt(2^HLL_P), about 1.6% */
+#define HLL_P 12
+#define HLL_M (1 << HLL_P)
+
+/* DDSketch: quantiles within DDS_ALPHA of the true value, relative.
+   Each store keeps DDS_MAXBIN keys; lower ones are collapsed. */
+#define DDS_ALPHA 0.01
+#define DDS_MAXBIN 2048
+
+typedef struct ddstore_t ddstore_t;
+struct ddstore_t {
+  int lo;        /* key of cnt[0] */
+  int n;         /* num keys in cnt[] */
+  int max;       /* num allocated in cnt[] */
+  uint64_t *cnt; /* cnt[i] - num values of key lo + i */
+};
+
+typedef struct dds_t dds_t;
+struct dds_t {
+  ddstore_t pos; /* keys of the positive values */
+  ddstore_t neg; /* keys of the magnitude of the negative values */
+  uint64_t zero;
+  uint64_t count;
+};
+
+/* the profile of a column; profiles of parts of the data merge into
+   the profile of the whole */
+typedef struct colstat_t colstat_t;
+struct colstat_t {
+  char *name;
+  int64_t nval;  /* num values, NULL included */
+  int64_t nnull; /* num NULL values */
+  int64_t minlen, maxlen, sumlen;
+  int cand;           /* bit 1 << CSV_xx for each type all values convert to */
+  int64_t imin, imax; /* of the values, while CSV_INT64 is in cand */
+  double fmin, fmax;  /* of the finite numeric values */
+  dds_t dds;          /* of the finite numeric values */
+  uint8_t hll[HLL_M];
+};
+
+typedef struct stat_t stat_t;
+struct stat_t {
   int64_t nbytes;
   int64_t nrows;
   int min_ncols, max_ncols;
   int min_rowsz, max_rowsz;
-} tot = {0};
+  int ncol;
+  colstat_t *col;
+  int hdr;  /* the next row holds the column names */
+  FILE *fp; /* read by do_read while scanning */
+};
+
+/* the types a column is inferred to be, by preference */
+static const int types[] = {CSV_INT64, CSV_FLOAT64, CSV_BOOL, CSV_DATE,
+                            CSV_TIMESTAMP};
+static const char *const typename[] = {"string", "int64", "float64",
+                                       "decimal", "bool", "date",
+                                       "timestamp"};
+
+static double dds_lngamma; /* log((1 + DDS_ALPHA) / (1 - DDS_ALPHA)) */
+
+static int dds_key(double x) { return (int)ceil(log(x) / dds_lngamma); }
+
+/* the value that all values of a key are within DDS_ALPHA of */
+static double dds_value(int key) {
+  const double gamma = exp(dds_lngamma);
+  return 2 * exp(key * dds_lngamma) / (gamma + 1);
+}
+
+static void store_add(ddstore_t *s, int key, uint64_t n) {
+  if (s->n == 0) {
+    s->lo = key;
+  } else if (key < s->lo) {
+    /* extend down, but never below DDS_MAXBIN keys under the top */
+    const int top = s->lo + s->n - 1;
+    key = key > top - DDS_MAXBIN + 1 ? key : top - DDS_MAXBIN + 1;
+  }
+  const int lo = key < s->lo ? key : s->lo;
+  const int hi = key > s->lo + s->n - 1 ? key : s->lo + s->n - 1;
+  if (hi - lo + 1 > s->max) {
+    s->max = hi - lo + 1 + 64;
+    if (!(s->cnt = realloc(s->cnt, s->max * sizeof(*s->cnt)))) {
+      fatal("ERROR: out of memory\n");
+    }
+  }
+  if (lo < s->lo && s->n) {
+    memmove(s->cnt + (s->lo - lo), s->cnt, s->n * sizeof(*s->cnt));
+    memset(s->cnt, 0, (s->lo - lo) * sizeof(*s->cnt));
+    s->n += s->lo - lo;
+  }
+  s->lo = lo;
+  if (hi - lo + 1 > s->n) {
+    memset(s->cnt + s->n, 0, (hi - lo + 1 - s->n) * sizeof(*s->cnt));
+    s->n = hi - lo + 1;
+  }
+  if (s->n > DDS_MAXBIN) {
+    /* collapse the lowest keys into the lowest one kept */
+    const int k = s->n - DDS_MAXBIN;
+    for (int i = 0; i < k; i++) {
+      s->cnt[k] += s->cnt[i];
+    }
+    memmove(s->cnt, s->cnt + k, DDS_MAXBIN * sizeof(*s->cnt));
+    s->n = DDS_MAXBIN;
+    s->lo += k;
+  }
+  s->cnt[(key > s->lo ? key : s->lo) - s->lo] += n;
+}
+
+static void dds_add(dds_t *d, double x) {
+  if (x > 0) {
+    store_add(&d->pos, dds_key(x), 1);
+  } else if (x < 0) {
+    store_add(&d->neg, dds_key(-x), 1);
+  } else {
+    d->zero++;
+  }
+  d->count++;
+}
+
+static void dds_merge(dds_t *d, const dds_t *o) {
+  for (int i = 0; i < o->pos.n; i++) {
+    if (o->pos.cnt[i]) {
+      store_add(&d->pos, o->pos.lo + i, o->pos.cnt[i]);
+    }
+  }
+  for (int i = 0; i < o->neg.n; i++) {
+    if (o->neg.cnt[i]) {
+      store_add(&d->neg, o->neg.lo + i, o->neg.cnt[i]);
+    }
+  }
+  d->zero += o->zero;
+  d->count += o->count;
+}
+
+/* the q-quantile, 0 <= q <= 1, of a sketch with count > 0 */
+static double dds_quantile(const dds_t *d, double q) {
+  const uint64_t rank = q * (d->count - 1);
+  uint64_t n = 0;
+  for (int i = d->neg.n - 1; i >= 0; i--) {
+    if ((n += d->neg.cnt[i]) > rank) {
+      return -dds_value(d->neg.lo + i);
+    }
+  }
+  if ((n += d->zero) > rank) {
+    return 0;
+  }
+  for (int i = 0; i < d->pos.n; i++) {
+    if ((n += d->pos.cnt[i]) > rank) {
+      return dds_value(d->pos.lo + i);
+    }
+  }
+  return dds_value(d->pos.lo + d->pos.n - 1);
+}
+
+/* the q-quantile of the values of x, which are never out of their
+   min..max */
+static double colstat_quantile(const colstat_t *x, double q) {
+  const double v = dds_quantile(&x->dds, q);
+  return v < x->fmin ? x->fmin : v > x->fmax ? x->fmax : v;
+}
+
+static uint64_t hash64(const char *p, int n) {
+  uint64_t h = 0x9e3779b97f4a7c15ull ^ n;
+  uint64_t w;
+  for (; n >= 8; n -= 8, p += 8) {
+    memcpy(&w, p, 8);
+    h = (h ^ w) * 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 31;
+  }
+  w = 0;
+  memcpy(&w, p, n);
+  h = (h ^ w) * 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  return h ^ h >> 33;
+}
+
+static void hll_add(uint8_t *reg, uint64_t h) {
+  /* the top bits pick the register; the rest give the rank of the
+     first 1 bit, which a sentinel bounds */
+  const int i = h >> (64 - HLL_P);
+  const int rank = __builtin_clzll(h << HLL_P | 1ull << (HLL_P - 1)) + 1;
+  reg[i] = rank > reg[i] ? rank : reg[i];
+}
+
+static double hll_estimate(const uint8_t *reg) {
+  const double m = HLL_M;
+  double sum = 0;
+  int zeros = 0;
+  for (int i = 0; i < HLL_M; i++) {
+    sum += ldexp(1, -reg[i]);
+    zeros += !reg[i];
+  }
+  double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  if (e <= 2.5 * m && zeros) {
+    e = m * log(m / zeros); /* linear counting for small sets */
+  }
+  return e;
+}
+
+static void colstat_init(colstat_t *x) {
+  memset(x, 0, sizeof(*x));
+  for (int i = 0; i < (int)(sizeof(types) / sizeof(types[0])); i++) {
+    x->cand |= 1 << types[i];
+  }
+  x->imin = INT64_MAX;
+  x->imax = INT64_MIN;
+  x->fmin = INFINITY;
+  x->fmax = -INFINITY;
+}
+
+static void colstat_free(colstat_t *x) {
+  free(x->name);
+  free(x->dds.pos.cnt);
+  free(x->dds.neg.cnt);
+}
+
+/* add the value s[0..len), or a NULL if len < 0 */
+static void colstat_add(colstat_t *x, const char *s, int len) {
+  x->nval++;
+  if (len < 0) {
+    x->nnull++;
+    return;
+  }
+  x->minlen = (x->nval - x->nnull == 1 || len < x->minlen) ? len : x->minlen;
+  x->maxlen = len > x->maxlen ? len : x->maxlen;
+  x->sumlen += len;
+  hll_add(x->hll, hash64(s, len));
+
+  /* drop the types this value does not convert to; numbers go to the
+     sketch */
+  double d;
+  int64_t i;
+  if ((x->cand & 1 << CSV_INT64) &&
+      0 == csv_parse_value(CSV_INT64, 0, s, len, &i)) {
+    x->imin = i < x->imin ? i : x->imin;
+    x->imax = i > x->imax ? i : x->imax;
+    d = i;
+  } else {
+    x->cand &= ~(1 << CSV_INT64);
+    if (!(x->cand & 1 << CSV_FLOAT64) ||
+        csv_parse_value(CSV_FLOAT64, 0, s, len, &d)) {
+      x->cand &= ~(1 << CSV_FLOAT64);
+      d = NAN;
+    }
+  }
+  if (isfinite(d)) {
+    x->fmin = d < x->fmin ? d : x->fmin;
+    x->fmax = d > x->fmax ? d : x->fmax;
+    dds_add(&x->dds, d);
+  }
+  for (int t = CSV_BOOL; t <= CSV_TIMESTAMP; t++) {
+    if (x->cand & 1 << t) {
+      int64_t tmp;
+      if (csv_parse_value(t, 0, s, len, &tmp)) {
+        x->cand &= ~(1 << t);
+      }
+    }
+  }
+}
+
+static void colstat_merge(colstat_t *x, const colstat_t *o) {
+  if (o->nval - o->nnull) {
+    const int first = (x->nval - x->nnull == 0);
+    x->minlen = (first || o->minlen < x->minlen) ? o->minlen : x->minlen;
+    x->maxlen = o->maxlen > x->maxlen ? o->maxlen : x->maxlen;
+  }
+  if (!x->name && o->name) {
+    x->name = strdup(o->name);
+  }
+  x->nval += o->nval;
+  x->nnull += o->nnull;
+  x->sumlen += o->sumlen;
+  x->cand &= o->cand;
+  x->imin = o->imin < x->imin ? o->imin : x->imin;
+  x->imax = o->imax > x->imax ? o->imax : x->imax;
+  x->fmin = o->fmin < x->fmin ? o->fmin : x->fmin;
+  x->fmax = o->fmax > x->fmax ? o->fmax : x->fmax;
+  dds_merge(&x->dds, &o->dds);
+  for (int i = 0; i < HLL_M; i++) {
+    x->hll[i] = o->hll[i] > x->hll[i] ? o->hll[i] : x->hll[i];
+  }
+}
+
+/* the type of a column: the first of types[] that all its values
+   convert to, or CSV_STRING. -1 if it has no values but NULLs. */
+static int colstat_type(const colstat_t *x) {
+  if (x->nval == x->nnull) {
+    return -1;
+  }
+  for (int i = 0; i < (int)(sizeof(types) / sizeof(types[0])); i++) {
+    if (x->cand & 1 << types[i]) {
+      return types[i];
+    }
+  }
+  return CSV_STRING;
+}
+
+/* make sure st has ncol columns */
+static void stat_reserve(stat_t *st, int ncol) {
+  if (ncol > st->ncol) {
+    if (!(st->col = realloc(st->col, ncol * sizeof(*st->col)))) {
+      fatal("ERROR: out of memory\n");
+    }
+    for (int c = st->ncol; c < ncol; c++) {
+      colstat_init(&st->col[c]);
+    }
+    st->ncol = ncol;
+  }
+}
+
+static void stat_merge(stat_t *st, const stat_t *o) {
+  if (o->nrows) {
+    const int first = (st->nrows == 0);
+    st->min_ncols = (first || o->min_ncols < st->min_ncols) ? o->min_ncols
+                                                             : st->min_ncols;
+    st->max_ncols = o->max_ncols > st->max_ncols ? o->max_ncols : st->max_ncols;
+    st->min_rowsz = (first || o->min_rowsz < st->min_rowsz) ? o->min_rowsz
+                                                             : st->min_rowsz;
+    st->max_rowsz = o->max_rowsz > st->max_rowsz ? o->max_rowsz : st->max_rowsz;
+  }
+  st->nbytes += o->nbytes;
+  st->nrows += o->nrows;
+  stat_reserve(st, o->ncol);
+  for (int c = 0; c < o->ncol; c++) {
+    colstat_merge(&st->col[c], &o->col[c]);
+  }
+}
+
+static void stat_free(stat_t *st) {
+  for (int c = 0; c < st->ncol; c++) {
+    colstat_free(&st->col[c]);
+  }
+  free(st->col);
+}
 
 int do_read(intptr_t handle, char *buf, int bufsz) {
-  FILE *fp = (FILE *)handle;
-  int nb = fread(buf, 1, bufsz, fp);
+  stat_t *st = (stat_t *)handle;
+  int nb = fread(buf, 1, bufsz, st->fp);
   if (nb > 0)
-    tot.nbytes += nb;
+    st->nbytes += nb;
   return nb;
 }
 
-int do_row(intptr_t handle, int64_t rownum, char **col, int ncol) {
-  (void)handle;
-  (void)col;
-  char *last = col[ncol - 1];
-  int rowsz = last + strlen(last) - col[0] + 1;
-
-  tot.nrows = rownum;
+int do_rows(intptr_t handle, const csv_batch_t *b) {
+  stat_t *st = (stat_t *)handle;
+  for (int r = 0; r < b->nrow; r++) {
+    const int j0 = b->row[r];
+    const int ncol = b->row[r + 1] - j0;
+    if (ncol <= 0) {
+      continue;
+    }
+    stat_reserve(st, ncol);
 
-  if (tot.min_ncols == 0 || ncol < tot.min_ncols)
-    tot.min_ncols = ncol;
-  if (tot.max_ncols < ncol)
-    tot.max_ncols = ncol;
+    if (st->hdr) {
+      st->hdr = 0;
+      for (int c = 0; c < ncol; c++) {
+        const int len = b->len[j0 + c];
+        st->col[c].name = strndup(b->buf + b->off[j0 + c], len > 0 ? len : 0);
+      }
+      continue;
+    }
 
-  if (tot.min_rowsz == 0 || rowsz < tot.min_rowsz)
-    tot.min_rowsz = rowsz;
-  if (tot.max_rowsz < rowsz)
-    tot.max_rowsz = rowsz;
+    /* from the first field to the end of the last, and a newline */
+    const int j1 = j0 + ncol - 1;
+    const int rowsz =
+        b->off[j1] + (b->len[j1] > 0 ? b->len[j1] : 0) - b->off[j0] + 1;
+    const int first = (st->nrows++ == 0);
+    if (first || ncol < st->min_ncols)
+      st->min_ncols = ncol;
+    if (st->max_ncols < ncol)
+      st->max_ncols = ncol;
+    if (first || rowsz < st->min_rowsz)
+      st->min_rowsz = rowsz;
+    if (st->max_rowsz < rowsz)
+      st->max_rowsz = rowsz;
 
+    for (int c = 0; c < ncol; c++) {
+      const int j = j0 + c;
+      colstat_add(&st->col[c], b->buf + b->off[j], b->len[j]);
+    }
+  }
   return 0;
 }
 
@@ -180,33 +560,208 @@ void do_error(intptr_t handle, int errtype, const char *errmsg,
   (void)handle;
   (void)errtype;
   errmsg = cp ? csv_errmsg(cp) : errmsg;
-  fatal("ERROR: %s\n", csv_errmsg(cp));
+  fatal("ERROR: %s\n", errmsg);
 }
 
-int main(int argc, char *argv[]) {
-  parse_cmdline(argc, argv);
-  FILE *fp = stdin;
+/* scan one file into a stat_t of its own */
+static void stat_file(stat_t *total, const char *path) {
+  stat_t st = {0};
+  st.hdr = header;
+  st.fp = stdin;
+
+  if (path && !(st.fp = fopen(path, "r"))) {
+    perr("ERROR: fopen %s - %s\n", path, strerror(errno));
+    exit(1);
+  }
+  /* read ahead in a thread so fread overlaps with parsing */
+  csv_scanopt_t opt = {0};
+  opt.nreadahead = 4;
+  if (csv_scan_batch_ex(&opt, (intptr_t)&st, qte, esc, delim, nullstr,
+                        do_read, do_rows, do_error)) {
+    exit(1);
+  }
+  if (path) {
+    fclose(st.fp);
+  }
+  stat_merge(total, &st);
+  stat_free(&st);
+}
 
-  if (fname && !(fp = fopen(fname, "r"))) {
-    perr("ERROR: fopen %s - %s\n", fname, strerror(errno));
+/* count the bytes and rows of one file into total, without parsing.
+   A regular file is mapped and counted in one go by nthread threads;
+   anything else is read and counted a block at a time. */
+static void count_file(stat_t *total, const char *path) {
+  int fd = 0;
+  if (path && (fd = open(path, O_RDONLY)) < 0) {
+    perr("ERROR: open %s - %s\n", path, strerror(errno));
     exit(1);
   }
 
-  csv_scan((intptr_t)fp, qte, esc, delim, nullstr, do_read, do_row, do_error);
+  csv_count_t cnt = {0};
+  struct stat st;
+  char *map = MAP_FAILED;
+  if (0 == fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+    map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  if (map != MAP_FAILED) {
+    madvise(map, st.st_size, MADV_WILLNEED);
+    csv_count_rows(&cnt, nthread, map, st.st_size, qte, esc, 1);
+    munmap(map, st.st_size);
+    total->nbytes += st.st_size;
+  } else {
+    static char buf[1024 * 1024];
+    ssize_t nb;
+    do {
+      while ((nb = read(fd, buf, sizeof(buf))) < 0 && errno == EINTR)
+        ;
+      if (nb < 0) {
+        perr("ERROR: read %s - %s\n", path ? path : "stdin", strerror(errno));
+        exit(1);
+      }
+      csv_count_rows(&cnt, 1, buf, nb, qte, esc, nb == 0);
+      total->nbytes += nb;
+    } while (nb > 0);
+  }
 
-  fclose(fp);
+  total->nrows += (header && cnt.nrow) ? cnt.nrow - 1 : cnt.nrow;
+  if (path) {
+    close(fd);
+  }
+}
 
-  printf("      #bytes: %" PRId64 "\n", tot.nbytes);
-  printf("       #rows: %" PRId64 "\n", tot.nrows);
+static void print_json_str(const char *s) {
+  putchar('"');
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      printf("\\%c", *s);
+    } else if ((unsigned char)*s < 0x20) {
+      printf("\\u%04x", *s);
+    } else {
+      putchar(*s);
+    }
+  }
+  putchar('"');
+}
+
+static const double quantiles[] = {0.01, 0.25, 0.5, 0.75, 0.99};
+
+static void print_text(const stat_t *st) {
+  printf("      #bytes: %" PRId64 "\n", st->nbytes);
+  printf("       #rows: %" PRId64 "\n", st->nrows);
   printf("    #columns: ");
-  if (tot.min_ncols == tot.max_ncols) {
-    printf("%d\n", tot.min_ncols);
+  if (st->min_ncols == st->max_ncols) {
+    printf("%d\n", st->min_ncols);
   } else {
-    printf("%d .. %d\n", tot.min_ncols, tot.max_ncols);
+    printf("%d .. %d\n", st->min_ncols, st->max_ncols);
+  }
+  printf("avg row size: %d\n",
+         st->nrows ? (int)(st->nbytes / st->nrows) : 0);
+  printf("min row size: %d\n", st->min_rowsz);
+  printf("max row size: %d\n", st->max_rowsz);
+
+  for (int c = 0; c < st->ncol; c++) {
+    const colstat_t *x = &st->col[c];
+    const int type = colstat_type(x);
+    const int64_t n = x->nval - x->nnull;
+    printf("\n  column %d: %s\n", c + 1, x->name ? x->name : "");
+    printf("        type: %s\n", type < 0 ? "null" : typename[type]);
+    printf("     #values: %" PRId64 "\n", x->nval);
+    printf("      #nulls: %" PRId64 "\n", x->nnull);
+    if (!n) {
+      continue;
+    }
+    printf("   #distinct: ~%.0f\n", hll_estimate(x->hll));
+    printf("  min length: %" PRId64 "\n", x->minlen);
+    printf("  max length: %" PRId64 "\n", x->maxlen);
+    printf("  avg length: %.1f\n", (double)x->sumlen / n);
+    if (type == CSV_INT64) {
+      printf("   min value: %" PRId64 "\n", x->imin);
+      printf("   max value: %" PRId64 "\n", x->imax);
+    } else if (type == CSV_FLOAT64 && x->dds.count) {
+      printf("   min value: %.17g\n", x->fmin);
+      printf("   max value: %.17g\n", x->fmax);
+    }
+    if ((type == CSV_INT64 || type == CSV_FLOAT64) && x->dds.count) {
+      printf("   quantiles:");
+      for (int i = 0; i < (int)(sizeof(quantiles) / sizeof(*quantiles));
+           i++) {
+        printf(" p%g=%.6g", quantiles[i] * 100,
+               colstat_quantile(x, quantiles[i]));
+      }
+      printf("\n");
+    }
   }
-  printf("avg row size: %d\n", (int)(tot.nbytes / tot.nrows));
-  printf("min row size: %d\n", tot.min_rowsz);
-  printf("max row size: %d\n", tot.max_rowsz);
+}
+
+static void print_json(const stat_t *st) {
+  printf("{\"bytes\": %" PRId64 ", \"rows\": %" PRId64 ",\n", st->nbytes,
+         st->nrows);
+  printf(" \"min_columns\": %d, \"max_columns\": %d,\n", st->min_ncols,
+         st->max_ncols);
+  printf(" \"min_row_size\": %d, \"max_row_size\": %d,\n", st->min_rowsz,
+         st->max_rowsz);
+  printf(" \"columns\": [");
+  for (int c = 0; c < st->ncol; c++) {
+    const colstat_t *x = &st->col[c];
+    const int type = colstat_type(x);
+    const int64_t n = x->nval - x->nnull;
+    printf("%s\n  {\"column\": %d, \"name\": ", c ? "," : "", c + 1);
+    if (x->name) {
+      print_json_str(x->name);
+    } else {
+      printf("null");
+    }
+    printf(", \"type\": \"%s\", \"values\": %" PRId64 ", \"nulls\": %" PRId64,
+           type < 0 ? "null" : typename[type], x->nval, x->nnull);
+    if (n) {
+      printf(", \"distinct\": %.0f", hll_estimate(x->hll));
+      printf(", \"min_length\": %" PRId64 ", \"max_length\": %" PRId64
+             ", \"avg_length\": %.17g",
+             x->minlen, x->maxlen, (double)x->sumlen / n);
+    }
+    if (n && type == CSV_INT64) {
+      printf(", \"min\": %" PRId64 ", \"max\": %" PRId64, x->imin, x->imax);
+    } else if (n && type == CSV_FLOAT64 && x->dds.count) {
+      printf(", \"min\": %.17g, \"max\": %.17g", x->fmin, x->fmax);
+    }
+    if (n && (type == CSV_INT64 || type == CSV_FLOAT64) && x->dds.count) {
+      printf(", \"quantiles\": {");
+      for (int i = 0; i < (int)(sizeof(quantiles) / sizeof(*quantiles));
+           i++) {
+        printf("%s\"p%g\": %.17g", i ? ", " : "", quantiles[i] * 100,
+               colstat_quantile(x, quantiles[i]));
+      }
+      printf("}");
+    }
+    printf("}");
+  }
+  printf("%s]}\n", st->ncol ? "\n " : "");
+}
 
+int main(int argc, char *argv[]) {
+  parse_cmdline(argc, argv);
+  dds_lngamma = log((1 + DDS_ALPHA) / (1 - DDS_ALPHA));
+
+  stat_t total = {0};
+  void (*fn)(stat_t *, const char *) = countonly ? count_file : stat_file;
+  if (nfname == 0) {
+    fn(&total, 0);
+  }
+  for (int i = 0; i < nfname; i++) {
+    fn(&total, fname[i]);
+  }
+
+  if (countonly && json) {
+    printf("{\"bytes\": %" PRId64 ", \"rows\": %" PRId64 "}\n",
+           total.nbytes, total.nrows);
+  } else if (countonly) {
+    printf("      #bytes: %" PRId64 "\n", total.nbytes);
+    printf("       #rows: %" PRId64 "\n", total.nrows);
+  } else if (json) {
+    print_json(&total);
+  } else {
+    print_text(&total);
+  }
+  stat_free(&total);
   return 0;
 }
@@ -0,0 +1,233 @@
+#include "csv.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXTHREAD 64
+
+/* the rows printed for one handle */
+typedef struct out_t out_t;
+struct out_t {
+  FILE *fp; /* read by do_read */
+  char *buf;
+  size_t len, cap;
+};
+
+static void fatal(const char *msg) {
+  fprintf(stderr, "%s\n", msg);
+  exit(1);
+}
+
+static void out_add(out_t *out, const char *s, size_t len) {
+  if (out->len + len > out->cap) {
+    size_t cap = out->cap ? out->cap * 2 : 4096;
+    while (cap < out->len + len) {
+      cap *= 2;
+    }
+    if (!(out->buf = realloc(out->buf, cap))) {
+      fatal("out of memory");
+    }
+    out->cap = cap;
+  }
+  memcpy(out->buf + out->len, s, len);
+  out->len += len;
+}
+
+/* print a row as: rownum [f1] [f2] ... */
+static int do_row(intptr_t handle, int64_t rownum, char **field, int nfield) {
+  out_t *out = (out_t *)handle;
+  char num[30];
+  out_add(out, num, sprintf(num, "%" PRId64, rownum));
+  for (int k = 0; k < nfield; k++) {
+    const char *s = field[k] ? field[k] : "(null)";
+    out_add(out, " [", 2);
+    out_add(out, s, strlen(s));
+    out_add(out, "]", 1);
+  }
+  out_add(out, "\n", 1);
+  return 0;
+}
+
+static int do_read(intptr_t handle, char *buf, int bufsz) {
+  out_t *out = (out_t *)handle;
+  return fread(buf, 1, bufsz, out->fp);
+}
+
+static void do_error(intptr_t handle, int errtype, const char *errmsg,
+                     csv_parse_t *cp) {
+  (void)handle;
+  (void)errtype;
+  fatal(cp ? csv_errmsg(cp) : errmsg);
+}
+
+/*
+ * Print the rows of FILE. With nthread > 0, the file is read into
+ * memory and parsed by csv_scan_parallel; otherwise it is parsed by
+ * csv_scan_ex with opt, one row after another. Both print the same.
+ */
+static int scan_file(const char *path, const csv_scanopt_t *opt, int nthread,
+                     int esc) {
+  char nullstr[20];
+  nullstr[0] = 0;
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, "fopen %s - %s\n", path, strerror(errno));
+    exit(1);
+  }
+
+  if (nthread <= 0) {
+    out_t out = {0};
+    out.fp = fp;
+    if (csv_scan_ex(opt, (intptr_t)&out, '"', esc, ',', nullstr, do_read,
+                    do_row, do_error)) {
+      exit(1);
+    }
+    fwrite(out.buf, 1, out.len, stdout);
+    free(out.buf);
+    fclose(fp);
+    return 0;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  const long bufsz = ftell(fp);
+  rewind(fp);
+  char *buf = malloc(bufsz + 1);
+  if (!buf) {
+    fatal("out of memory");
+  }
+  if ((long)fread(buf, 1, bufsz, fp) != bufsz) {
+    fatal("short read");
+  }
+  fclose(fp);
+
+  out_t out[MAXTHREAD] = {{0}};
+  intptr_t handle[MAXTHREAD];
+  for (int i = 0; i < nthread; i++) {
+    handle[i] = (intptr_t)&out[i];
+  }
+  if (csv_scan_parallel(nthread, handle, buf, bufsz, '"', esc, ',', nullstr,
+                        do_row, do_error)) {
+    exit(1);
+  }
+  /* the rows of chunk i follow those of chunk i - 1 */
+  for (int i = 0; i < nthread; i++) {
+    fwrite(out[i].buf, 1, out[i].len, stdout);
+    free(out[i].buf);
+  }
+  free(buf);
+  return 0;
+}
+
+/*
+ * Feed each BUF in turn to one parser with csv_feed, and print what
+ * each call returned. With -a, a buffer that follows a 0 return is
+ * passed as the same row again, by csv_feed_again.
+ *
+ * With -i, index each BUF with csv_sindex instead, into one
+ * csv_sindex_t, and print pos[]; a q marks a field with a quote.
+ *
+ * With -f, print the rows of FILE instead; see scan_file. -b, -g, -m
+ * and -r set bufsz, growpct, maxrowsz and nreadahead of the scan.
+ */
+int main(int argc, char **argv) {
+  int esc = '"';
+  int again = 0;
+  int sindex = 0;
+  int nthread = 0;
+  const char *path = 0;
+  csv_scanopt_t opt = {0};
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    if (0 == strcmp(argv[i], "-a")) {
+      again = 1;
+    } else if (0 == strcmp(argv[i], "-i")) {
+      sindex = 1;
+    } else if (0 == strcmp(argv[i], "-e") && i + 1 < argc) {
+      esc = argv[++i][0];
+    } else if (0 == strcmp(argv[i], "-p") && i + 1 < argc) {
+      nthread = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "-f") && i + 1 < argc) {
+      path = argv[++i];
+    } else if (0 == strcmp(argv[i], "-b") && i + 1 < argc) {
+      opt.bufsz = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "-g") && i + 1 < argc) {
+      opt.growpct = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "-m") && i + 1 < argc) {
+      opt.maxrowsz = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "-r") && i + 1 < argc) {
+      opt.nreadahead = atoi(argv[++i]);
+    } else {
+      break;
+    }
+  }
+  if (nthread < 0 || nthread > MAXTHREAD || (path ? i != argc : i >= argc)) {
+    fprintf(stderr,
+            "usage: %s [-a | -i] [-e esc] buf ...\n"
+            "       %s [-p nthread] [-e esc] -f file\n"
+            "       %s [-b bufsz] [-g growpct] [-m maxrowsz] [-r nreadahead] "
+            "[-e esc] -f file\n",
+            argv[0], argv[0], argv[0]);
+    exit(1);
+  }
+  if (path) {
+    return scan_file(path, &opt, nthread, esc);
+  }
+
+  char nullstr[20];
+  nullstr[0] = 0;
+  csv_parse_t *cp = csv_open('"', esc, ',', nullstr);
+  if (!cp) {
+    fprintf(stderr, "csv_open failed\n");
+    exit(1);
+  }
+
+  if (sindex) {
+    csv_sindex_t ix = {0};
+    for (; i < argc; i++) {
+      if (csv_sindex(cp, argv[i], strlen(argv[i]), &ix)) {
+        printf("%s\n", csv_errmsg(cp));
+        continue;
+      }
+      printf("%d:", ix.npos);
+      for (int k = 0; k < ix.npos; k++) {
+        printf(" %u%s", ix.pos[k] & ~CSV_SINDEX_QUOTED,
+               ix.pos[k] & CSV_SINDEX_QUOTED ? "q" : "");
+      }
+      printf("\n");
+    }
+    csv_sindex_free(&ix);
+    csv_close(cp);
+    return 0;
+  }
+
+  for (; i < argc; i++) {
+    /* a copy, as csv_feed writes to buf[] */
+    const int len = strlen(argv[i]);
+    char *buf = malloc(len + 1);
+    if (!buf) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+    memcpy(buf, argv[i], len + 1);
+    char **field;
+    int nfield;
+    int n = csv_feed(cp, buf, len, &field, &nfield);
+    printf("%d", n);
+    for (int k = 0; k < nfield; k++) {
+      printf(" [%s]", field[k] ? field[k] : "(null)");
+    }
+    printf("\n");
+    if (n < 0) {
+      printf("%s\n", csv_errmsg(cp));
+    }
+    if (n == 0 && again) {
+      csv_feed_again(cp);
+    }
+    free(buf);
+  }
+
+  csv_close(cp);
+  return 0;
+}
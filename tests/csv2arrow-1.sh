@@ -0,0 +1,2 @@
+# Test Case : typed columns in the stream format, named by the header row
+../csv2arrow -H -t i,f,d3,b,D,T,s in/csv2py-8.csv | od -A d -t x1
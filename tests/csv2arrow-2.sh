@@ -0,0 +1,2 @@
+# Test Case : file format, with a dictionary that grows by delta batches
+../csv2arrow -F -D -H -b 2 in/csv2arrow-1.csv | od -A d -t x1
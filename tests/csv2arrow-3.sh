@@ -0,0 +1,4 @@
+# Test Case : empty input still has a schema; bad values report row and column
+../csv2arrow -t i,s < /dev/null | od -A d -t x1
+../csv2arrow -t i in/csv2py-8.csv 2>&1 >/dev/null || echo "exit $?"
+../csv2arrow -t d19 in/csv2py-8.csv 2>&1 >/dev/null || echo "exit $?"
@@ -0,0 +1,2 @@
+# Test Case : typed columns in network byte order; NULLs have length -1
+../csv2pgcopy -H -t i,f,d3,b,D,T,s in/csv2py-8.csv | od -A d -t x1
@@ -0,0 +1,4 @@
+# Test Case : text columns from stdin, numerics, and bad values
+../csv2pgcopy -H < in/csv2arrow-1.csv | od -A d -t x1
+printf '0\n-0.001\n12345.6789\n100000000\n-92233720368.54775808\n' | ../csv2pgcopy -t d8 | od -A d -t x1
+../csv2pgcopy -t s,i in/csv2arrow-1.csv 2>&1 >/dev/null || echo "exit $?"
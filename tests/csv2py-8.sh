@@ -0,0 +1,2 @@
+# Test Case : convert columns to typed values; the last row has no newline
+tail -n +2 in/csv2py-8.csv | ../csv2py -t i,f,d3,b,D,T,s
@@ -0,0 +1,4 @@
+# Test Case : values that do not convert report their row and column
+../csv2py -t i in/csv2py-8.csv 2>&1 || echo "exit $?"
+../csv2py -t s,s,d2 in/csv2py-8.csv 2>&1 || echo "exit $?"
+../csv2py -t s,s,s,s,D in/csv2py-2.csv 2>&1 || echo "exit $?"
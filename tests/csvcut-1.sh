@@ -0,0 +1,3 @@
+# Test Case : select columns; quoted, empty and short rows
+../csvcut -f 1,3 in/csvcut-1.csv
+../csvcut -f 4 in/csvcut-1.csv
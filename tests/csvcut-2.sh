@@ -0,0 +1,3 @@
+# Test Case : ranges are printed in column order
+../csvcut -f 3-4,1 in/csvcut-1.csv
+../csvcut -f 2,2,9 in/csvcut-1.csv
@@ -0,0 +1,2 @@
+# Test Case : pipe delim, backslash escape and nullstr
+../csvcut -d '|' -e '\' -n NULL -f 2-4 in/csvcut-2.csv
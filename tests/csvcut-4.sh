@@ -0,0 +1,2 @@
+# Test Case : columns past the first 64 of a wide row, from stdin
+../csvcut -f 7,63-66,70,80 < in/csvcut-3.csv
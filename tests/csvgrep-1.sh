@@ -0,0 +1,2 @@
+# Test Case : rows with a field containing the pattern
+../csvgrep C1001 in/csvgrep-1.csv
@@ -0,0 +1,4 @@
+# Test Case : exact match and prefix match on one column
+../csvgrep -x -c 2 C1001 in/csvgrep-1.csv
+../csvgrep -p -c 2 C100 in/csvgrep-1.csv
+../csvgrep -c 3 C1001 < in/csvgrep-1.csv
@@ -0,0 +1,3 @@
+# Test Case : pipe delim, backslash escape, nullstr and CR newlines
+../csvgrep -d '|' -e '\' -n NULL 'a"b' in/csvgrep-2.csv | od -c
+../csvgrep -d '|' -e '\' -n NULL -p -c 2 ab in/csvgrep-2.csv | od -c
@@ -0,0 +1,10 @@
+# Test Case : Index Every 2nd Row and Read from an Indexed Row
+set -e
+mkdir -p out
+../csvindex -k 2 -o out/csvindex-1.idx in/csvindex-1.csv
+echo "# from row 3"
+../csvindex -o out/csvindex-1.idx -r 3 in/csvindex-1.csv
+echo "# rows 4 and 5, which start past the indexed row 3"
+../csvindex -o out/csvindex-1.idx -r 4 -c 2 in/csvindex-1.csv
+echo "# past the last row"
+../csvindex -o out/csvindex-1.idx -r 8 in/csvindex-1.csv
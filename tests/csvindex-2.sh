@@ -0,0 +1,8 @@
+# Test Case : A Stale Index is Refused
+mkdir -p out
+cp in/csvindex-1.csv out/csvindex-2.csv
+../csvindex out/csvindex-2.csv
+../csvindex -r 6 out/csvindex-2.csv
+echo '7,gus,new' >> out/csvindex-2.csv
+../csvindex -r 6 out/csvindex-2.csv 2>&1
+exit 0
@@ -0,0 +1,2 @@
+# Test Case : rows terminated by a bare CR
+../csvnorm in/csvnorm-6.csv
@@ -0,0 +1,3 @@
+# Test Case : CRLF file with a stray LF row end is rejected
+../csvnorm in/csvnorm-7.csv 2>&1
+echo "exit $?"
@@ -0,0 +1,13 @@
+# Test Case : split rows with quoted newlines, from a file and from a pipe
+set -e
+mkdir -p out
+
+rm -f out/csvsplit-3-[fp]0*
+../csvsplit -p 2 -b 20 in/csvsplit-3.csv out/csvsplit-3-f
+cat in/csvsplit-3.csv | ../csvsplit -b 20 - out/csvsplit-3-p
+
+for f in out/csvsplit-3-f0*; do
+	echo "# File: $f"
+	cat $f | od -c
+	cmp $f out/csvsplit-3-p${f#out/csvsplit-3-f}
+done
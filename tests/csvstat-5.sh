@@ -0,0 +1,2 @@
+# Test Case : Column Profile with a Header Row
+../csvstat -H in/csvstat-5.csv
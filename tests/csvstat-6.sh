@@ -0,0 +1,2 @@
+# Test Case : JSON Profile Merged over Files
+../csvstat -j -H in/csvstat-5.csv in/csvstat-6.csv
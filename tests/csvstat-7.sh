@@ -0,0 +1,3 @@
+# Test Case : Count Rows Only, with Newlines in Quotes
+../csvstat -c -H in/csvstat-7.csv
+../csvstat -H in/csvstat-7.csv | head -2
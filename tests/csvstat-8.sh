@@ -0,0 +1,16 @@
+# Test Case : Count Rows Only, from stdin and by Threads
+cat in/csvstat-2.csv in/csvstat-7.csv | ../csvstat -c -j
+../csvstat -c -p 4 in/csvstat-1.csv in/csvstat-2.csv in/csvstat-7.csv
+
+# big enough for 4 threads to each count a chunk of their own; the
+# rows are mostly quoted, with CRLFs inside, so chunks start in quotes
+set -e
+mkdir -p out
+awk 'BEGIN {
+	pad = sprintf("%60s", ""); gsub(/ /, "z", pad)
+	for (i = 1; i <= 40000; i++)
+		printf "%d,\"one\r\ntwo \"\"%s\"\"\r\n%s\",x\r\n", i, pad, pad
+}' > out/csvstat-8.csv
+../csvstat -c -j -p 4 out/csvstat-8.csv | tee out/csvstat-8.p4
+../csvstat -c -j -p 1 out/csvstat-8.csv | cmp - out/csvstat-8.p4
+cat out/csvstat-8.csv | ../csvstat -c -j | cmp - out/csvstat-8.p4
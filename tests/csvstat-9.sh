@@ -0,0 +1,2 @@
+# Test Case : Only Decimals Count as Floats
+../csvstat -H in/csvstat-9.csv
@@ -2,7 +2,7 @@
 
 mkdir -p out
 
-for i in csv2py-{1..10}.sh csvecho-{1..10}.sh csvnorm-{1..10}.sh csvsplit-{1..10}.sh csvstat-{1..10}.sh ; do
+for i in csv2arrow-{1..10}.sh csv2pgcopy-{1..10}.sh csv2py-{1..10}.sh csvcut-{1..10}.sh csvecho-{1..10}.sh csvgrep-{1..10}.sh csvindex-{1..10}.sh csvnorm-{1..10}.sh csvsplit-{1..10}.sh csvstat-{1..10}.sh t-{1..10}.sh ; do
 	F=$i
 	if [ -f $F ]; then
 		echo $F
@@ -0,0 +1,8 @@
+# Test Case : unrelated buffers that share a long prefix do not resume a row
+A=AAAAAAAAAAAAAAAAAAAA
+echo "# esc is quote"
+../t "$A,BBBB" "${A}XXXXXXXXXX,Z"$'\n'
+echo "# esc is backslash"
+../t -e '\' "$A,BBBB" "${A}XXXXXXXXXX,Z"$'\n'
+echo "# quoted"
+../t "\"$A,BB" "\"${A}XXXXXXXXXX\",Z"$'\n'
@@ -0,0 +1,8 @@
+# Test Case : csv_feed_again picks up a row passed again with more data
+A=AAAAAAAAAAAAAAAAAAAA
+echo "# esc is quote"
+../t -a "$A,\"BB" "$A,\"BB\"\"CC\",DD"$'\n'
+echo "# esc is backslash"
+../t -a -e '\' "$A,\"BB" "$A,\"BB\\\"CC\",DD"$'\n'
+echo "# the row completed, then an unrelated one"
+../t -a "$A,BB" "$A,BB,CC"$'\n' "${A}XX,Z"$'\n'
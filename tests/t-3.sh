@@ -0,0 +1,24 @@
+# Test Case : csv_scan_parallel gives the rows and row numbers of csv_scan
+# Both inputs are big enough for 8 threads to each parse a chunk of their
+# own. In the first, chunks start inside quoted fields with newlines; in
+# the second, inside runs of doubled quotes, where a chunk cannot tell a
+# quote that opens a field from one that escapes another.
+set -e
+mkdir -p out
+awk 'BEGIN {
+	pad = sprintf("%70s", ""); gsub(/ /, "q", pad)
+	for (i = 1; i <= 52000; i++)
+		printf "%d,\"%s\n%s \"\"%d\"\",\r\n%s\",x%d\n", i, substr(pad, 1, i % 70), pad, i, substr(pad, 1, 70 - i % 70), i % 7
+}' > out/t-3a.csv
+awk 'BEGIN {
+	dq = sprintf("%40s", ""); gsub(/ /, "\"\"", dq)
+	for (i = 1; i <= 64000; i++)
+		printf "%d,\"%s\n%s\",\"%s\"\n", i, substr(dq, 1, 2 * (i % 40)), dq, i % 3 ? "" : "y"
+}' > out/t-3b.csv
+for f in out/t-3a out/t-3b; do
+	../t -f $f.csv > $f.rows
+	wc -l < $f.rows
+	for p in 1 2 4 8; do
+		../t -p $p -f $f.csv | cmp - $f.rows
+	done
+done
@@ -0,0 +1,20 @@
+# Test Case : a scan grows its buffer for a long row, up to maxrowsz, and a
+# runaway unterminated quote fails with "row exceeds"
+mkdir -p out
+awk 'BEGIN {
+	for (i = 0; i < 12000; i++) s = s "a"
+	printf "1,\"%s\"\n2,b\n", s > "out/t-4a.csv"
+	printf "1,x\n2,\"%s%s\n3,y\n", s, s > "out/t-4b.csv"
+}'
+echo "# a 12000 byte row fits in 16384, from 4096 by 50% or 10%"
+../t -f out/t-4a.csv > out/t-4a.rows
+../t -b 4096 -g 50 -m 16384 -f out/t-4a.csv | cmp - out/t-4a.rows && echo ok
+../t -b 4096 -g 10 -m 16384 -r 2 -f out/t-4a.csv | cmp - out/t-4a.rows && echo ok
+echo "# an unterminated quote"
+../t -b 4096 -m 16384 -f out/t-4b.csv 2>&1
+echo "rc=$?"
+../t -b 4096 -g 10 -m 16384 -r 2 -f out/t-4b.csv 2>&1
+echo "rc=$?"
+echo "# below the default maxrowsz, it runs to the end of the input"
+../t -b 4096 -f out/t-4b.csv 2>&1
+echo "rc=$?"
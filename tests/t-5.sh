@@ -0,0 +1,15 @@
+# Test Case : csv_sindex gives the same pos[] in every kernel, across
+# 64 byte blocks, and when one csv_sindex_t is reused
+A=$(printf '%062d' 0)
+B=$(printf 'ab,"c,d",e\n%.0s' 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16)
+set -- 'a,b' 'a,"b,c"'$'\n''d,"e""f"' '"x'$'\n''y",z'$'\r\n' \
+	"$A,\"q,\"\"r"$'\n'"s\",t"$'\n' \
+	"$A"'"",u'$'\n' \
+	"${A:2},\"x\"\"y\",u"$'\n' \
+	"$B" 'a,b' "$B"
+../t -i "$@" > out/t-5.scalar
+cat out/t-5.scalar
+for k in sse42 avx2 avx512; do
+	CSV_SIMD=$k ../t -i "$@" | cmp - out/t-5.scalar
+done
+../t -i -e '\' 'a,b'